@@ -7,6 +7,7 @@ namespace pmkd {
 	public:
 		AABB() { reset(); }
 		AABB(const AABB& b) { ptMin = b.ptMin; ptMax = b.ptMax; }
+		AABB& operator=(const AABB& b) = default;
 		AABB(const vec3f& v) { ptMin = v; ptMax = v; }
 		AABB(const vec3f& vMin, const vec3f& vMax) { ptMin = vMin; ptMax = vMax; }
 		AABB(mfloat minx, mfloat miny, mfloat minz,
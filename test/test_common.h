@@ -117,11 +117,12 @@ vector<AABB> genRanges(size_t n, bool random = true, bool printInfo = true) {
 }
 
 RangeQueryResponses rangeQuery_Brutal(
-    const vector<RangeQuery>& queries, const vector<vec3f>& pts) {
+    const vector<RangeQuery>& queries, const vector<vec3f>& pts,
+    uint32_t capPerResponse = DEFAULT_MAX_SIZE_PER_RANGE_RESPONSE) {
     if (queries.empty()) return RangeQueryResponses(0);
 
     size_t nq = queries.size();
-    RangeQueryResponses responses(nq);
+    RangeQueryResponses responses(nq, capPerResponse);
 
     for (size_t i = 0; i < nq; ++i) {
         auto resp = responses.at(i);
@@ -138,6 +139,52 @@ RangeQueryResponses rangeQuery_Brutal(
     return responses;
 }
 
+RangeQueryResponses radiusQuery_Brutal(
+    const vector<Query>& centers, const vector<mfloat>& radii, const vector<vec3f>& pts) {
+    if (centers.empty()) return RangeQueryResponses(0);
+
+    size_t nq = centers.size();
+    RangeQueryResponses responses(nq);
+
+    for (size_t i = 0; i < nq; ++i) {
+        auto resp = responses.at(i);
+        for (const auto& pt : pts) {
+            if (square_norm(pt - centers[i]) <= radii[i] * radii[i]) {
+                auto& respSize = *(resp.size);
+                resp.pts[respSize++] = pt;
+                if (respSize == responses.capPerResponse) break;
+            }
+        }
+    }
+    return responses;
+}
+
+// sorted squared distances of the k nearest neighbors of each query
+vector<vector<mfloat>> knnQuery_Brutal(const vector<Query>& queries, const vector<vec3f>& pts, int k) {
+    vector<vector<mfloat>> dists(queries.size());
+    parlay::parallel_for(0, queries.size(), [&](size_t i) {
+        vector<mfloat> d(pts.size());
+        for (size_t j = 0; j < pts.size(); ++j) d[j] = square_norm(pts[j] - queries[i]);
+        size_t m = std::min<size_t>(k, d.size());
+        std::partial_sort(d.begin(), d.begin() + m, d.end());
+        dists[i].assign(d.begin(), d.begin() + m);
+    });
+    return dists;
+}
+
+bool isKnnEqual(const KnnQueryResponse& a, const vector<mfloat>& sqDistBrutal, const vector<vec3f>& storedPts,
+    const Query& query) {
+    if (*a.size != sqDistBrutal.size()) return false;
+    for (size_t i = 0; i < *a.size; ++i) {
+        mfloat d = std::sqrt(sqDistBrutal[i]);
+        if (std::abs(a.dist[i] - d) > 1e-4f * (1 + d)) return false;
+        // returned index must point at a stored point with the reported distance
+        mfloat dIdx = length(storedPts[a.idx[i]] - query);
+        if (std::abs(dIdx - a.dist[i]) > 1e-4f * (1 + d)) return false;
+    }
+    return true;
+}
+
 bool isContentEqual(const RangeQueryResponse& a, const RangeQueryResponse& b) {
     bool isNull_a = !a.pts && !a.size;
     bool isNull_b = !b.pts && !b.size;
@@ -187,8 +234,11 @@ void printPMKD_Plain(const PMKDTree& tree) {
         fmt::print("interiors:\n");
         fmt::print("rangeL:\n{}\n", interiors.rangeL);
         fmt::print("rangeR:\n{}\n", interiors.rangeR);
-        fmt::print("splitDim:\n{}\n", interiors.splitDim);
-        fmt::print("splitVal:\n{}\n\n", interiors.splitVal);
+        vector<int> splitDim;
+        vector<mfloat> splitVal;
+        interiors.appendSplits(splitDim, splitVal);
+        fmt::print("splitDim:\n{}\n", splitDim);
+        fmt::print("splitVal:\n{}\n\n", splitVal);
     }
 }
 
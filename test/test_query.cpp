@@ -0,0 +1,556 @@
+#include "test_common.h"
+#include <set>
+
+using namespace pmkd;
+
+int main(int argc, char* argv[]) {
+    int N = argc > 1 ? std::stoi(argv[1]) : 1000;
+    int K = argc > 2 ? std::stoi(argv[2]) : 8;
+    bool verbose = argc > 3 ? std::string(argv[3]) == "-v" : false;
+
+    AABB bound(-30, -30, -30, 30, 30, 30);
+    PMKD_Config config;
+    config.globalBoundary = bound;
+
+    auto pts = genPts(N, false, false, bound);
+    auto ptsAdd1 = genPts(N / 5, false, false, bound);
+    auto ptsAdd2 = genPts(N / 5, false, false, bound);
+    auto ptQueries = genPts(N / 3, false, false, bound);
+
+    vector<vec3f> ptRemove(pts.begin(), pts.begin() + pts.size() / 2);
+    vector<vec3f> ptRemain(pts.begin() + pts.size() / 2, pts.end());
+    ptRemain.insert(ptRemain.end(), ptsAdd1.begin(), ptsAdd1.end());
+    ptRemain.insert(ptRemain.end(), ptsAdd2.begin(), ptsAdd2.end());
+
+    PMKDTree* tree = new PMKDTree(config);
+
+    auto checkKnn = [&](const vector<vec3f>& truth) {
+        KnnQueryResponses resps(0, 0);
+        mTimer("kNN Search Time", [&] { resps = tree->knnQuery(ptQueries, K); });
+        auto brutal = knnQuery_Brutal(ptQueries, truth, K);
+        auto stored = tree->getStoredPoints();
+
+        int nErr = 0;
+        for (size_t i = 0; i < resps.size(); ++i) {
+            size_t j = resps.queryIdx[i];
+            if (!isKnnEqual(resps.at(i), brutal[j], stored, ptQueries[j])) {
+                ++nErr;
+                if (verbose) loge("kNN of ({:.3f}, {:.3f}, {:.3f}) is incorrect", ptQueries[j].x, ptQueries[j].y, ptQueries[j].z);
+            }
+        }
+        fmtlog::poll();
+        fmt::print("{}/{} Failures\n\n", nErr, resps.size());
+    };
+
+    vector<mfloat> radii(ptQueries.size());
+    for (size_t i = 0; i < radii.size(); ++i) radii[i] = 0.25f * (1 + i % 6);
+
+    auto checkRadius = [&](const vector<vec3f>& truth) {
+        RangeQueryResponses resps(0);
+        mTimer("Radius Search Time", [&] { resps = tree->radiusQuery(ptQueries, radii); });
+        auto brutal = radiusQuery_Brutal(ptQueries, radii, truth);
+
+        std::set<std::tuple<mfloat, mfloat, mfloat>> truthSet;
+        for (const auto& pt : truth) truthSet.insert({ pt.x, pt.y, pt.z });
+
+        int nErr = 0;
+        for (size_t i = 0; i < resps.size(); ++i) {
+            auto resp = resps.at(i);
+            bool ok;
+            if (*brutal.at(i).size < resps.capPerResponse) ok = isContentEqual(resp, brutal.at(i));
+            else {
+                // 截断的结果取决于遍历顺序, 只检查数量以及每个点都在球内且属于真值
+                ok = *resp.size == resps.capPerResponse;
+                for (uint32_t j = 0; ok && j < *resp.size; ++j) {
+                    const auto& pt = resp.pts[j];
+                    ok = square_norm(pt - ptQueries[i]) <= radii[i] * radii[i] && truthSet.count({ pt.x, pt.y, pt.z }) > 0;
+                }
+            }
+            if (!ok) {
+                ++nErr;
+                if (verbose) loge("radius query around ({:.3f}, {:.3f}, {:.3f}) is incorrect", ptQueries[i].x, ptQueries[i].y, ptQueries[i].z);
+            }
+        }
+        fmtlog::poll();
+        fmt::print("{}/{} Failures\n\n", nErr, resps.size());
+    };
+
+    auto rangeQueries = genRanges(N / 3, false, false);
+
+    auto checkCompact = [&](const vector<vec3f>& truth) {
+        CompactRangeQueryResponses resps(0);
+        mTimer("Compact Range Search Time", [&] { resps = tree->compactQuery(rangeQueries); });
+        auto brutal = rangeQuery_Brutal(rangeQueries, truth, truth.size());
+
+        int nErr = 0;
+        for (size_t i = 0; i < resps.size(); ++i) {
+            if (!isContentEqual(resps.at(i), brutal.at(i))) {
+                ++nErr;
+                if (verbose) loge("compact range query {} is incorrect", rangeQueries[i].toString());
+            }
+        }
+        fmtlog::poll();
+        fmt::print("{}/{} Failures\n\n", nErr, resps.size());
+    };
+
+    // large ranges let whole subtrees be counted at once
+    auto countQueries = rangeQueries;
+    for (const auto& q : rangeQueries) countQueries.emplace_back(q.center() - vec3f(8), q.center() + vec3f(8));
+
+    auto checkCount = [&](const vector<vec3f>& truth) {
+        vector<uint32_t> counts;
+        mTimer("Range Count Time", [&] { counts = tree->countQuery(countQueries); });
+
+        int nErr = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            const auto& q = countQueries[i];
+            size_t expected = std::count_if(truth.begin(), truth.end(), [&](const vec3f& pt) { return q.include(pt); });
+            if (counts[i] != expected) {
+                ++nErr;
+                if (verbose) loge("range count {} is {}, expected {}", q.toString(), counts[i], expected);
+            }
+        }
+        fmtlog::poll();
+        fmt::print("{}/{} Failures\n\n", nErr, counts.size());
+    };
+
+    auto checkIndex = [&](const vector<vec3f>& truth) {
+        RangeIndexQueryResponses resps(0);
+        mTimer("Range Index Search Time", [&] { resps = tree->indexQuery(rangeQueries); });
+        // truncated responses depend on traversal order, so compare with the point query
+        auto expected = tree->query(rangeQueries);
+        auto stored = tree->getStoredPoints();
+        std::set<std::tuple<mfloat, mfloat, mfloat>> truthSet;
+        for (const auto& pt : truth) truthSet.insert({ pt.x, pt.y, pt.z });
+
+        // resolve indices to points
+        RangeQueryResponses resolved(resps.size());
+        for (size_t i = 0; i < resps.size(); ++i) {
+            auto resp = resps.at(i);
+            auto dst = resolved.at(i);
+            *dst.size = *resp.size;
+            for (uint32_t j = 0; j < *resp.size; ++j) dst.pts[j] = stored[resp.idx[j]];
+        }
+
+        int nErr = 0;
+        for (size_t i = 0; i < resps.size(); ++i) {
+            const auto& q = rangeQueries[resps.queryIdx[i]];
+            auto resp = resolved.at(i);
+            // 每个结果都应在查询框内且属于真值, 未截断的结果数量应与真值一致
+            bool ok = isContentEqual(resp, expected.at(i));
+            for (uint32_t j = 0; ok && j < *resp.size; ++j) {
+                const auto& pt = resp.pts[j];
+                ok = q.include(pt) && truthSet.count({ pt.x, pt.y, pt.z }) > 0;
+            }
+            if (ok && *resp.size < resps.capPerResponse) {
+                ok = *resp.size == size_t(std::count_if(truth.begin(), truth.end(), [&](const vec3f& pt) { return q.include(pt); }));
+            }
+            if (!ok) {
+                ++nErr;
+                if (verbose) loge("range index query {} is incorrect", q.toString());
+            }
+        }
+        fmtlog::poll();
+        fmt::print("{}/{} Failures\n\n", nErr, resps.size());
+    };
+
+    auto checkVisitor = [&](const vector<vec3f>& truth) {
+        auto stored = tree->getStoredPoints();
+        vector<uint32_t> counts(rangeQueries.size(), 0);
+        vector<uint8_t> mismatch(rangeQueries.size(), 0);
+        mTimer("Range Visit Time", [&] {
+            tree->forEachInRange(rangeQueries, [&](int qIdx, const vec3f& pt, int ptIdx) {
+                ++counts[qIdx];
+                if (!(stored[ptIdx] == pt) || !rangeQueries[qIdx].include(pt)) mismatch[qIdx] = 1;
+                });
+            });
+
+        int nErr = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            const auto& q = rangeQueries[i];
+            size_t expected = std::count_if(truth.begin(), truth.end(), [&](const vec3f& pt) { return q.include(pt); });
+            if (mismatch[i] || counts[i] != expected) {
+                ++nErr;
+                if (verbose) loge("range visit {} is incorrect", q.toString());
+            }
+        }
+        fmtlog::poll();
+        fmt::print("{}/{} Failures\n\n", nErr, counts.size());
+    };
+
+    // payload of a point is its index in allPts
+    vector<vec3f> allPts(pts);
+    allPts.insert(allPts.end(), ptsAdd1.begin(), ptsAdd1.end());
+    allPts.insert(allPts.end(), ptsAdd2.begin(), ptsAdd2.end());
+    auto genPayloads = [](size_t begin, size_t size) {
+        vector<Payload> payloads(size);
+        for (size_t i = 0; i < size; ++i) payloads[i] = begin + i;
+        return payloads;
+    };
+
+    auto checkPayload = [&]() {
+        auto stored = tree->getStoredPoints();
+        auto payloads = tree->getStoredPayloads();
+
+        int nErr = stored.size() == payloads.size() ? 0 : 1;
+        for (size_t i = 0; i < stored.size() && nErr == 0; ++i) {
+            if (payloads[i] >= allPts.size() || !(allPts[payloads[i]] == stored[i])) ++nErr;
+            if (tree->getPayload(i) != payloads[i]) ++nErr;
+        }
+        fmtlog::poll();
+        fmt::print("{}/{} Failures\n\n", nErr, stored.size());
+    };
+
+    fmt::print("kNN测试-静态树\n");
+    tree->firstInsert(pts);
+    checkKnn(pts);
+
+    fmt::print("球形范围查询测试-静态树\n");
+    checkRadius(pts);
+
+    fmt::print("紧凑范围查询测试-静态树\n");
+    checkCompact(pts);
+
+    fmt::print("范围计数测试-静态树\n");
+    checkCount(pts);
+
+    fmt::print("索引范围查询测试-静态树\n");
+    checkIndex(pts);
+
+    fmt::print("范围遍历测试-静态树\n");
+    checkVisitor(pts);
+
+    fmt::print("kNN测试-插入+删除+插入\n");
+    tree->destroy();
+    tree->firstInsert(pts);
+    tree->remove(ptRemove);
+    tree->insert(ptsAdd1);
+    tree->insert(ptsAdd2);
+    checkKnn(ptRemain);
+
+    fmt::print("球形范围查询测试-插入+删除+插入\n");
+    checkRadius(ptRemain);
+
+    fmt::print("紧凑范围查询测试-插入+删除+插入\n");
+    checkCompact(ptRemain);
+
+    fmt::print("范围计数测试-插入+删除+插入\n");
+    checkCount(ptRemain);
+
+    fmt::print("索引范围查询测试-插入+删除+插入\n");
+    checkIndex(ptRemain);
+
+    fmt::print("范围遍历测试-插入+删除+插入\n");
+    checkVisitor(ptRemain);
+
+    fmt::print("负载测试-插入+删除+插入\n");
+    tree->destroy();
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->remove(ptRemove);
+    tree->insert(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->execute(ptRemove, ptsAdd2, genPayloads(pts.size() + ptsAdd1.size(), ptsAdd2.size()));
+    checkPayload();
+
+    fmt::print("负载测试-静态插入+删除\n");
+    tree->destroy();
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->insert_v2(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->remove_v2(ptRemove);
+    checkPayload();
+
+    fmt::print("重建测试-插入+删除+插入\n");
+    delete tree;
+    config.maxNumBatches = 2;
+    config.maxRemovedRatio = 0.4f;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->remove(ptRemove);  // rebuilt upon remove
+    tree->insert(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->insert(ptsAdd2, genPayloads(pts.size() + ptsAdd1.size(), ptsAdd2.size()));  // rebuilt upon insert
+    fmt::print("{}/{} Failures\n\n", tree->getStoredPoints().size() == ptRemain.size() ? 0 : 1, 1);
+    checkKnn(ptRemain);
+    checkCount(ptRemain);
+    checkPayload();
+
+    fmt::print("重建测试-插入+融合更新\n");
+    tree->destroy();
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->insert(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->execute(ptRemove, ptsAdd2, genPayloads(pts.size() + ptsAdd1.size(), ptsAdd2.size()));  // rebuilt upon the fused update
+    fmt::print("{}/{} Failures\n\n", tree->getStoredPoints().size() == ptRemain.size() ? 0 : 1, 1);
+    checkKnn(ptRemain);
+    checkCount(ptRemain);
+    checkPayload();
+
+    fmt::print("分层合并测试-多次插入+删除\n");
+    delete tree;
+    config = PMKD_Config();
+    config.globalBoundary = bound;
+    config.levelRatio = 2;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    for (size_t i = 0; i < 4; ++i) {
+        size_t begin = ptsAdd1.size() * i / 4, end = ptsAdd1.size() * (i + 1) / 4;
+        tree->insert(vector<vec3f>(ptsAdd1.begin() + begin, ptsAdd1.begin() + end), genPayloads(pts.size() + begin, end - begin));
+    }
+    tree->remove(ptRemove);
+    for (size_t i = 0; i < 4; ++i) {
+        size_t begin = ptsAdd2.size() * i / 4, end = ptsAdd2.size() * (i + 1) / 4;
+        tree->insert(vector<vec3f>(ptsAdd2.begin() + begin, ptsAdd2.begin() + end),
+            genPayloads(pts.size() + ptsAdd1.size() + begin, end - begin));
+    }
+    checkKnn(ptRemain);
+    checkCount(ptRemain);
+    checkIndex(ptRemain);
+    checkPayload();
+
+    // point queries over allPts, a point exists iff it is in truth
+    auto checkPoint = [&](const vector<vec3f>& truth) {
+        auto resps = tree->query(allPts);
+        std::set<std::tuple<mfloat, mfloat, mfloat>> stored;
+        for (const auto& pt : truth) stored.insert({ pt.x, pt.y, pt.z });
+        int nErr = 0;
+        for (size_t i = 0; i < resps.size(); ++i) {
+            const auto& pt = allPts[resps.queryIdx[i]];
+            if (bool(resps.exist[i]) != (stored.count({ pt.x, pt.y, pt.z }) > 0)) ++nErr;
+        }
+        fmt::print("{}/{} Failures\n\n", nErr, resps.size());
+    };
+
+    fmt::print("归并连接点查询测试-静态树\n");
+    delete tree;
+    config.levelRatio = 0;
+    config.pointQueryEngine = PointQueryEngine::MergeJoin;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts);
+    checkPoint(pts);
+    config.pointQueryEngine = PointQueryEngine::Traversal;
+
+    fmt::print("Morton区间范围查询测试-静态树\n");
+    {
+        // both engines visit leaves in order, so even truncated responses match the traversal
+        auto expected = tree->query(rangeQueries);
+        int nErr = 0;
+        for (auto engine : { RangeQueryEngine::MortonScan, RangeQueryEngine::Auto }) {
+            delete tree;
+            config.rangeQueryEngine = engine;
+            tree = new PMKDTree(config);
+            tree->firstInsert(pts);
+            auto resps = tree->query(rangeQueries);
+            for (size_t i = 0; i < resps.size(); ++i)
+                if (!isContentEqual(resps.at(i), expected.at(i))) ++nErr;
+        }
+        fmt::print("{}/{} Failures\n\n", nErr, 2 * rangeQueries.size());
+        config.rangeQueryEngine = RangeQueryEngine::Traversal;
+    }
+
+    fmt::print("SIMD分组遍历测试-插入+删除+插入\n");
+    delete tree;
+    config.packetTraversal = true;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts);
+    checkPoint(pts);
+    tree->remove(ptRemove);
+    tree->insert(ptsAdd1);
+    tree->execute(vector<vec3f>{}, ptsAdd2);
+    checkPoint(ptRemain);
+    checkCount(ptRemain);
+    config.packetTraversal = false;
+
+    fmt::print("分组预取查询测试-静态树\n");
+    {
+        delete tree;
+        tree = new PMKDTree(config);
+        tree->firstInsert(pts);
+        auto expected = tree->query(rangeQueries);  // truncated responses follow the leaf order in both modes
+        delete tree;
+        config.prefetchGroupSize = 16;
+        tree = new PMKDTree(config);
+        tree->firstInsert(pts);
+        auto resps = tree->query(rangeQueries);
+        int nErr = 0;
+        for (size_t i = 0; i < resps.size(); ++i)
+            if (!isContentEqual(resps.at(i), expected.at(i))) ++nErr;
+        fmt::print("{}/{} Failures\n\n", nErr, resps.size());
+        checkPoint(pts);
+        config.prefetchGroupSize = 0;
+    }
+
+    fmt::print("分桶叶子测试-静态树\n");
+    auto configNoBucket = config;
+    {
+        delete tree;
+        tree = new PMKDTree(config);
+        tree->firstInsert(pts);
+        auto expectedPts = tree->query(ptQueries);
+        auto expectedRanges = tree->query(rangeQueries);
+        vector<uint8_t> expectedExist(ptQueries.size());
+        for (size_t i = 0; i < expectedPts.size(); ++i) expectedExist[expectedPts.queryIdx[i]] = expectedPts.exist[i];
+
+        delete tree;
+        config.bucketSize = 16;
+        tree = new PMKDTree(config);
+        tree->firstInsert(pts, genPayloads(0, pts.size()));
+
+        // 存储的点都应找到, 其余点与不分桶的树一致
+        vector<vec3f> pq = pts;
+        pq.insert(pq.end(), ptQueries.begin(), ptQueries.end());
+        auto bPts = tree->query(pq);
+        int nErr = 0;
+        for (size_t i = 0; i < bPts.size(); ++i) {
+            size_t j = bPts.queryIdx[i];
+            if (j < pts.size() ? !bPts.exist[i] : bPts.exist[i] != expectedExist[j - pts.size()]) ++nErr;
+        }
+        fmt::print("{}/{} Failures\n\n", nErr, pq.size());
+
+        auto bRanges = tree->query(rangeQueries);
+        nErr = 0;
+        for (size_t i = 0; i < bRanges.size(); ++i)
+            if (!isContentEqual(bRanges.at(i), expectedRanges.at(i))) ++nErr;
+        fmt::print("{}/{} Failures\n\n", nErr, bRanges.size());
+    }
+    checkKnn(pts);
+    checkRadius(pts);
+    checkCompact(pts);
+    checkCount(pts);
+    checkIndex(pts);
+    checkVisitor(pts);
+    checkPayload();
+
+    fmt::print("分桶叶子测试-插入+删除+插入\n");
+    tree->remove(ptRemove);
+    tree->insert(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->execute(vector<vec3f>{}, ptsAdd2, genPayloads(pts.size() + ptsAdd1.size(), ptsAdd2.size()));
+    checkPoint(ptRemain);
+    checkKnn(ptRemain);
+    checkRadius(ptRemain);
+    checkCount(ptRemain);
+    checkIndex(ptRemain);
+    checkVisitor(ptRemain);
+    checkPayload();
+
+    fmt::print("分桶叶子测试-静态插入+删除\n");
+    {
+        delete tree;
+        tree = new PMKDTree(config);
+        tree->firstInsert(pts, genPayloads(0, pts.size()));
+        tree->insert_v2(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+        tree->remove_v2(ptRemove);
+        vector<vec3f> truth(ptRemain.begin(), ptRemain.end() - ptsAdd2.size());
+        checkPoint(truth);
+        checkCount(truth);
+        checkPayload();
+    }
+
+    fmt::print("分桶叶子测试-重建\n");
+    delete tree;
+    config.maxNumBatches = 2;
+    config.maxRemovedRatio = 0.4f;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->remove(ptRemove);  // rebuilt upon remove
+    tree->insert(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->insert(ptsAdd2, genPayloads(pts.size() + ptsAdd1.size(), ptsAdd2.size()));  // rebuilt upon insert
+    checkPoint(ptRemain);
+    checkKnn(ptRemain);
+    checkCount(ptRemain);
+    checkPayload();
+    config = configNoBucket;
+
+    fmt::print("点索引测试-插入+删除+插入\n");
+    delete tree;
+    config.indexPoints = true;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts);
+    tree->remove(ptRemove);
+    tree->remove(ptRemove);  // not stored any more, must be a no-op
+    tree->insert(ptsAdd1);
+    tree->execute(vector<vec3f>{}, ptsAdd2);
+    checkPoint(ptRemain);
+    checkCount(ptRemain);
+
+    fmt::print("点索引测试-静态插入+删除\n");
+    delete tree;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts);
+    tree->insert_v2(ptsAdd1);
+    tree->remove_v2(ptRemove);  // rebuilds the main tree
+    tree->insert(ptsAdd2);
+    checkPoint(ptRemain);
+    checkCount(ptRemain);
+
+    fmt::print("点索引测试-融合更新删除不存在的点\n");
+    {
+        delete tree;
+        tree = new PMKDTree(config);
+        tree->firstInsert(pts);
+        // 偏移后的点不在树中, 删除后原来的点应仍然存在
+        const vec3f& p = pts[0];
+        tree->execute({ p + vec3f(1e-4, 0, 0) }, ptsAdd1);
+        auto exist = tree->query(vector<vec3f>{ p });
+        auto around = tree->countQuery({ AABB(p - vec3f(1e-5, 1e-5, 1e-5), p + vec3f(1e-5, 1e-5, 1e-5)) });
+        int nErr = !exist.exist[0] || around[0] == 0 ? 1 : 0;
+        fmt::print("{}/1 Failures\n\n", nErr);
+
+        vector<vec3f> truth(pts);
+        truth.insert(truth.end(), ptsAdd1.begin(), ptsAdd1.end());
+        checkPoint(truth);
+        checkCount(truth);
+    }
+    config.indexPoints = false;
+
+    fmt::print("异步重建测试-插入+删除+插入\n");
+    config.levelRatio = 0;
+    config.maxNumBatches = 2;
+    config.maxRemovedRatio = 0.4f;
+    delete tree;
+    config.asyncRebuild = true;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->remove(ptRemove);  // compaction starts in the background
+    tree->insert(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->execute(vector<vec3f>{}, ptsAdd2, genPayloads(pts.size() + ptsAdd1.size(), ptsAdd2.size()));
+    checkCount(ptRemain);
+    tree->finishCompaction();
+    fmt::print("{}/{} Failures\n\n", tree->isCompacting() ? 1 : 0, 1);
+    checkKnn(ptRemain);
+    checkCount(ptRemain);
+    checkPayload();
+
+    // 后台整理期间的插入不触发分级合并，整理读取的批次保持不变
+    fmt::print("异步重建测试-分级合并\n");
+    config.levelRatio = 2;
+    config.maxNumBatches = 8;
+    delete tree;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->remove(ptRemove);
+    tree->insert(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    tree->insert(ptsAdd2, genPayloads(pts.size() + ptsAdd1.size(), ptsAdd2.size()));
+    checkCount(ptRemain);
+    tree->finishCompaction();
+    fmt::print("{}/{} Failures\n\n", tree->isCompacting() ? 1 : 0, 1);
+    checkKnn(ptRemain);
+    checkCount(ptRemain);
+    checkPayload();
+
+    // 合并式插入会改写整理读取的批次
+    fmt::print("异步重建测试-静态插入\n");
+    delete tree;
+    tree = new PMKDTree(config);
+    tree->firstInsert(pts, genPayloads(0, pts.size()));
+    tree->compactAsync();
+    tree->insert_v2(ptsAdd1, genPayloads(pts.size(), ptsAdd1.size()));
+    fmt::print("{}/{} Failures\n\n", tree->isCompacting() ? 1 : 0, 1);
+    {
+        vector<vec3f> truth(pts);
+        truth.insert(truth.end(), ptsAdd1.begin(), ptsAdd1.end());
+        checkKnn(truth);
+        checkCount(truth);
+        checkPayload();
+    }
+
+    fmt::print("All done!\n");
+    delete tree;
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <string>
 #include <auth/verify.h>
+#include <auth/serialize.h>
 
 #include "test_common.h"
 
@@ -96,6 +97,110 @@ int main(int argc, char* argv[]) {
     });
     fmt::print("{}/{} Failures\n", nErr, veriResps.size());
 
+    vector<uint8_t> correct;
+    mTimer("平均验证用时-批量", 1.0 / veriResps.size(), [&] {
+        correct = verifyRangeQueries(rootHash, veriResps);
+    });
+    nErr = 0;
+    for (size_t i = 0; i < correct.size(); ++i) {
+        nErr += 1 - correct[i];
+        if (!correct[i] && verbose) {
+            fmt::print("Incorrect Range {}:\n", rangeQueries[veriResps.queryIdx[i]].toString());
+        }
+    }
+    fmt::print("{}/{} Failures\n", nErr, veriResps.size());
+
+    // 延迟维护哈希，结果应与立即维护相同
+    fmt::print("延迟Merkle: 插入-删除-插入\n");
+    PMKD_Config lazyConfig = config;
+    lazyConfig.lazyMerkle = true;
+    PMKDTree lazyTree(lazyConfig);
+    lazyTree.firstInsert(pts);
+    lazyTree.remove(ptRemove);
+    lazyTree.insert(ptsAdd1);
+    lazyTree.insert(ptsAdd2);
+
+    auto lazyResps = lazyTree.verifiableQuery(rangeQueries);
+    hash_t lazyRootHash = lazyTree.getRootHash();
+    nErr = !equal(rootHash, lazyRootHash);
+    for (size_t i = 0; i < lazyResps.size(); ++i) {
+        size_t j = lazyResps.queryIdx[i];
+        nErr += 1 - verifyRangeQuery(lazyRootHash, rangeQueries[j], lazyResps, i, table);
+    }
+    fmt::print("{}/{} Failures\n", nErr, lazyResps.size() + 1);
+
+    // 压缩编码，共享节点只保存一次
+    auto bytes = serializeResponses(veriResps);
+    auto decoded = deserializeResponses(bytes.data(), bytes.size());
+    const auto& vs = veriResps.vs;
+    size_t rawSize = vs.fNodes.size() * (sizeof(vec3f) + 1 + sizeof(int))
+        + vs.mNodes.size() * (3 * sizeof(int) + sizeof(mfloat) + 1)
+        + vs.hNodes.size() * (sizeof(hash_t) + sizeof(int));
+    fmt::print("证明编码: {} -> {} bytes\n", rawSize, bytes.size());
+    nErr = decoded.size() != veriResps.size();
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        size_t j = decoded.queryIdx[i];
+        nErr += 1 - verifyRangeQuery(rootHash, rangeQueries[j], decoded, i, table);
+    }
+    fmt::print("{}/{} Failures\n", nErr, decoded.size() + 1);
+
+    // 篡改一个叶子后应无法通过验证
+    for (size_t i = 0; i < decoded.size(); ++i) {
+        size_t fEnd = i < decoded.size() - 1 ? decoded.fOffset[i + 1] : decoded.vs.fNodes.size();
+        if (decoded.fOffset[i] == fEnd) continue;
+        decoded.vs.fNodes.pt[decoded.fOffset[i]].x += 1;
+        nErr = verifyRangeQueries(rootHash, decoded)[i];
+        fmt::print("{}/{} Failures\n", nErr, 1);
+        break;
+    }
+
+    // 去掉一个H节点后应无法通过验证
+    auto dropped = deserializeResponses(bytes.data(), bytes.size());
+    auto& hNodes = dropped.vs.hNodes;
+    for (size_t i = 0; i < dropped.size(); ++i) {
+        size_t hEnd = i < dropped.size() - 1 ? dropped.hOffset[i + 1] : hNodes.size();
+        if (dropped.hOffset[i] == int(hEnd)) continue;
+        hNodes.hash.erase(hNodes.hash.begin() + dropped.hOffset[i]);
+        hNodes.parentCode.erase(hNodes.parentCode.begin() + dropped.hOffset[i]);
+        for (size_t j = i + 1; j < dropped.size(); ++j) --dropped.hOffset[j];
+        nErr = verifyRangeQueries(rootHash, dropped)[i];
+        fmt::print("{}/{} Failures\n", nErr, 1);
+        break;
+    }
+
+    // 分桶叶子的证明给出桶内的全部点
+    fmt::print("分桶叶子: 静态树, 插入-删除-插入\n");
+    PMKD_Config bucketConfig = config;
+    bucketConfig.bucketSize = 8;
+    PMKDTree bucketTree(bucketConfig);
+    auto checkBucketTree = [&]() {
+        auto resps = bucketTree.verifiableQuery(rangeQueries);
+        hash_t hash = bucketTree.getRootHash();
+        auto batchCorrect = verifyRangeQueries(hash, resps);
+        int nErr = 0;
+        for (size_t i = 0; i < resps.size(); ++i) {
+            size_t j = resps.queryIdx[i];
+            nErr += 1 - batchCorrect[i];
+            nErr += 1 - verifyRangeQuery_Sequential(hash, rangeQueries[j], resps, i, table);
+            nErr += 1 - verifyRangeQuery(hash, rangeQueries[j], resps, i, table);
+        }
+        fmt::print("{}/{} Failures\n", nErr, 3 * resps.size());
+    };
+    bucketTree.firstInsert(pts);
+    checkBucketTree();
+    bucketTree.remove(ptRemove);
+    bucketTree.insert(ptsAdd1);
+    bucketTree.insert(ptsAdd2);
+    checkBucketTree();
+
+    bucketConfig.lazyMerkle = true;
+    PMKDTree lazyBucketTree(bucketConfig);
+    lazyBucketTree.firstInsert(pts);
+    lazyBucketTree.remove(ptRemove);
+    lazyBucketTree.insert(ptsAdd1);
+    lazyBucketTree.insert(ptsAdd2);
+    fmt::print("{}/{} Failures\n", equal(bucketTree.getRootHash(), lazyBucketTree.getRootHash()) ? 0 : 1, 1);
+
     delete tree;
 #endif
     
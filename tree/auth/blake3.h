@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace pmkd {
+    // BLAKE3 inputs of up to one chunk, which covers every node message
+    constexpr size_t BLAKE3_CHUNK_LEN = 1024;
+
+    // digest = the first outLen <= 32 bytes of BLAKE3 of msg, len <= BLAKE3_CHUNK_LEN
+    void blake3(const uint8_t* msg, size_t len, uint8_t* digest, size_t outLen);
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <string.h>
+
+#include <auth/sha.h>
+#include <auth/blake3.h>
+
+namespace pmkd {
+    template<size_t N>
+    struct digest_t {
+        uint8_t byte[N];
+    };
+
+    template<size_t N>
+    inline bool equal(const digest_t<N>& a, const digest_t<N>& b) {
+        return memcmp(a.byte, b.byte, N) == 0;
+    }
+
+    // hash policies of the Merkle tree
+    // DIGEST_SIZE <= 32, shorter digests are prefixes of the full ones
+    // hashLanes hashes n <= DIGEST_LANES messages of the same length
+    constexpr int DIGEST_LANES = SHA256_LANES;
+
+    template<size_t N = 32>
+    struct SHA256Hash {
+        static_assert(N > 0 && N <= 32);
+        static constexpr size_t DIGEST_SIZE = N;
+
+        static void hash(const uint8_t* msg, size_t len, uint8_t* digest) {
+            if constexpr (N == 32) sha256(msg, len, digest);
+            else {
+                uint8_t full[32];
+                sha256(msg, len, full);
+                memcpy(digest, full, N);
+            }
+        }
+
+        static void hashLanes(const uint8_t* const msgs[], size_t len, int n, uint8_t* const digests[]) {
+            if constexpr (N == 32) sha256Lanes(msgs, len, n, digests);
+            else {
+                uint8_t full[DIGEST_LANES][32];
+                uint8_t* fullPtr[DIGEST_LANES];
+                for (int i = 0; i < n; i++) fullPtr[i] = full[i];
+                sha256Lanes(msgs, len, n, fullPtr);
+                for (int i = 0; i < n; i++) memcpy(digests[i], full[i], N);
+            }
+        }
+    };
+
+    template<size_t N = 32>
+    struct BLAKE3Hash {
+        static_assert(N > 0 && N <= 32);
+        static constexpr size_t DIGEST_SIZE = N;
+
+        static void hash(const uint8_t* msg, size_t len, uint8_t* digest) {
+            blake3(msg, len, digest, N);
+        }
+
+        static void hashLanes(const uint8_t* const msgs[], size_t len, int n, uint8_t* const digests[]) {
+            for (int i = 0; i < n; i++) blake3(msgs[i], len, digests[i], N);
+        }
+    };
+
+    // the policy the tree is built with, see CMakeLists.txt
+#ifdef MERKLE_DIGEST_16
+    constexpr size_t MERKLE_DIGEST_SIZE = 16;
+#else
+    constexpr size_t MERKLE_DIGEST_SIZE = 32;
+#endif
+
+#ifdef MERKLE_HASH_BLAKE3
+    using MerkleHash = BLAKE3Hash<MERKLE_DIGEST_SIZE>;
+#else
+    using MerkleHash = SHA256Hash<MERKLE_DIGEST_SIZE>;
+#endif
+
+    using hash_t = digest_t<MerkleHash::DIGEST_SIZE>;
+
+    // messages hashed into the digests of nodes, return their lengths
+    // leaf node
+    inline size_t encodeLeafMessage(uint8_t* data, float x, float y, float z, bool removed) {
+        memcpy(data, &x, 4);
+        memcpy(data + 4, &y, 4);
+        memcpy(data + 8, &z, 4);
+        data[12] = uint8_t(removed);
+        return 13;
+    }
+
+    inline size_t encodeLeafMessage(uint8_t* data, double x, double y, double z, bool removed) {
+        memcpy(data, &x, 8);
+        memcpy(data + 8, &y, 8);
+        memcpy(data + 16, &z, 8);
+        data[24] = uint8_t(removed);
+        return 25;
+    }
+
+    // interior node
+    template<size_t N>
+    inline size_t encodeInteriorMessage(uint8_t* data, const digest_t<N>* lcDigest, const digest_t<N>* rcDigest, int dimension, float value, uint8_t removeState) {
+        memcpy(data, lcDigest->byte, N);
+        memcpy(data + N, rcDigest->byte, N);
+        memcpy(data + N * 2, &value, 4);
+        data[N * 2 + 4] = uint8_t(dimension);
+        data[N * 2 + 5] = removeState;
+        return 2 * N + 6;
+    }
+
+    template<size_t N>
+    inline size_t encodeInteriorMessage(uint8_t* data, const digest_t<N>* lcDigest, const digest_t<N>* rcDigest, int dimension, double value, uint8_t removeState) {
+        memcpy(data, lcDigest->byte, N);
+        memcpy(data + N, rcDigest->byte, N);
+        memcpy(data + N * 2, &value, 8);
+        data[N * 2 + 8] = uint8_t(dimension);
+        data[N * 2 + 9] = removeState;
+        return 2 * N + 10;
+    }
+
+    constexpr size_t MAX_DIGEST_MESSAGE = 2 * 32 + 10;
+
+    // device functions
+    // leaf node
+    inline void computeDigest(hash_t* digest, float x, float y, float z, bool removed = false) {
+        uint8_t data[MAX_DIGEST_MESSAGE];
+        MerkleHash::hash(data, encodeLeafMessage(data, x, y, z, removed), digest->byte);
+    }
+
+    inline void computeDigest(hash_t* digest, double x, double y, double z, bool removed=false) {
+        uint8_t data[MAX_DIGEST_MESSAGE];
+        MerkleHash::hash(data, encodeLeafMessage(data, x, y, z, removed), digest->byte);
+    }
+
+    // leaves of a bucketed tree hold up to MAX_BUCKET_SIZE points, see PMKD_Config::bucketSize
+    constexpr int MAX_BUCKET_SIZE = 32;
+
+    // leaf node holding n points: their coordinates sorted bytewise, then the removed flag
+    // the order the points are stored or sent in does not matter, a single point hashes like a point leaf
+    template<typename Point>
+    inline void computeBucketDigest(hash_t* digest, const Point* pts, int n, bool removed = false) {
+        if (n == 1) {
+            computeDigest(digest, pts[0].x, pts[0].y, pts[0].z, removed);
+            return;
+        }
+        uint8_t coords[MAX_BUCKET_SIZE][MAX_DIGEST_MESSAGE];
+        int order[MAX_BUCKET_SIZE];
+        size_t len = 0;
+        for (int i = 0; i < n; i++) {
+            len = encodeLeafMessage(coords[i], pts[i].x, pts[i].y, pts[i].z, removed) - 1;
+            order[i] = i;
+        }
+        std::sort(order, order + n, [&](int a, int b) { return memcmp(coords[a], coords[b], len) < 0; });
+
+        uint8_t data[MAX_BUCKET_SIZE * MAX_DIGEST_MESSAGE];
+        for (int i = 0; i < n; i++) memcpy(data + i * len, coords[order[i]], len);
+        data[n * len] = uint8_t(removed);
+        MerkleHash::hash(data, n * len + 1, digest->byte);
+    }
+
+    // interior node
+    inline void computeDigest(hash_t* digest, const hash_t* lcDigest, const hash_t* rcDigest, int dimension, float value, uint8_t removeState) {
+        uint8_t data[MAX_DIGEST_MESSAGE];
+        MerkleHash::hash(data, encodeInteriorMessage(data, lcDigest, rcDigest, dimension, value, removeState), digest->byte);
+    }
+
+    inline void computeDigest(hash_t* digest, const hash_t* lcDigest, const hash_t* rcDigest, int dimension, double value, uint8_t removeState) {
+        uint8_t data[MAX_DIGEST_MESSAGE];
+        MerkleHash::hash(data, encodeInteriorMessage(data, lcDigest, rcDigest, dimension, value, removeState), digest->byte);
+    }
+
+    // collects up to DIGEST_LANES node messages of the same kind and hashes them together
+    template<typename Hash = MerkleHash>
+    struct DigestBatch {
+        using digest_type = digest_t<Hash::DIGEST_SIZE>;
+
+        uint8_t data[DIGEST_LANES][MAX_DIGEST_MESSAGE];
+        const uint8_t* msgs[DIGEST_LANES];
+        uint8_t* digests[DIGEST_LANES];
+        size_t len = 0;
+        int n = 0;
+
+        template<typename T>
+        void addLeaf(digest_type* digest, T x, T y, T z, bool removed) {
+            len = encodeLeafMessage(data[n], x, y, z, removed);
+            push(digest);
+        }
+
+        template<typename T>
+        void addInterior(digest_type* digest, const digest_type* lcDigest, const digest_type* rcDigest, int dimension, T value, uint8_t removeState) {
+            len = encodeInteriorMessage(data[n], lcDigest, rcDigest, dimension, value, removeState);
+            push(digest);
+        }
+
+        void flush() {
+            if (n > 0) Hash::hashLanes(msgs, len, n, digests);
+            n = 0;
+        }
+
+    private:
+        void push(digest_type* digest) {
+            msgs[n] = data[n];
+            digests[n] = digest->byte;
+            if (++n == DIGEST_LANES) flush();
+        }
+    };
+}
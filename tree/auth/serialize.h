@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <query_response.h>
+
+namespace pmkd {
+    // compact binary encoding of verifiable range query responses
+    // nodes shared by several queries are stored once, each query keeps a sorted list of node ids
+    // keys and parent codes are delta and varint encoded, floats and digests are copied as in memory (little endian)
+    // the order of the nodes inside a query is not kept, the verifiers do not depend on it
+    vector<uint8_t> serializeResponses(const VerifiableRangeQueryResponses& resps);
+
+    // throws std::runtime_error if the data is malformed or was written with another digest or float size
+    VerifiableRangeQueryResponses deserializeResponses(const uint8_t* data, size_t size);
+
+    // return false if the file cannot be opened
+    bool saveResponses(const VerifiableRangeQueryResponses& resps, const std::string& filename);
+
+    VerifiableRangeQueryResponses loadResponses(const std::string& filename);
+}
@@ -1,60 +1,18 @@
 #pragma once
 #include <cstdint>
-#include <cmath>
-#include <string.h>
+#include <cstddef>
 #include <openssl/sha.h>
 
 namespace pmkd {
-    struct sha256_t {
-        uint8_t byte[SHA256_DIGEST_LENGTH];
-    };
-
-    inline bool equal(const sha256_t& a, const sha256_t& b) {
-        return memcmp(a.byte, b.byte, SHA256_DIGEST_LENGTH) == 0;
-    }
-
-    // device functions
-    // leaf node
-    inline void computeDigest(sha256_t* digest, float x, float y, float z, bool removed = false) {
-        uint8_t data[13];
-        memcpy(data, &x, 4);
-        memcpy(data + 4, &y, 4);
-        memcpy(data + 8, &z, 4);
-        data[12] = uint8_t(removed);
-
-        SHA256(data, 13, digest->byte);
-    }
-
-    inline void computeDigest(sha256_t* digest, double x, double y, double z, bool removed=false) {
-        uint8_t data[25];
-        memcpy(data, &x, 8);
-        memcpy(data + 8, &y, 8);
-        memcpy(data + 16, &z, 8);
-        data[24] = uint8_t(removed);
-
-        SHA256(data, 25, digest->byte);
-    }
-
-    // interior node
-    inline void computeDigest(sha256_t* digest, const sha256_t* lcDigest, const sha256_t* rcDigest, int dimension, float value, uint8_t removeState) {
-        uint8_t data[2 * SHA256_DIGEST_LENGTH + 6];
-        memcpy(data, lcDigest->byte, SHA256_DIGEST_LENGTH);
-        memcpy(data + SHA256_DIGEST_LENGTH, rcDigest->byte, SHA256_DIGEST_LENGTH);
-        memcpy(data + SHA256_DIGEST_LENGTH * 2, &value, 4);
-        data[SHA256_DIGEST_LENGTH * 2 + 4] = uint8_t(dimension);
-        data[SHA256_DIGEST_LENGTH * 2 + 5] = removeState;
-
-        SHA256(data, 2 * SHA256_DIGEST_LENGTH + 6, digest->byte);
-    }
-
-    inline void computeDigest(sha256_t* digest, const sha256_t* lcDigest, const sha256_t* rcDigest, int dimension, double value, uint8_t removeState) {
-        uint8_t data[2 * SHA256_DIGEST_LENGTH + 10];
-        memcpy(data, lcDigest->byte, SHA256_DIGEST_LENGTH);
-        memcpy(data + SHA256_DIGEST_LENGTH, rcDigest->byte, SHA256_DIGEST_LENGTH);
-        memcpy(data + SHA256_DIGEST_LENGTH * 2, &value, 8);
-        data[SHA256_DIGEST_LENGTH * 2 + 8] = uint8_t(dimension);
-        data[SHA256_DIGEST_LENGTH * 2 + 9] = removeState;
-
-        SHA256(data, 2 * SHA256_DIGEST_LENGTH + 10, digest->byte);
-    }
-}
\ No newline at end of file
+    // number of messages hashed side by side, one per 32-bit lane of an AVX2 register
+    constexpr int SHA256_LANES = 8;
+
+    // digest = SHA-256 of msg, 32 bytes
+    // uses the SHA extensions if the CPU has them, otherwise OpenSSL
+    void sha256(const uint8_t* msg, size_t len, uint8_t* digest);
+
+    // digests[i] = SHA-256 of msgs[i] for i < n <= SHA256_LANES, all messages are len bytes long
+    // the lanes run in one AVX2 instruction stream if the CPU supports it and enough lanes are filled,
+    // otherwise the messages are hashed one by one like sha256()
+    void sha256Lanes(const uint8_t* const msgs[], size_t len, int n, uint8_t* const digests[]);
+}
@@ -1,6 +1,7 @@
 #pragma once
-#include <auth/sha.h>
+#include <auth/digest.h>
 #include <node.h>
+#include <device_helper.h>
 
 namespace pmkd {
     // inline int toKey(int idx, uint8_t isInterior) {
@@ -40,10 +41,11 @@ namespace pmkd {
         uint8_t* __restrict_arr removal;
         int* __restrict_arr parentCode;
 
-        inline void fromLeaf(const LeavesRawRepr& leaves, const vec3f* pts, uint32_t fi, uint32_t li, uint32_t globalOffset) {
+        // point pi of leaf li, the points of a bucket share the parent code of their leaf
+        inline void fromLeaf(const LeavesRawRepr& leaves, const vec3f* pts, uint32_t fi, uint32_t li, uint32_t pi, uint32_t globalOffset) {
             //key[fi] = toFKey(globalOffset + li);
-            pt[fi] = pts[li];
-            removal[fi] = leaves.replacedBy[li] == -1;
+            pt[fi] = pts[pi];
+            removal[fi] = getReplacedBy(leaves, li) == -1;
             parentCode[fi] = (globalOffset << 1) + leaves.parent[li];
         }
     };
@@ -57,9 +59,8 @@ namespace pmkd {
 
         inline void fromInterior(const InteriorsRawRepr& interiors, uint32_t mi, uint32_t ii, uint32_t globalOffset, int iBatch) {
             key[mi] = toMKey(globalOffset + ii);
-            splitDim[mi] = interiors.splitDim[ii];
-            splitVal[mi] = interiors.splitVal[ii];
-            removal[mi] = interiors.removeState[ii].load(std::memory_order_relaxed);
+            getSplit(interiors, ii, splitDim[mi], splitVal[mi]);
+            removal[mi] = getRemoveState(interiors, ii);
             parentCode[mi] = transformParentCode(interiors.parent[ii], globalOffset, iBatch);
         }
     };
@@ -8,4 +8,10 @@ namespace pmkd {
 
     bool verifyRangeQuery_Sequential(const hash_t& rootHash, const RangeQuery& query, const VerifiableRangeQueryResponses& resps, size_t idx,
         parlay::parlay_unordered_map<int, size_t>& table);
+
+    // verify all responses in parallel, one query per worker, result[i] is 1 iff response i is correct
+    // each query looks up its m nodes in a sorted key table of its own, and rejects proofs with missing or repeated nodes
+    // the proof is checked against the root hash only: f nodes include the leaves outside the box that the search reached,
+    // and pruned removed subtrees are sent as h nodes, so the box cannot be checked against them
+    vector<uint8_t> verifyRangeQueries(const hash_t& rootHash, const VerifiableRangeQueryResponses& resps);
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
+#include <type_traits>
 #include <node.h>
+#include <helper.h>
+#include <common/geometry/aabb.h>
 
 namespace pmkd {
     // inline void copyState(const BottomUpState& src, TopDownStates& dst, int idx) {
@@ -64,6 +67,41 @@ namespace pmkd {
         return state == 0b11;
     }
 
+    // removeState and replacedBy are null until the first update (see NodeMgr::prepareUpdates)
+    // and nothing is removed or replaced before that
+    inline bool isInteriorRemoved(const InteriorsRawRepr& interiors, int idx) {
+        return interiors.removeState && isInteriorRemoved(interiors.removeState[idx]);
+    }
+
+    inline uint8_t getRemoveState(const InteriorsRawRepr& interiors, int idx) {
+        return interiors.removeState ? interiors.removeState[idx].load(std::memory_order_relaxed) : 0;
+    }
+
+    inline int getReplacedBy(const LeavesRawRepr& leaves, int idx) {
+        return leaves.replacedBy ? leaves.replacedBy[idx] : 0;
+    }
+
+    // leaf idx holds points [bucketBegin, bucketEnd) of its batch, see Leaves::bucketOffset
+    inline int bucketBegin(const LeavesRawRepr& leaves, int idx) {
+        return leaves.bucketOffset ? leaves.bucketOffset[idx] : idx;
+    }
+
+    inline int bucketEnd(const LeavesRawRepr& leaves, int idx) {
+        return leaves.bucketOffset ? leaves.bucketOffset[idx + 1] : idx + 1;
+    }
+
+    // leaf holding point idx of a batch of leafSize leaves
+    inline int findBucket(const LeavesRawRepr& leaves, int leafSize, int idx) {
+        if (!leaves.bucketOffset) return idx;
+        return std::upper_bound(leaves.bucketOffset, leaves.bucketOffset + leafSize + 1, idx) - leaves.bucketOffset - 1;
+    }
+
+    inline bool bucketHolds(const LeavesRawRepr& leaves, const vec3f* pts, int idx, const vec3f& pt) {
+        for (int p = bucketBegin(leaves, idx); p < bucketEnd(leaves, idx); p++)
+            if (pts[p] == pt) return true;
+        return false;
+    }
+
     
     inline bool setVisitCountBottomUp(AtomicCount& visitCount, bool fromRC) {
         uint8_t oldCnt = visitCount.cnt.fetch_add(1, std::memory_order_relaxed);
@@ -85,27 +123,468 @@ namespace pmkd {
         fromRC = parentCode & 1;
     }
 
+    inline void prefetchSplit(const InteriorsRawRepr& interiors, int idx) {
+#ifdef COMPACT_INTERIORS
+        prefetch(interiors.split + idx);
+#else
+        prefetch(interiors.splitDim + idx);
+        prefetch(interiors.splitVal + idx);
+#endif
+    }
+
+    // whether interior idx is the root of the main tree or of a subtree in a dynamic batch
+    inline bool isSubtreeRoot(const LeavesRawRepr& leaves, const InteriorsRawRepr& interiors, int idx, bool isMainTree) {
+        if (isMainTree) return interiors.parent[idx] < 0;
+        int l = interiors.rangeL[idx];
+        return (l == 0 || leaves.treeLocalRangeR[l - 1] == l) && interiors.rangeR[idx] == leaves.treeLocalRangeR[l] - 1;
+    }
+
+    // grid cell [ptMin, ptMax) of the jump table
+    inline AABB calcJumpCellBox(const AABB& boundary, const int q[3]) {
+        constexpr int n = 1 << JUMP_TABLE_BITS;
+        AABB cell;
+        for (int d = 0; d < 3; d++) {
+            mfloat ext = boundary.ptMax[d] - boundary.ptMin[d];
+            // same rounding as the split values from Morton::calcSplit, so cell faces fall on splits exactly
+            cell.ptMin[d] = mfloat(q[d]) / n * ext + boundary.ptMin[d];
+            cell.ptMax[d] = mfloat(q[d] + 1) / n * ext + boundary.ptMin[d];
+        }
+        return cell;
+    }
+
+    inline int encodeJumpCell(const int q[3]) {
+        return int((leftShift3f_64b(q[0]) << 2) | (leftShift3f_64b(q[1]) << 1) | leftShift3f_64b(q[2]));
+    }
+
+    // jump table cell containing pt, -1 if none does
+    inline int calcJumpCell(const AABB& boundary, const vec3f& pt) {
+        constexpr int n = 1 << JUMP_TABLE_BITS;
+        int q[3];
+        for (int d = 0; d < 3; d++) {
+            mfloat f = (pt[d] - boundary.ptMin[d]) / (boundary.ptMax[d] - boundary.ptMin[d]) * n;
+            if (!(f >= 0 && f < n)) return -1;
+            q[d] = int(f);
+        }
+        // rounding may put pt just outside the cell it is mapped to
+        AABB cell = calcJumpCellBox(boundary, q);
+        for (int d = 0; d < 3; d++) {
+            if (pt[d] < cell.ptMin[d] || pt[d] >= cell.ptMax[d]) return -1;
+        }
+        return encodeJumpCell(q);
+    }
+
+    // a traversal starting at node (interior index, or ~leaf index) sprouts from the leftmost leaf of node
+    // and skips the interiors above node on the segment of that leaf
+    inline void decodeStartNode(int node, const LeavesRawRepr& leaves, const InteriorsRawRepr& interiors, int leafSize,
+        int& bin, int& skip) {
+        if (node >= 0) {
+            bin = interiors.rangeL[node];
+            skip = node;
+        }
+        else {
+            bin = ~node;
+            skip = bin == leafSize - 1 ? leaves.segOffset[bin] : leaves.segOffset[bin + 1];
+        }
+    }
+
+    // where the main tree traversal of pt starts: the leaf to sprout from and the first interior of its segment
+    // falls back to the root if there is no table or pt is outside its grid
+    inline void lookupJumpTable(const JumpTableDevice& jump, const vec3f& pt, const LeavesRawRepr& leaves,
+        const InteriorsRawRepr& interiors, int leafSize, int& bin, int& skip) {
+        bin = 0;
+        skip = 0;
+        if (!jump.node) return;
+        int cell = calcJumpCell(jump.boundary, pt);
+        if (cell < 0) return;
+        decodeStartNode(jump.node[cell], leaves, interiors, leafSize, bin, skip);
+    }
+
+    // start of the main tree traversal of query qIdx, from startNode if given (see SearchKernel::findPacketStarts)
+    inline void findTraversalStart(const JumpTableDevice& jump, const int* startNode, int qIdx, const vec3f& pt,
+        const LeavesRawRepr& leaves, const InteriorsRawRepr& interiors, int leafSize, int& bin, int& skip) {
+        if (startNode) decodeStartNode(startNode[qIdx], leaves, interiors, leafSize, bin, skip);
+        else lookupJumpTable(jump, pt, leaves, interiors, leafSize, bin, skip);
+    }
+
+#ifdef ENABLE_MERKLE
+    // mark the path from the main tree root down to the node a traversal jumped to
+    inline void markJumpedPath(const LeavesRawRepr& leaves, InteriorsRawRepr& interiors, int leafSize, int bin, int skip) {
+        int R = bin == leafSize - 1 ? leaves.segOffset[bin] : leaves.segOffset[bin + 1];
+        int parentCode = skip < R ? interiors.parent[skip] : leaves.parent[bin];
+        int parent;
+        bool isRC;
+        for (; parentCode >= 0; parentCode = interiors.parent[parent]) {
+            decodeParentCode(parentCode, parent, isRC);
+            setVisitStateTopDown(interiors.visitStateTopDown, parent, isRC);
+        }
+    }
+#endif
+
+    // add delta to the live count of every ancestor of a leaf in a static tree
+    inline void propagateLiveCount(int leafIdx, int delta, const LeavesRawRepr& leaves, const InteriorsRawRepr& interiors) {
+        int parent;
+        bool isRC;
+        for (int parentCode = leaves.parent[leafIdx]; parentCode >= 0; parentCode = interiors.parent[parent]) {
+            decodeParentCode(parentCode, parent, isRC);
+            interiors.liveCount[parent].fetch_add(delta, std::memory_order_relaxed);
+        }
+    }
+
+    // add delta to the live count of every ancestor of a leaf, following replaced leaves up to the main tree
+    inline void propagateLiveCount(int globalLeafIdx, int delta, const NodeMgrDevice& nodeMgr) {
+        while (true) {
+            int iBatch, localLeafIdx;
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
+            const auto& leaves = nodeMgr.leavesBatch[iBatch];
+            const auto& interiors = nodeMgr.interiorsBatch[iBatch];
+
+            if (iBatch == 0) {
+                propagateLiveCount(localLeafIdx, delta, leaves, interiors);
+                break;
+            }
+
+            int current;
+            bool isRC;
+            decodeParentCode(leaves.parent[localLeafIdx], current, isRC);
+            while (true) {
+                interiors.liveCount[current].fetch_add(delta, std::memory_order_relaxed);
+                if (isSubtreeRoot(leaves, interiors, current, false)) break;
+                decodeParentCode(interiors.parent[current], current, isRC);
+            }
+            globalLeafIdx = leaves.derivedFrom[localLeafIdx];
+        }
+    }
+
+    // kd region of a node, bounded by the split planes of its ancestors and by boundary elsewhere
+    // node is given by its parent code and one of its leaves, crossing batches at subtree roots
+    inline AABB calcNodeRegion(const NodeMgrDevice& nodeMgr, int iBatch, int parentCode, int localLeafIdx,
+        const AABB& boundary) {
+        AABB region = boundary;
+        uint8_t bounded = 0;  // bit 2 * dim + isMin
+        while (bounded != 0b111111) {
+            const auto& leaves = nodeMgr.leavesBatch[iBatch];
+            const auto& interiors = nodeMgr.interiorsBatch[iBatch];
+            if (parentCode < 0) {
+                if (iBatch == 0) break;
+                // node is a subtree root, continue from the leaf it replaces
+                int globalLeafIdx = leaves.derivedFrom[localLeafIdx];
+                transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
+                parentCode = nodeMgr.leavesBatch[iBatch].parent[localLeafIdx];
+                if (iBatch == 0 && nodeMgr.sizesAcc[0] == 1) break;
+                continue;
+            }
+            int parent;
+            bool isRC;
+            decodeParentCode(parentCode, parent, isRC);
+            int dim;
+            mfloat val;
+            getSplit(interiors, parent, dim, val);
+            uint8_t bit = 1 << (2 * dim + isRC);
+            if (!(bounded & bit)) {
+                bounded |= bit;
+                if (isRC) region.ptMin[dim] = val;
+                else region.ptMax[dim] = val;
+            }
+            parentCode = isSubtreeRoot(leaves, interiors, parent, iBatch == 0) ? -1 : interiors.parent[parent];
+        }
+        return region;
+    }
+
+    inline AABB calcNodeRegion(const InteriorsRawRepr& interiors, int parentCode, const AABB& boundary) {
+        AABB region = boundary;
+        uint8_t bounded = 0;  // bit 2 * dim + isMin
+        while (bounded != 0b111111 && parentCode >= 0) {
+            int parent;
+            bool isRC;
+            decodeParentCode(parentCode, parent, isRC);
+            int dim;
+            mfloat val;
+            getSplit(interiors, parent, dim, val);
+            uint8_t bit = 1 << (2 * dim + isRC);
+            if (!(bounded & bit)) {
+                bounded |= bit;
+                if (isRC) region.ptMin[dim] = val;
+                else region.ptMax[dim] = val;
+            }
+            parentCode = interiors.parent[parent];
+        }
+        return region;
+    }
+
+    // insert a candidate into a neighbor list sorted by ascending distance, keeping at most k entries
+    inline void insertNeighbor(int* nbrIdx, mfloat* nbrDist, uint32_t& size, uint32_t k, int ptIdx, mfloat dist) {
+        if (size == k && dist >= nbrDist[k - 1]) return;
+        for (uint32_t i = 0; i < size; i++) {
+            if (nbrIdx[i] == ptIdx) return;  // already collected
+        }
+        uint32_t i = size < k ? size++ : k - 1;
+        while (i > 0 && nbrDist[i - 1] > dist) {
+            nbrIdx[i] = nbrIdx[i - 1];
+            nbrDist[i] = nbrDist[i - 1];
+            --i;
+        }
+        nbrIdx[i] = ptIdx;
+        nbrDist[i] = dist;
+    }
+
+    inline mfloat worstNeighborDist(const mfloat* nbrDist, uint32_t size, uint32_t k) {
+        return size < k ? FMAX : nbrDist[k - 1];
+    }
+
+    // kd regions of the interiors a traversal went down from whose right child is still ahead, innermost on top
+    // only the innermost CAPACITY are kept, the region of one that fell off is recomputed by calcNodeRegion
+    struct RegionStack {
+        static constexpr int CAPACITY = 64;
+        AABB region[CAPACITY];
+        int batch[CAPACITY];
+        int node[CAPACITY];
+        int top = 0, size = 0;
+
+        void push(int iBatch, int idx, const AABB& r) {
+            region[top] = r;
+            batch[top] = iBatch;
+            node[top] = idx;
+            top = (top + 1) % CAPACITY;
+            size = std::min(size + 1, CAPACITY);
+        }
+
+        // region of the right child of interior idx, false if idx is not on top
+        bool popRight(int iBatch, int idx, int dim, mfloat val, AABB& r) {
+            int last = (top + CAPACITY - 1) % CAPACITY;
+            if (size == 0 || batch[last] != iBatch || node[last] != idx) return false;
+            top = last;
+            --size;
+            r = region[last];
+            r.ptMin[dim] = val;
+            return true;
+        }
+    };
+
+    struct NoRegionStack {};
+
+    // sprouting traversal driven by a policy, which provides
+    //   bool pruneLeft(int dim, mfloat val)        nothing is wanted below the split plane
+    //   bool pruneRight(int dim, mfloat val)       nothing is wanted at or above the split plane
+    //   bool visit(const vec3f& pt, int ptIdx)     called on every point of the valid leaves reached, return false to stop
+    //   static constexpr bool TRACK_REGION         track the kd region of each node, starting from policy.boundary
+    //   bool takeSubtree(const AABB& region, int liveCount)   with TRACK_REGION, take a subtree as a whole and skip it
+    template<typename Policy>
+    inline void traverseSprouting(Policy& policy, const vec3f* pts, int leafSize,
+        const InteriorsRawRepr& interiors, const LeavesRawRepr& leaves) {
+        [[maybe_unused]] std::conditional_t<Policy::TRACK_REGION, RegionStack, NoRegionStack> regions;
+        [[maybe_unused]] AABB region;
+        int splitDim;
+        mfloat splitVal;
+        for (int begin = 0; begin < leafSize; begin++) {
+            int L = leaves.segOffset[begin];
+            int R = begin == leafSize - 1 ? L : leaves.segOffset[begin + 1];
+
+            // the segment starts at the right child of parentCode, or at the root
+            int parentCode = L < R ? interiors.parent[L] : leaves.parent[begin];
+            if (parentCode >= 0) {
+                int parent;
+                bool isRC;
+                decodeParentCode(parentCode, parent, isRC);
+                getSplit(interiors, parent, splitDim, splitVal);
+                if constexpr (Policy::TRACK_REGION) {
+                    if (!regions.popRight(0, parent, splitDim, splitVal, region))
+                        region = calcNodeRegion(interiors, parentCode, policy.boundary);
+                }
+                if (policy.pruneRight(splitDim, splitVal)) {
+                    if (L < R) begin = interiors.rangeR[L];
+                    continue;
+                }
+            }
+            else if constexpr (Policy::TRACK_REGION) region = policy.boundary;
+
+            bool reached = true;
+            for (int interiorIdx = L; interiorIdx < R; interiorIdx++) {
+                if constexpr (Policy::TRACK_REGION) {
+                    if (policy.takeSubtree(region, interiors.liveCount[interiorIdx].load(std::memory_order_relaxed))) {
+                        begin = interiors.rangeR[interiorIdx];
+                        reached = false;
+                        break;
+                    }
+                }
+                if (isInteriorRemoved(interiors, interiorIdx)) {
+                    begin = interiors.rangeR[interiorIdx];
+                    reached = false;
+                    break;
+                }
+                getSplit(interiors, interiorIdx, splitDim, splitVal);
+                if constexpr (Policy::TRACK_REGION) regions.push(0, interiorIdx, region);
+                if (policy.pruneLeft(splitDim, splitVal)) {
+                    // go on from the right child, i.e. after the last leaf of the left child
+                    if (interiorIdx < R - 1) begin = interiors.rangeR[interiorIdx + 1];
+                    reached = false;
+                    break;
+                }
+                if constexpr (Policy::TRACK_REGION) region.ptMax[splitDim] = splitVal;
+            }
+            if (!reached) continue;
+
+            // hit leaf with index <begin>
+            if (getReplacedBy(leaves, begin) < 0) continue;  // leaf is removed
+            for (int p = bucketBegin(leaves, begin); p < bucketEnd(leaves, begin); p++)
+                if (!policy.visit(pts[p], p)) return;
+        }
+    }
+
+    // sprouting traversal of a dynamic tree, ptIdx passed to visit is the global point index, see transformPointIdx
+    template<typename Policy>
+    inline void traverseSprouting(Policy& policy, const NodeMgrDevice& nodeMgr, int totalLeafSize) {
+        [[maybe_unused]] std::conditional_t<Policy::TRACK_REGION, RegionStack, NoRegionStack> regions;
+        [[maybe_unused]] AABB region;
+        int iBatch = 0, localLeafIdx = 0;
+        int mainTreeLeafSize = nodeMgr.sizesAcc[0];
+        int splitDim;
+        mfloat splitVal;
+
+        int globalLeafIdx = 0;
+        int state = 0;   // 0: init, 1: deeper, 2: stack return
+
+        while (globalLeafIdx < totalLeafSize) {
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
+
+            const auto& leaves = nodeMgr.leavesBatch[iBatch];
+            const auto& interiors = nodeMgr.interiorsBatch[iBatch];
+
+            int rBound = iBatch == 0 ? mainTreeLeafSize : leaves.treeLocalRangeR[localLeafIdx];
+            // going deeper starts at the root of the subtree that replaces a leaf, it keeps the region of that leaf
+            bool atSubtreeRoot = state == 1;
+            if (state == 2) {
+                globalLeafIdx++;
+                localLeafIdx++;
+            }
+            state = 2;
+
+            int oldLocalLeafIdx = localLeafIdx;
+            for (;localLeafIdx < rBound;globalLeafIdx += ++localLeafIdx - oldLocalLeafIdx, atSubtreeRoot = false) {
+                oldLocalLeafIdx = localLeafIdx;
+
+                int L = leaves.segOffset[localLeafIdx];
+                int R = localLeafIdx == rBound - 1 ? L : leaves.segOffset[localLeafIdx + 1];
+
+                // the parent code of a subtree root is not a local one
+                int parentCode = atSubtreeRoot ? -1 : L < R ? interiors.parent[L] : leaves.parent[localLeafIdx];
+                if (parentCode >= 0) {
+                    int parent;
+                    bool isRC;
+                    decodeParentCode(parentCode, parent, isRC);
+                    getSplit(interiors, parent, splitDim, splitVal);
+                    if constexpr (Policy::TRACK_REGION) {
+                        if (!regions.popRight(iBatch, parent, splitDim, splitVal, region))
+                            region = calcNodeRegion(nodeMgr, iBatch, parentCode, localLeafIdx, policy.boundary);
+                    }
+                    if (policy.pruneRight(splitDim, splitVal)) {
+                        if (L < R) localLeafIdx = interiors.rangeR[L];
+                        continue;
+                    }
+                }
+                else if constexpr (Policy::TRACK_REGION) {
+                    if (!atSubtreeRoot) region = policy.boundary;
+                }
+
+                bool reached = true;
+                for (int interiorIdx = L; interiorIdx < R; interiorIdx++) {
+                    if constexpr (Policy::TRACK_REGION) {
+                        if (policy.takeSubtree(region, interiors.liveCount[interiorIdx].load(std::memory_order_relaxed))) {
+                            localLeafIdx = interiors.rangeR[interiorIdx];
+                            reached = false;
+                            break;
+                        }
+                    }
+                    if (isInteriorRemoved(interiors, interiorIdx)) {
+                        localLeafIdx = interiors.rangeR[interiorIdx];
+                        reached = false;
+                        break;
+                    }
+                    getSplit(interiors, interiorIdx, splitDim, splitVal);
+                    if constexpr (Policy::TRACK_REGION) regions.push(iBatch, interiorIdx, region);
+                    if (policy.pruneLeft(splitDim, splitVal)) {
+                        if (interiorIdx < R - 1) localLeafIdx = interiors.rangeR[interiorIdx + 1];
+                        reached = false;
+                        break;
+                    }
+                    if constexpr (Policy::TRACK_REGION) region.ptMax[splitDim] = splitVal;
+                }
+                if (!reached) continue;
+
+                int globalSubstitute = getReplacedBy(leaves, localLeafIdx);
+                if (globalSubstitute == 0) { // this leaf is valid (i.e. not replaced or removed)
+                    const vec3f* pts = nodeMgr.ptsBatch[iBatch];
+                    int ptOffset = iBatch > 0 ? globalLeafIdx - localLeafIdx + nodeMgr.pointShift : 0;
+                    for (int p = bucketBegin(leaves, localLeafIdx); p < bucketEnd(leaves, localLeafIdx); p++)
+                        if (!policy.visit(pts[p], ptOffset + p)) return;
+                }
+                else if (globalSubstitute > 0) {
+                    // leaf is replaced, the subtree replacing it is rooted at the first interior of its leftmost leaf
+                    if constexpr (Policy::TRACK_REGION) {
+                        int subBatch, subLeafIdx;
+                        transformLeafIdx(globalSubstitute, nodeMgr, subBatch, subLeafIdx);
+                        int subRoot = nodeMgr.leavesBatch[subBatch].segOffset[subLeafIdx];
+                        if (policy.takeSubtree(region,
+                            nodeMgr.interiorsBatch[subBatch].liveCount[subRoot].load(std::memory_order_relaxed))) continue;
+                    }
+                    globalLeafIdx = globalSubstitute;
+                    state = 1;
+                    break;
+                }
+            }
+            if (state == 2) {
+                // equal to stack return
+                globalLeafIdx = iBatch > 0 ? leaves.derivedFrom[rBound - 1] : totalLeafSize;
+            }
+        }
+    }
+
+    // prune policy of a box, calling visit(pt, ptIdx) on the points inside it
+    template<typename Visitor>
+    struct BoxPolicy {
+        static constexpr bool TRACK_REGION = false;
+        const AABB& box;
+        Visitor& visitor;
+
+        bool pruneLeft(int dim, mfloat val) const { return box.ptMin[dim] >= val; }
+        bool pruneRight(int dim, mfloat val) const { return box.ptMax[dim] < val; }
+        bool visit(const vec3f& pt, int ptIdx) { return !box.include(pt) || visitor(pt, ptIdx); }
+    };
+
+    // sprouting traversal of a static tree, calling visit(pt, ptIdx) on every stored point inside box
+    // stop early if visit returns false
+    template<typename Visitor>
+    inline void forEachPointInRange(const AABB& box, const vec3f* pts, int leafSize,
+        const InteriorsRawRepr& interiors, const LeavesRawRepr& leaves, Visitor&& visit) {
+        BoxPolicy<std::remove_reference_t<Visitor>> policy{ box, visit };
+        traverseSprouting(policy, pts, leafSize, interiors, leaves);
+    }
+
+    // ptIdx passed to visit is the global point index
+    template<typename Visitor>
+    inline void forEachPointInRange(const AABB& box, const NodeMgrDevice& nodeMgr, int totalLeafSize, Visitor&& visit) {
+        BoxPolicy<std::remove_reference_t<Visitor>> policy{ box, visit };
+        traverseSprouting(policy, nodeMgr, totalLeafSize);
+    }
+
 #ifdef ENABLE_MERKLE
     inline void getOtherChildHash(const LeavesRawRepr& leaves, const InteriorsRawRepr& interiors,
         int leafBinIdx, int interiorIdx, int rBound, bool fromRC,
         const hash_t* &otherChildHash) {
         
         int R = leaves.segOffset[leafBinIdx + 1];
+        // the left child is leaf leafBinIdx if current is the last interior sprouted from it
+        bool lcIsLeaf = interiorIdx == R - 1;
 
-        if (interiorIdx == R - 1) {
-            otherChildHash = leaves.hash + (leafBinIdx + 1 - fromRC);
+        if (fromRC) {
+            otherChildHash = lcIsLeaf ? leaves.hash + leafBinIdx : interiors.hash + (interiorIdx + 1);
         }
         else {
-            if (fromRC) {
-                otherChildHash = interiors.hash + (interiorIdx + 1);
-            }
-            else {
-                int nextBin = interiors.rangeR[interiorIdx + 1] + 1;
-                int nextIdx = leaves.segOffset[nextBin];
-                if (nextBin == rBound - 1 || nextIdx == leaves.segOffset[nextBin + 1])
-                    otherChildHash = leaves.hash + nextBin;
-                else otherChildHash = interiors.hash + nextIdx;
-            }
+            // the right child starts right after the left child, it is a leaf if no interior sprouts from there
+            int nextBin = lcIsLeaf ? leafBinIdx + 1 : interiors.rangeR[interiorIdx + 1] + 1;
+            int nextIdx = leaves.segOffset[nextBin];
+            if (nextBin == rBound - 1 || nextIdx == leaves.segOffset[nextBin + 1])
+                otherChildHash = leaves.hash + nextBin;
+            else otherChildHash = interiors.hash + nextIdx;
         }
     }
 #endif
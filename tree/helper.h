@@ -2,10 +2,54 @@
 #include <immintrin.h>
 #include <parlay/parallel.h>
 #include <parlay/primitives.h>
+#include <common/basic/vector.h>
 
 namespace pmkd {
     void compare_vectors(const float* vec1, const float* vec2, int* result);
 
+    inline void prefetch(const void* ptr) {
+        _mm_prefetch(static_cast<const char*>(ptr), _MM_HINT_T0);
+    }
+
+    constexpr int PACKET_SIZE = 8;
+
+    // up to PACKET_SIZE points transposed into one AVX register per dimension
+    struct PointPacket {
+#if USE_DOUBLE_PRECISION
+        __m256d coord[3][2];
+#else
+        __m256 coord[3];
+#endif
+
+        // lanes past n repeat the last point, so they never split the packet
+        PointPacket(const vec3f* pts, int n) {
+            alignas(32) mfloat c[3][PACKET_SIZE];
+            for (int i = 0; i < PACKET_SIZE; i++) {
+                const vec3f& pt = pts[i < n ? i : n - 1];
+                for (int d = 0; d < 3; d++) c[d][i] = pt[d];
+            }
+            for (int d = 0; d < 3; d++) {
+#if USE_DOUBLE_PRECISION
+                coord[d][0] = _mm256_load_pd(c[d]);
+                coord[d][1] = _mm256_load_pd(c[d] + 4);
+#else
+                coord[d] = _mm256_load_ps(c[d]);
+#endif
+            }
+        }
+
+        // bit i is set iff point i goes to the right child, i.e. pt[dim] >= val
+        int onRightMask(int dim, mfloat val) const {
+#if USE_DOUBLE_PRECISION
+            __m256d v = _mm256_set1_pd(val);
+            return _mm256_movemask_pd(_mm256_cmp_pd(coord[dim][0], v, _CMP_GE_OQ)) |
+                (_mm256_movemask_pd(_mm256_cmp_pd(coord[dim][1], v, _CMP_GE_OQ)) << 4);
+#else
+            return _mm256_movemask_ps(_mm256_cmp_ps(coord[dim], _mm256_set1_ps(val), _CMP_GE_OQ));
+#endif
+        }
+    };
+
     template<typename T>
     inline decltype(auto) fromConstPtr(const T* ptr) {
         return const_cast<T*>(ptr);
@@ -126,4 +170,33 @@ namespace pmkd {
             binIdx.data(), oPrimIdx.data(), oBinIdx.data(), f
         );
     }
+
+    // oRank[i] = offset + index of the first key in B greater or equal to A[i], A and B sorted
+    template <typename T, typename BinaryOp>
+    void _mergeRank(T* A, size_t nA, T* B, size_t nB, int offset, int* oRank, BinaryOp&& less) {
+        if (nA == 0) return;
+        if (nA + nB < parlay::internal::_merge_base) {
+            size_t j = 0;
+            for (size_t i = 0; i < nA; i++) {
+                while (j < nB && less(B[j], A[i])) j++;
+                oRank[i] = offset + j;
+            }
+        }
+        else if (nB == 0) {
+            parlay::parallel_for(0, nA, [&](size_t i) { oRank[i] = offset; });
+        }
+        else {
+            size_t mA = nA / 2;
+            size_t mB = binary_search(B, nB, A[mA], less);
+            auto left = [&]() { _mergeRank(A, mA, B, mB, offset, oRank, less); };
+            auto right = [&]() { _mergeRank(A + mA, nA - mA, B + mB, nB - mB, offset + mB, oRank + mA, less); };
+            parlay::par_do(left, right, false);
+        }
+    }
+
+    // rank every element of sorted A in sorted B by a parallel merge, in O(nA + nB) work
+    template <typename R1, typename R2, typename BinaryOp>
+    void mergeRank(R1&& A, R2&& B, int* oRank, BinaryOp&& less) {
+        _mergeRank(fromConstPtr(A.data()), A.size(), fromConstPtr(B.data()), B.size(), 0, oRank, less);
+    }
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+#include <auth/blake3.h>
+
+// portable BLAKE3 for inputs of a single chunk, which is all the Merkle tree hashes
+// longer inputs would need the chunk tree and are not supported
+
+namespace pmkd {
+    namespace {
+        constexpr uint32_t IV[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+
+        constexpr int MSG_PERMUTATION[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+
+        constexpr size_t BLOCK_LEN = 64;
+
+        constexpr uint32_t CHUNK_START = 1 << 0;
+        constexpr uint32_t CHUNK_END = 1 << 1;
+        constexpr uint32_t ROOT = 1 << 3;
+
+        inline uint32_t rotr(uint32_t x, int n) {
+            return (x >> n) | (x << (32 - n));
+        }
+
+        inline uint32_t loadLE32(const uint8_t* p) {
+            return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+        }
+
+        inline void g(uint32_t s[16], int a, int b, int c, int d, uint32_t mx, uint32_t my) {
+            s[a] = s[a] + s[b] + mx;
+            s[d] = rotr(s[d] ^ s[a], 16);
+            s[c] = s[c] + s[d];
+            s[b] = rotr(s[b] ^ s[c], 12);
+            s[a] = s[a] + s[b] + my;
+            s[d] = rotr(s[d] ^ s[a], 8);
+            s[c] = s[c] + s[d];
+            s[b] = rotr(s[b] ^ s[c], 7);
+        }
+
+        // chaining value cv <- compression of one block, the chunk counter is always 0 here
+        void compress(uint32_t cv[8], const uint8_t block[BLOCK_LEN], uint32_t blockLen, uint32_t flags) {
+            uint32_t m[16];
+            for (int i = 0; i < 16; i++) m[i] = loadLE32(block + 4 * i);
+
+            uint32_t s[16] = {
+                cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                IV[0], IV[1], IV[2], IV[3], 0, 0, blockLen, flags
+            };
+            for (int r = 0; r < 7; r++) {
+                g(s, 0, 4, 8, 12, m[0], m[1]);
+                g(s, 1, 5, 9, 13, m[2], m[3]);
+                g(s, 2, 6, 10, 14, m[4], m[5]);
+                g(s, 3, 7, 11, 15, m[6], m[7]);
+                g(s, 0, 5, 10, 15, m[8], m[9]);
+                g(s, 1, 6, 11, 12, m[10], m[11]);
+                g(s, 2, 7, 8, 13, m[12], m[13]);
+                g(s, 3, 4, 9, 14, m[14], m[15]);
+
+                uint32_t permuted[16];
+                for (int i = 0; i < 16; i++) permuted[i] = m[MSG_PERMUTATION[i]];
+                memcpy(m, permuted, sizeof(m));
+            }
+            for (int i = 0; i < 8; i++) cv[i] = s[i] ^ s[i + 8];
+        }
+    }
+
+    void blake3(const uint8_t* msg, size_t len, uint8_t* digest, size_t outLen) {
+        assert(len <= BLAKE3_CHUNK_LEN && outLen <= 32);
+
+        uint32_t cv[8];
+        memcpy(cv, IV, sizeof(cv));
+
+        // every block but the last is full, an empty input is one empty block
+        size_t nBlocks = len == 0 ? 1 : (len + BLOCK_LEN - 1) / BLOCK_LEN;
+        for (size_t k = 0; k < nBlocks; k++) {
+            size_t offset = k * BLOCK_LEN;
+            size_t blockLen = std::min(BLOCK_LEN, len - offset);
+            uint8_t block[BLOCK_LEN] = {};
+            memcpy(block, msg + offset, blockLen);
+
+            uint32_t flags = (k == 0 ? CHUNK_START : 0) | (k == nBlocks - 1 ? CHUNK_END | ROOT : 0);
+            compress(cv, block, uint32_t(blockLen), flags);
+        }
+
+        uint8_t out[32];
+        for (int i = 0; i < 8; i++) {
+            out[4 * i] = uint8_t(cv[i]);
+            out[4 * i + 1] = uint8_t(cv[i] >> 8);
+            out[4 * i + 2] = uint8_t(cv[i] >> 16);
+            out[4 * i + 3] = uint8_t(cv[i] >> 24);
+        }
+        memcpy(digest, out, outLen);
+    }
+}
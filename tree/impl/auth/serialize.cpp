@@ -0,0 +1,337 @@
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <string.h>
+#include <auth/serialize.h>
+
+// layout, all counts and ids are varints
+//   header:       "PMKP", version, digest size, float size, #queries, #m nodes, #h nodes, #f nodes
+//   m nodes:      sorted by key, key delta, zigzag(parentCode - 2 * key), splitDim | removal << 2, splitVal
+//   h nodes:      sorted by parentCode, parentCode delta, hash
+//   f nodes:      sorted by parentCode, parentCode delta << 1 | removal, pt
+//   per query:    queryIdx, #m, #h, #f, then the sorted ids of each kind as deltas
+// the deltas of sorted keys and parent codes are nonnegative, the first one is taken from INT32_MIN
+
+namespace pmkd {
+    namespace {
+        constexpr uint8_t MAGIC[4] = { 'P', 'M', 'K', 'P' };
+        constexpr uint8_t VERSION = 1;
+
+        // writers return the number of bytes, with dst == nullptr they only count
+        inline size_t putVarint(uint8_t* dst, uint64_t v) {
+            size_t n = 0;
+            for (; v >= 0x80; v >>= 7, n++) {
+                if (dst) dst[n] = uint8_t(v) | 0x80;
+            }
+            if (dst) dst[n] = uint8_t(v);
+            return n + 1;
+        }
+
+        inline size_t putRaw(uint8_t* dst, const void* src, size_t len) {
+            if (dst) memcpy(dst, src, len);
+            return len;
+        }
+
+        inline uint64_t zigzag(int64_t v) {
+            return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+        }
+
+        inline int64_t unzigzag(uint64_t v) {
+            return int64_t(v >> 1) ^ -int64_t(v & 1);
+        }
+
+        constexpr int64_t FIRST_PREV = INT32_MIN;
+
+        inline uint64_t delta(int64_t v, int64_t prev) {
+            return uint64_t(v - prev);
+        }
+
+        // append the encodings of items [0, n), encode(i, dst) returns the length of item i
+        template<typename F>
+        void appendEncoded(vector<uint8_t>& out, size_t n, F&& encode) {
+            auto offset = parlay::tabulate(n, [&](size_t i) { return encode(i, (uint8_t*)nullptr); });
+            size_t total = parlay::scan_inplace(offset);
+            size_t start = out.size();
+            out.resize(start + total);
+            parlay::parallel_for(0, n, [&](size_t i) { encode(i, out.data() + start + offset[i]); });
+        }
+
+        // id[i] = dictionary entry of node i, equal nodes share one entry
+        // returns the first node of each entry, entries are ordered by less
+        template<typename Less, typename Same>
+        parlay::sequence<int> dedupNodes(size_t n, Less&& less, Same&& same, parlay::sequence<int>& id) {
+            auto order = parlay::sort(parlay::iota<int>(n), less);
+            auto isFirst = parlay::tabulate(n, [&](size_t i) { return int(i == 0 || !same(order[i - 1], order[i])); });
+            auto entry = isFirst;
+            parlay::scan_inplace(entry);
+
+            id = parlay::sequence<int>(n);
+            parlay::parallel_for(0, n, [&](size_t i) { id[order[i]] = entry[i] + isFirst[i] - 1; });
+            return parlay::map(parlay::pack_index<int>(isFirst), [&](int i) { return order[i]; });
+        }
+
+        struct Reader {
+            const uint8_t* p;
+            const uint8_t* end;
+
+            [[noreturn]] static void fail() {
+                throw std::runtime_error("Malformed range query proof");
+            }
+
+            void need(size_t len) {
+                if (size_t(end - p) < len) fail();
+            }
+
+            uint64_t varint() {
+                uint64_t v = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    need(1);
+                    uint8_t b = *p++;
+                    v |= uint64_t(b & 0x7f) << shift;
+                    if (!(b & 0x80)) return v;
+                }
+                fail();
+            }
+
+            // a count of items taking at least one byte each
+            size_t count() {
+                uint64_t n = varint();
+                if (n > uint64_t(end - p)) fail();
+                return n;
+            }
+
+            // an id into a dictionary of n entries
+            int id(int64_t prev, size_t n) {
+                int64_t v = int64_t(prev + varint());
+                if (v < 0 || v >= int64_t(n)) fail();
+                return int(v);
+            }
+
+            uint8_t byte() {
+                need(1);
+                return *p++;
+            }
+
+            void raw(void* dst, size_t len) {
+                need(len);
+                memcpy(dst, p, len);
+                p += len;
+            }
+        };
+
+        inline size_t rangeEnd(const parlay::sequence<int>& offset, size_t q, size_t total) {
+            return q + 1 < offset.size() ? offset[q + 1] : total;
+        }
+    }
+
+    vector<uint8_t> serializeResponses(const VerifiableRangeQueryResponses& resps) {
+        const auto& mNodes = resps.vs.mNodes;
+        const auto& hNodes = resps.vs.hNodes;
+        const auto& fNodes = resps.vs.fNodes;
+        size_t nq = resps.size();
+
+        // shared node dictionaries
+        parlay::sequence<int> mId, hId, fId;
+        auto mRep = dedupNodes(mNodes.size(),
+            [&](int a, int b) {
+                return std::tie(mNodes.key[a], mNodes.parentCode[a], mNodes.splitDim[a], mNodes.splitVal[a], mNodes.removal[a])
+                    < std::tie(mNodes.key[b], mNodes.parentCode[b], mNodes.splitDim[b], mNodes.splitVal[b], mNodes.removal[b]);
+            },
+            [&](int a, int b) {
+                return mNodes.key[a] == mNodes.key[b] && mNodes.parentCode[a] == mNodes.parentCode[b]
+                    && mNodes.splitDim[a] == mNodes.splitDim[b] && mNodes.splitVal[a] == mNodes.splitVal[b]
+                    && mNodes.removal[a] == mNodes.removal[b];
+            }, mId);
+        auto hRep = dedupNodes(hNodes.size(),
+            [&](int a, int b) {
+                if (hNodes.parentCode[a] != hNodes.parentCode[b]) return hNodes.parentCode[a] < hNodes.parentCode[b];
+                return memcmp(hNodes.hash[a].byte, hNodes.hash[b].byte, sizeof(hash_t)) < 0;
+            },
+            [&](int a, int b) {
+                return hNodes.parentCode[a] == hNodes.parentCode[b] && equal(hNodes.hash[a], hNodes.hash[b]);
+            }, hId);
+        auto fRep = dedupNodes(fNodes.size(),
+            [&](int a, int b) {
+                return std::tie(fNodes.parentCode[a], fNodes.removal[a], fNodes.pt[a].x, fNodes.pt[a].y, fNodes.pt[a].z)
+                    < std::tie(fNodes.parentCode[b], fNodes.removal[b], fNodes.pt[b].x, fNodes.pt[b].y, fNodes.pt[b].z);
+            },
+            [&](int a, int b) {
+                return fNodes.parentCode[a] == fNodes.parentCode[b] && fNodes.removal[a] == fNodes.removal[b]
+                    && fNodes.pt[a].x == fNodes.pt[b].x && fNodes.pt[a].y == fNodes.pt[b].y && fNodes.pt[a].z == fNodes.pt[b].z;
+            }, fId);
+
+        // the ids of each query are sorted to make their deltas small
+        parlay::parallel_for(0, nq, [&](size_t q) {
+            std::sort(mId.begin() + resps.mOffset[q], mId.begin() + rangeEnd(resps.mOffset, q, mNodes.size()));
+            std::sort(hId.begin() + resps.hOffset[q], hId.begin() + rangeEnd(resps.hOffset, q, hNodes.size()));
+            std::sort(fId.begin() + resps.fOffset[q], fId.begin() + rangeEnd(resps.fOffset, q, fNodes.size()));
+            });
+
+        vector<uint8_t> out(MAGIC, MAGIC + 4);
+        out.push_back(VERSION);
+        out.push_back(uint8_t(sizeof(hash_t)));
+        out.push_back(uint8_t(sizeof(mfloat)));
+        appendEncoded(out, 4, [&](size_t i, uint8_t* dst) {
+            size_t n[4] = { nq, mRep.size(), hRep.size(), fRep.size() };
+            return putVarint(dst, n[i]);
+            });
+
+        appendEncoded(out, mRep.size(), [&](size_t j, uint8_t* dst) {
+            int i = mRep[j];
+            int key = mNodes.key[i];
+            int64_t prevKey = j > 0 ? mNodes.key[mRep[j - 1]] : FIRST_PREV;
+            size_t len = putVarint(dst, delta(key, prevKey));
+            len += putVarint(dst ? dst + len : nullptr, zigzag(int64_t(mNodes.parentCode[i]) - 2 * int64_t(key)));
+            uint8_t dimAndRemoval = uint8_t(mNodes.splitDim[i]) | uint8_t(mNodes.removal[i] << 2);
+            len += putRaw(dst ? dst + len : nullptr, &dimAndRemoval, 1);
+            len += putRaw(dst ? dst + len : nullptr, &mNodes.splitVal[i], sizeof(mfloat));
+            return len;
+            });
+
+        appendEncoded(out, hRep.size(), [&](size_t j, uint8_t* dst) {
+            int i = hRep[j];
+            int64_t prevCode = j > 0 ? hNodes.parentCode[hRep[j - 1]] : FIRST_PREV;
+            size_t len = putVarint(dst, delta(hNodes.parentCode[i], prevCode));
+            len += putRaw(dst ? dst + len : nullptr, hNodes.hash[i].byte, sizeof(hash_t));
+            return len;
+            });
+
+        appendEncoded(out, fRep.size(), [&](size_t j, uint8_t* dst) {
+            int i = fRep[j];
+            int64_t prevCode = j > 0 ? fNodes.parentCode[fRep[j - 1]] : FIRST_PREV;
+            size_t len = putVarint(dst, delta(fNodes.parentCode[i], prevCode) << 1 | fNodes.removal[i]);
+            len += putRaw(dst ? dst + len : nullptr, &fNodes.pt[i], sizeof(vec3f));
+            return len;
+            });
+
+        appendEncoded(out, nq, [&](size_t q, uint8_t* dst) {
+            size_t start[3] = { size_t(resps.mOffset[q]), size_t(resps.hOffset[q]), size_t(resps.fOffset[q]) };
+            size_t end[3] = { rangeEnd(resps.mOffset, q, mNodes.size()), rangeEnd(resps.hOffset, q, hNodes.size()),
+                rangeEnd(resps.fOffset, q, fNodes.size()) };
+            const parlay::sequence<int>* ids[3] = { &mId, &hId, &fId };
+
+            size_t len = putVarint(dst, resps.queryIdx[q]);
+            for (int k = 0; k < 3; k++) len += putVarint(dst ? dst + len : nullptr, end[k] - start[k]);
+            for (int k = 0; k < 3; k++) {
+                int prev = 0;
+                for (size_t i = start[k]; i < end[k]; i++) {
+                    int id = (*ids[k])[i];
+                    len += putVarint(dst ? dst + len : nullptr, id - prev);
+                    prev = id;
+                }
+            }
+            return len;
+            });
+
+        return out;
+    }
+
+    VerifiableRangeQueryResponses deserializeResponses(const uint8_t* data, size_t size) {
+        Reader in{ data, data + size };
+
+        uint8_t header[7];
+        in.raw(header, 7);
+        if (memcmp(header, MAGIC, 4) != 0 || header[4] != VERSION) Reader::fail();
+        if (header[5] != sizeof(hash_t) || header[6] != sizeof(mfloat)) {
+            throw std::runtime_error("Range query proof uses another digest or float size");
+        }
+
+        size_t nq = in.count();
+        size_t nm = in.count(), nh = in.count(), nf = in.count();
+
+        // shared node dictionaries
+        MNodes mDict;
+        mDict.resize(nm);
+        for (int64_t j = 0, key = FIRST_PREV; j < int64_t(nm); j++) {
+            key += in.varint();
+            mDict.key[j] = int(key);
+            mDict.parentCode[j] = int(unzigzag(in.varint()) + 2 * int64_t(mDict.key[j]));
+            uint8_t dimAndRemoval = in.byte();
+            mDict.splitDim[j] = dimAndRemoval & 3;
+            mDict.removal[j] = dimAndRemoval >> 2;
+            in.raw(&mDict.splitVal[j], sizeof(mfloat));
+        }
+
+        HNodes hDict;
+        hDict.resize(nh);
+        for (int64_t j = 0, code = FIRST_PREV; j < int64_t(nh); j++) {
+            code += in.varint();
+            hDict.parentCode[j] = int(code);
+            in.raw(hDict.hash[j].byte, sizeof(hash_t));
+        }
+
+        FNodes fDict;
+        fDict.resize(nf);
+        for (int64_t j = 0, code = FIRST_PREV; j < int64_t(nf); j++) {
+            uint64_t v = in.varint();
+            code += v >> 1;
+            fDict.parentCode[j] = int(code);
+            fDict.removal[j] = v & 1;
+            in.raw(&fDict.pt[j], sizeof(vec3f));
+        }
+
+        // per query ids, offsets are exclusive prefix sums of the counts
+        VerifiableRangeQueryResponses resps(nq);
+        vector<int> ids[3];
+        parlay::sequence<int>* offset[3] = { &resps.mOffset, &resps.hOffset, &resps.fOffset };
+        size_t dictSize[3] = { nm, nh, nf };
+        for (size_t q = 0; q < nq; q++) {
+            resps.queryIdx[q] = int(in.varint());
+            size_t n[3];
+            for (int k = 0; k < 3; k++) n[k] = in.count();
+            for (int k = 0; k < 3; k++) {
+                (*offset[k])[q] = int(ids[k].size());
+                int prev = 0;
+                for (size_t i = 0; i < n[k]; i++) {
+                    prev = in.id(prev, dictSize[k]);
+                    ids[k].push_back(prev);
+                }
+            }
+        }
+        if (in.p != in.end) Reader::fail();
+
+        resps.initVerificationSet(ids[2].size(), ids[0].size(), ids[1].size());
+        auto& vs = resps.vs;
+        parlay::parallel_for(0, ids[0].size(), [&](size_t i) {
+            int j = ids[0][i];
+            vs.mNodes.key[i] = mDict.key[j];
+            vs.mNodes.splitDim[i] = mDict.splitDim[j];
+            vs.mNodes.splitVal[i] = mDict.splitVal[j];
+            vs.mNodes.removal[i] = mDict.removal[j];
+            vs.mNodes.parentCode[i] = mDict.parentCode[j];
+            });
+        parlay::parallel_for(0, ids[1].size(), [&](size_t i) {
+            int j = ids[1][i];
+            vs.hNodes.hash[i] = hDict.hash[j];
+            vs.hNodes.parentCode[i] = hDict.parentCode[j];
+            });
+        parlay::parallel_for(0, ids[2].size(), [&](size_t i) {
+            int j = ids[2][i];
+            vs.fNodes.pt[i] = fDict.pt[j];
+            vs.fNodes.removal[i] = fDict.removal[j];
+            vs.fNodes.parentCode[i] = fDict.parentCode[j];
+            });
+        return resps;
+    }
+
+    bool saveResponses(const VerifiableRangeQueryResponses& resps, const std::string& filename) {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file.is_open()) return false;
+
+        auto data = serializeResponses(resps);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        return bool(file);
+    }
+
+    VerifiableRangeQueryResponses loadResponses(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot open " + filename);
+        }
+        vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return deserializeResponses(data.data(), data.size());
+    }
+}
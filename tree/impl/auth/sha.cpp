@@ -0,0 +1,230 @@
+#include <string.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <auth/sha.h>
+
+// node messages are short (1 or 2 blocks), so a per-message SHA256() call is mostly overhead
+// SHA extensions: one message at a time, the compression runs in sha256rnds2
+// multi-buffer: lane i of every AVX2 register holds the state of message i
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SHA __attribute__((target("sha,sse4.1")))
+#else
+#define TARGET_AVX2
+#define TARGET_SHA
+#endif
+
+namespace pmkd {
+    namespace {
+        constexpr uint32_t K256[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        constexpr uint32_t H256[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+
+        // node messages fit in 2 blocks, longer ones take the scalar path
+        constexpr size_t MAX_LANE_BLOCKS = 2;
+
+        bool cpuHasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+            return __builtin_cpu_supports("avx2");
+#else
+            int info[4];
+            __cpuidex(info, 7, 0);
+            return (info[1] >> 5) & 1;
+#endif
+        }
+
+        bool cpuHasSha() {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuidex(info, 7, 0);
+            return (info[1] >> 29) & 1;
+#else
+            unsigned a, b, c, d;
+            return __get_cpuid_count(7, 0, &a, &b, &c, &d) && ((b >> 29) & 1);
+#endif
+        }
+
+        bool useSha() {
+            static const bool hasSha = cpuHasSha();
+            return hasSha;
+        }
+
+        bool useAvx2() {
+            static const bool hasAvx2 = cpuHasAvx2();
+            return hasAvx2;
+        }
+
+        inline uint32_t loadBE32(const uint8_t* p) {
+            return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+
+        inline void storeBE32(uint8_t* p, uint32_t v) {
+            p[0] = uint8_t(v >> 24);
+            p[1] = uint8_t(v >> 16);
+            p[2] = uint8_t(v >> 8);
+            p[3] = uint8_t(v);
+        }
+
+        // copy the last len bytes of a message of totalLen bytes and append the SHA-256 padding
+        // return the number of 64-byte blocks
+        size_t padMessage(const uint8_t* msg, size_t len, size_t totalLen, uint8_t* blocks) {
+            size_t nBlocks = (len + 9 + 63) / 64;
+            memcpy(blocks, msg, len);
+            blocks[len] = 0x80;
+            memset(blocks + len + 1, 0, nBlocks * 64 - len - 9);
+            uint64_t bits = uint64_t(totalLen) * 8;
+            for (int i = 0; i < 8; i++) blocks[nBlocks * 64 - 1 - i] = uint8_t(bits >> (8 * i));
+            return nBlocks;
+        }
+
+        // the state is kept as ABEF and CDGH, the layout sha256rnds2 works on
+        TARGET_SHA void compressSha(uint32_t state[8], const uint8_t* blocks, size_t nBlocks) {
+            const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+            __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+            __m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+            __m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+            cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+            for (size_t k = 0; k < nBlocks; k++, blocks += 64) {
+                __m128i abefSaved = abef, cdghSaved = cdgh;
+                // w[i % 4] holds the schedule words 4i..4i+3
+                __m128i w[4];
+                for (int i = 0; i < 16; i++) {
+                    if (i < 4) w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)), byteSwap);
+                    else {
+                        __m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]),
+                            _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                        w[i % 4] = _mm_sha256msg2_epu32(t, w[(i + 3) % 4]);
+                    }
+                    __m128i msg = _mm_add_epi32(w[i % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(K256 + 4 * i)));
+                    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+                    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+                }
+                abef = _mm_add_epi32(abef, abefSaved);
+                cdgh = _mm_add_epi32(cdgh, cdghSaved);
+            }
+
+            tmp = _mm_shuffle_epi32(abef, 0x1B);
+            cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(tmp, cdgh, 0xF0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+        }
+
+        void sha256Sha(const uint8_t* msg, size_t len, uint8_t* digest) {
+            uint32_t state[8];
+            memcpy(state, H256, sizeof(state));
+            // full blocks straight from the message, the tail is padded on the stack
+            size_t nFull = len / 64;
+            compressSha(state, msg, nFull);
+            uint8_t tail[128];
+            size_t nTail = padMessage(msg + nFull * 64, len - nFull * 64, len, tail);
+            compressSha(state, tail, nTail);
+            for (int j = 0; j < 8; j++) storeBE32(digest + 4 * j, state[j]);
+        }
+
+        template<int N>
+        TARGET_AVX2 inline __m256i rotr(__m256i x) {
+            return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N));
+        }
+
+        TARGET_AVX2 inline __m256i add(__m256i a, __m256i b) { return _mm256_add_epi32(a, b); }
+
+        TARGET_AVX2 inline __m256i xor3(__m256i a, __m256i b, __m256i c) {
+            return _mm256_xor_si256(_mm256_xor_si256(a, b), c);
+        }
+
+        // one block of each lane, block[i] is the block of lane i
+        TARGET_AVX2 void compressLanes(__m256i state[8], const uint8_t* const block[SHA256_LANES]) {
+            __m256i w[64];
+            for (int t = 0; t < 16; t++) {
+                w[t] = _mm256_setr_epi32(
+                    loadBE32(block[0] + 4 * t), loadBE32(block[1] + 4 * t), loadBE32(block[2] + 4 * t), loadBE32(block[3] + 4 * t),
+                    loadBE32(block[4] + 4 * t), loadBE32(block[5] + 4 * t), loadBE32(block[6] + 4 * t), loadBE32(block[7] + 4 * t));
+            }
+            for (int t = 16; t < 64; t++) {
+                __m256i s0 = xor3(rotr<7>(w[t - 15]), rotr<18>(w[t - 15]), _mm256_srli_epi32(w[t - 15], 3));
+                __m256i s1 = xor3(rotr<17>(w[t - 2]), rotr<19>(w[t - 2]), _mm256_srli_epi32(w[t - 2], 10));
+                w[t] = add(add(w[t - 16], s0), add(w[t - 7], s1));
+            }
+
+            __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+            __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int t = 0; t < 64; t++) {
+                __m256i s1 = xor3(rotr<6>(e), rotr<11>(e), rotr<25>(e));
+                __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+                __m256i t1 = add(add(add(h, s1), add(ch, _mm256_set1_epi32(int(K256[t])))), w[t]);
+                __m256i s0 = xor3(rotr<2>(a), rotr<13>(a), rotr<22>(a));
+                __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+                __m256i t2 = add(s0, maj);
+                h = g;
+                g = f;
+                f = e;
+                e = add(d, t1);
+                d = c;
+                c = b;
+                b = a;
+                a = add(t1, t2);
+            }
+            state[0] = add(state[0], a);
+            state[1] = add(state[1], b);
+            state[2] = add(state[2], c);
+            state[3] = add(state[3], d);
+            state[4] = add(state[4], e);
+            state[5] = add(state[5], f);
+            state[6] = add(state[6], g);
+            state[7] = add(state[7], h);
+        }
+
+        // unused lanes hash a copy of lane 0 and are dropped
+        TARGET_AVX2 void sha256LanesAvx2(const uint8_t* const msgs[], size_t len, int n, uint8_t* const digests[]) {
+            alignas(32) uint8_t padded[SHA256_LANES][MAX_LANE_BLOCKS * 64];
+            size_t nBlocks = 0;
+            for (int i = 0; i < n; i++) nBlocks = padMessage(msgs[i], len, len, padded[i]);
+
+            __m256i state[8];
+            for (int j = 0; j < 8; j++) state[j] = _mm256_set1_epi32(int(H256[j]));
+            for (size_t k = 0; k < nBlocks; k++) {
+                const uint8_t* block[SHA256_LANES];
+                for (int i = 0; i < SHA256_LANES; i++) block[i] = padded[i < n ? i : 0] + k * 64;
+                compressLanes(state, block);
+            }
+
+            alignas(32) uint32_t words[8][SHA256_LANES];
+            for (int j = 0; j < 8; j++) _mm256_store_si256(reinterpret_cast<__m256i*>(words[j]), state[j]);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < 8; j++) storeBE32(digests[i] + 4 * j, words[j][i]);
+            }
+        }
+    }
+
+    void sha256(const uint8_t* msg, size_t len, uint8_t* digest) {
+        if (useSha()) sha256Sha(msg, len, digest);
+        else SHA256(msg, len, digest);
+    }
+
+    void sha256Lanes(const uint8_t* const msgs[], size_t len, int n, uint8_t* const digests[]) {
+        // a single message is not worth eight lanes, and the SHA extensions win unless most lanes are filled
+        int minLanes = useSha() ? SHA256_LANES * 3 / 4 : 2;
+        if (!useAvx2() || n < minLanes || len + 9 > MAX_LANE_BLOCKS * 64) {
+            for (int i = 0; i < n; i++) sha256(msgs[i], len, digests[i]);
+            return;
+        }
+        sha256LanesAvx2(msgs, len, n, digests);
+    }
+}
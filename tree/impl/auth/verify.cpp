@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <fmt/ranges.h>
 #include <auth/verify.h>
 
@@ -10,6 +13,19 @@ namespace pmkd {
         ChildHash():ref{nullptr, nullptr} {}
     };
 
+    namespace {
+        // the points of a leaf are consecutive F nodes sharing its parent code, a bucket has several of them
+        bool isLeafStart(const FNodes& fNodes, size_t fStart, size_t i) {
+            return i == fStart || fNodes.parentCode[i] != fNodes.parentCode[i - 1];
+        }
+
+        int leafPointCount(const FNodes& fNodes, size_t i, size_t fEnd) {
+            size_t j = i + 1;
+            while (j < fEnd && fNodes.parentCode[j] == fNodes.parentCode[i]) j++;
+            return j - i;
+        }
+    }
+
     bool verifyRangeQuery(const hash_t& rootHash, const RangeQuery& query, const VerifiableRangeQueryResponses& resps, size_t idx,
         parlay::parlay_unordered_map<int, size_t>& table) {
 
@@ -90,11 +106,18 @@ namespace pmkd {
             }
         }
         );
-        // bottom up from F Nodes
+        // bottom up from F Nodes, once per leaf
+        std::atomic<bool> oversized = false;
         parlay::parallel_for(fStart, fEnd, [&](size_t i) {
             const auto& fNodes = resps.vs.fNodes;
             const auto& mNodes = resps.vs.mNodes;
-            computeDigest(&lHash[i - fStart], fNodes.pt[i].x, fNodes.pt[i].y, fNodes.pt[i].z, fNodes.removal[i]);
+            if (!isLeafStart(fNodes, fStart, i)) return;
+            int n = leafPointCount(fNodes, i, fEnd);
+            if (n > MAX_BUCKET_SIZE) {
+                oversized = true;
+                return;
+            }
+            computeBucketDigest(&lHash[i - fStart], &fNodes.pt[i], n, fNodes.removal[i]);
 
             K key;
             bool isRC;
@@ -130,7 +153,7 @@ namespace pmkd {
         // clean up
         table.clear();
 
-        return rootIndex < 0 || equal(mHash[rootIndex], rootHash);
+        return !oversized && (rootIndex < 0 || equal(mHash[rootIndex], rootHash));
     }
 
     bool verifyRangeQuery_Sequential(const hash_t& rootHash, const RangeQuery& query, const VerifiableRangeQueryResponses& resps, size_t idx,
@@ -188,11 +211,17 @@ namespace pmkd {
             }
         }
 
-        // bottom up from F Nodes
+        // bottom up from F Nodes, once per leaf
         for (size_t i = fStart; i < fEnd; i++) {
             const auto& fNodes = resps.vs.fNodes;
             const auto& mNodes = resps.vs.mNodes;
-            computeDigest(&lHash[i - fStart], fNodes.pt[i].x, fNodes.pt[i].y, fNodes.pt[i].z, fNodes.removal[i]);
+            if (!isLeafStart(fNodes, fStart, i)) continue;
+            int n = leafPointCount(fNodes, i, fEnd);
+            if (n > MAX_BUCKET_SIZE) {
+                table.clear();
+                return false;
+            }
+            computeBucketDigest(&lHash[i - fStart], &fNodes.pt[i], n, fNodes.removal[i]);
 
             K key;
             bool isRC;
@@ -231,4 +260,76 @@ namespace pmkd {
 
         return rootIndex < 0 || equal(mHash[rootIndex], rootHash);
     }
+
+    vector<uint8_t> verifyRangeQueries(const hash_t& rootHash, const VerifiableRangeQueryResponses& resps) {
+        const auto& fNodes = resps.vs.fNodes;
+        const auto& mNodes = resps.vs.mNodes;
+        const auto& hNodes = resps.vs.hNodes;
+        size_t nq = resps.size();
+
+        // scratch space shared by all queries, each query works on the ranges of its own nodes
+        parlay::sequence<std::pair<int, int>> mTable(mNodes.size());  // (key, m node), sorted by key per query
+        parlay::sequence<uint8_t> visitCount(mNodes.size(), 0);
+        parlay::sequence<hash_t> mHash(mNodes.size());
+        parlay::sequence<ChildHash> childHash(mNodes.size());
+        parlay::sequence<hash_t> lHash(fNodes.size());
+        vector<uint8_t> correct(nq);
+
+        parlay::parallel_for(0, nq, [&](size_t idx) {
+            size_t mStart = resps.mOffset[idx], mEnd = idx < nq - 1 ? resps.mOffset[idx + 1] : mNodes.size();
+            size_t hStart = resps.hOffset[idx], hEnd = idx < nq - 1 ? resps.hOffset[idx + 1] : hNodes.size();
+            size_t fStart = resps.fOffset[idx], fEnd = idx < nq - 1 ? resps.fOffset[idx + 1] : fNodes.size();
+
+            auto tableBegin = mTable.begin() + mStart, tableEnd = mTable.begin() + mEnd;
+            for (size_t i = mStart; i < mEnd; i++) mTable[i] = { mNodes.key[i], int(i) };
+            std::sort(tableBegin, tableEnd);
+
+            // point leaves are hashed DIGEST_LANES at a time, buckets one by one
+            DigestBatch<> batch;
+            bool ok = true;
+            for (size_t i = fStart; ok && i < fEnd; i++) {
+                if (!isLeafStart(fNodes, fStart, i)) continue;
+                int n = leafPointCount(fNodes, i, fEnd);
+                if (n == 1) batch.addLeaf(&lHash[i], fNodes.pt[i].x, fNodes.pt[i].y, fNodes.pt[i].z, fNodes.removal[i]);
+                else if (n <= MAX_BUCKET_SIZE) computeBucketDigest(&lHash[i], &fNodes.pt[i], n, fNodes.removal[i]);
+                else ok = false;
+            }
+            batch.flush();
+
+            // hand a child hash to its parent, and go up while the parent has both children
+            int rootIndex = -1;
+            auto climb = [&](int parentCode, const hash_t* hash) {
+                while (true) {
+                    int key;
+                    bool isRC;
+                    decodeParent(parentCode, key, isRC);
+                    auto it = std::lower_bound(tableBegin, tableEnd, std::make_pair(key, INT_MIN));
+                    if (it == tableEnd || it->first != key) return false;
+                    int m = it->second;
+                    if (childHash[m][isRC]) return false;
+
+                    childHash[m][isRC] = hash;
+                    if (++visitCount[m] < 2) return true;
+
+                    computeDigest(&mHash[m], childHash[m][0], childHash[m][1],
+                        mNodes.splitDim[m], mNodes.splitVal[m], mNodes.removal[m]);
+                    parentCode = mNodes.parentCode[m];
+                    if (parentCode == -1) {
+                        rootIndex = m;
+                        return true;
+                    }
+                    hash = &mHash[m];
+                }
+            };
+
+            for (size_t i = hStart; ok && i < hEnd; i++) ok = climb(hNodes.parentCode[i], &hNodes.hash[i]);
+            for (size_t i = fStart; ok && i < fEnd; i++)
+                if (isLeafStart(fNodes, fStart, i)) ok = climb(fNodes.parentCode[i], &lHash[i]);
+            // every m node must get both children, and only an empty proof may skip the root
+            for (size_t i = mStart; ok && i < mEnd; i++) ok = visitCount[i] == 2;
+            bool empty = mStart == mEnd && hStart == hEnd && fStart == fEnd;
+            correct[idx] = ok && (empty || (rootIndex >= 0 && equal(mHash[rootIndex], rootHash)));
+        });
+        return correct;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,28 @@
+#include <tree/device_helper.h>
+#include <tree/kernel.h>
+
+namespace pmkd {
+
+	void BucketKernel::markBucketBounds(int idx, int size, INPUT(uint8_t*) metrics, int bucketSize, OUTPUT(uint8_t*) isBound) {
+		if (idx >= size) return;
+
+		// the node splitting at idx covers leaves (lb, rb], an equal metric on the left belongs to an ancestor
+		// (see BuildKernel::buildInteriors), the scans stop as soon as more than bucketSize leaves are covered
+		uint8_t metric = metrics[idx];
+		int lb = idx - 1;
+		while (lb >= 0 && idx - lb <= bucketSize && metrics[lb] < metric) --lb;
+		int rb = idx + 1;
+		while (rb < size && rb - idx <= bucketSize && metrics[rb] <= metric) ++rb;
+		isBound[idx] = rb - lb > bucketSize;
+	}
+
+#ifdef ENABLE_MERKLE
+	void BucketKernel::calcBucketHash(int idx, int size, INPUT(vec3f*) pts, INPUT(int*) bucketOffset,
+		OUTPUT(hash_t*) leafHash) {
+		if (idx >= size) return;
+
+		int begin = bucketOffset[idx];
+		computeBucketDigest(leafHash + idx, pts + begin, bucketOffset[idx + 1] - begin);
+	}
+#endif
+}
@@ -19,14 +19,13 @@ namespace pmkd {
 	}
 	
 	void BuildKernel::calcBuildMetrics(int idx, int interiorSize, const AABB& gBoundary, INPUT(MortonType*) morton,
-		OUTPUT(uint8_t*) metrics, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal) {
+		OUTPUT(uint8_t*) metrics, InteriorsRawRepr interiors) {
 		if (idx >= interiorSize) return;
 
 		// reflects the highest differing bit between the keys covered by interior node idx
 		uint8_t metric = MortonType::calcMetric(morton[idx], morton[idx + 1]);
 		metrics[idx] = metric;
-		MortonType::calcSplit(metric, morton[idx + 1], gBoundary.ptMin, gBoundary.ptMax,
-			splitDim + idx, splitVal + idx);
+		setSplit(interiors, idx, metric, morton[idx + 1], gBoundary);
 	}
 
 	void BuildKernel::buildInteriors(int idx, int leafSize, const LeavesRawRepr leaves,
@@ -151,21 +150,20 @@ namespace pmkd {
 
 	// in place
 	void BuildKernel::reorderInteriors(int idx, int interiorSize, INPUT(int*) mapidx, const InteriorsRawRepr interiors,
-		OUTPUT(int*) rangeL, OUTPUT(int*) rangeR, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal, OUTPUT(int*) parent) {
+		InteriorsRawRepr reordered) {
 
 		if (idx >= interiorSize) return;
 		int mapped_idx = mapidx[idx];
 
-		rangeL[mapped_idx] = interiors.rangeL[idx];
-		rangeR[mapped_idx] = interiors.rangeR[idx];
+		reordered.rangeL[mapped_idx] = interiors.rangeL[idx];
+		reordered.rangeR[mapped_idx] = interiors.rangeR[idx];
 
-		splitDim[mapped_idx] = interiors.splitDim[idx];
-		splitVal[mapped_idx] = interiors.splitVal[idx];
+		copySplit(reordered, mapped_idx, interiors, idx);
 
 		int parentIdx;
 		bool isRC;
 		decodeParentCode(interiors.parent[idx], parentIdx, isRC);
-		parent[mapped_idx] = parentIdx >= 0 ? encodeParentCode(mapidx[parentIdx], isRC) : -1;
+		reordered.parent[mapped_idx] = parentIdx >= 0 ? encodeParentCode(mapidx[parentIdx], isRC) : -1;
 	}
 
 	void BuildKernel::remapLeafParents(int idx, int leafSize, INPUT(int*) mapidx, LeavesRawRepr leaves) {
@@ -179,6 +177,13 @@ namespace pmkd {
 		leaves.parent[idx] = encodeParentCode(mapped_idx, isRC);
 	}
 
+	void BuildKernel::calcLiveCount(int idx, int interiorSize, INPUT(int*) validAcc, InteriorsRawRepr interiors) {
+		if (idx >= interiorSize) return;
+
+		int liveCount = validAcc[interiors.rangeR[idx] + 1] - validAcc[interiors.rangeL[idx]];
+		interiors.liveCount[idx].store(liveCount, std::memory_order_relaxed);
+	}
+
 #ifdef ENABLE_MERKLE
 	void BuildKernel::calcLeafHash(int idx, int size, INPUT(vec3f*) pts, INPUT(int*) removeFlag, OUTPUT(hash_t*) leafHash) {
 		if (idx >= size) return;
@@ -231,8 +236,8 @@ namespace pmkd {
 			const hash_t* otherChildHash;
 			getOtherChildHash(leaves, interiors, left, current, leafSize, isRC, otherChildHash);
 
-			computeDigest(interiors.hash + current, childHash, otherChildHash,
-				interiors.splitDim[current], interiors.splitVal[current], interiors.removeState[current]);
+			computeDigest(interiors.hash + current, isRC ? otherChildHash : childHash, isRC ? childHash : otherChildHash,
+				getSplitDim(interiors, current), getSplitVal(interiors, current), getRemoveState(interiors, current));
 
 			if (current == 0) break; // root
 
@@ -241,5 +246,60 @@ namespace pmkd {
 			decodeParentCode(interiors.parent[current], parent, isRC);
 		}
 	}
+
+	void BuildKernel::calcLeafHashGroup(int groupIdx, int size, INPUT(vec3f*) pts, INPUT(int*) removeFlag,
+		OUTPUT(hash_t*) leafHash) {
+		int begin = groupIdx * DIGEST_LANES;
+		int end = std::min(begin + DIGEST_LANES, size);
+
+		DigestBatch<> batch;
+		for (int i = begin; i < end; i++)
+			batch.addLeaf(leafHash + i, pts[i].x, pts[i].y, pts[i].z, removeFlag && removeFlag[i] == -1);
+		batch.flush();
+	}
+
+	void BuildKernel::calcInteriorHeight(int idx, int leafSize, const LeavesRawRepr leaves,
+		const InteriorsRawRepr interiors, OUTPUT(AtomicCount*) visitCount, OUTPUT(int*) height) {
+		if (idx >= leafSize) return;
+
+		int parent;
+		bool isRC;
+		decodeParentCode(leaves.parent[idx], parent, isRC);
+
+		int h = 0;
+		while (true) {
+			// raise the parent to h + 1 before arriving, the second arrival then reads the final height
+			std::atomic_ref<int> parentHeight(height[parent]);
+			int old = parentHeight.load(std::memory_order_relaxed);
+			while (old < h + 1 && !parentHeight.compare_exchange_weak(old, h + 1, std::memory_order_relaxed));
+
+			if (visitCount[parent].cnt.fetch_add(1, std::memory_order_acq_rel) != 3) break;
+
+			int current = parent;
+			if (current == 0) break; // root
+			h = parentHeight.load(std::memory_order_relaxed);
+
+			decodeParentCode(interiors.parent[current], parent, isRC);
+		}
+	}
+
+	void BuildKernel::calcInteriorHashGroup(int groupIdx, int size, INPUT(int*) nodes, int leafSize,
+		const LeavesRawRepr leaves, InteriorsRawRepr interiors) {
+		int begin = groupIdx * DIGEST_LANES;
+		int end = std::min(begin + DIGEST_LANES, size);
+
+		DigestBatch<> batch;
+		for (int i = begin; i < end; i++) {
+			int current = nodes[i];
+			int left = interiors.rangeL[current];
+			const hash_t* lcHash, * rcHash;
+			getOtherChildHash(leaves, interiors, left, current, leafSize, true, lcHash);
+			getOtherChildHash(leaves, interiors, left, current, leafSize, false, rcHash);
+
+			batch.addInterior(interiors.hash + current, lcHash, rcHash,
+				getSplitDim(interiors, current), getSplitVal(interiors, current), getRemoveState(interiors, current));
+		}
+		batch.flush();
+	}
 #endif
 }
\ No newline at end of file
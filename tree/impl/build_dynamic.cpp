@@ -4,7 +4,7 @@
 namespace pmkd {
     void DynamicBuildKernel::calcBuildMetrics(int idx, int interiorRealSize, const AABB& gBoundary,
         INPUT(MortonType*) morton, INPUT(int*) interiorToLeafIdx,
-        OUTPUT(uint8_t*) metrics, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal) {
+        OUTPUT(uint8_t*) metrics, InteriorsRawRepr interiors) {
         
         if (idx >= interiorRealSize) return;
         int leafIdx = interiorToLeafIdx[idx];
@@ -12,8 +12,7 @@ namespace pmkd {
         // reflects the highest differing bit between the keys covered by interior node idx
         uint8_t metric = MortonType::calcMetric(morton[leafIdx], morton[leafIdx + 1]);
         metrics[leafIdx] = metric;
-        MortonType::calcSplit(metric, morton[leafIdx + 1], gBoundary.ptMin, gBoundary.ptMax,
-            splitDim + leafIdx, splitVal + leafIdx);
+        setSplit(interiors, leafIdx, metric, morton[leafIdx + 1], gBoundary);
     }
 
     void DynamicBuildKernel::buildInteriors(int idx, int batchLeafSize, INPUT(int*) localRangeL, const LeavesRawRepr leaves,
@@ -97,22 +96,21 @@ namespace pmkd {
     }
 
     void DynamicBuildKernel::reorderInteriors(int idx, int batchInteriorSize, INPUT(int*) mapidx, const InteriorsRawRepr interiors,
-        OUTPUT(int*) rangeL, OUTPUT(int*) rangeR, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal, OUTPUT(int*) parent) {
+        InteriorsRawRepr reordered) {
 
         if (idx >= batchInteriorSize) return;
         int mapped_idx = mapidx[idx];
         if (mapped_idx == -1) return;
 
-        rangeL[mapped_idx] = interiors.rangeL[idx];
-        rangeR[mapped_idx] = interiors.rangeR[idx];
+        reordered.rangeL[mapped_idx] = interiors.rangeL[idx];
+        reordered.rangeR[mapped_idx] = interiors.rangeR[idx];
 
-        splitDim[mapped_idx] = interiors.splitDim[idx];
-        splitVal[mapped_idx] = interiors.splitVal[idx];
+        copySplit(reordered, mapped_idx, interiors, idx);
 
         int parentIdx;
         bool isRC;
         decodeParentCode(interiors.parent[idx], parentIdx, isRC);
-        parent[mapped_idx] = parentIdx >= 0 ? encodeParentCode(mapidx[parentIdx], isRC) : -1;
+        reordered.parent[mapped_idx] = parentIdx >= 0 ? encodeParentCode(mapidx[parentIdx], isRC) : -1;
     }
 
     void DynamicBuildKernel::remapLeafParents(int idx, int batchLeafSize, INPUT(int*) mapidx, LeavesRawRepr leaves) {
@@ -138,7 +136,7 @@ namespace pmkd {
         // int binIdx = derivedFrom[firstLeafOfSubtree];
 
         // int iBatch, offset;
-        // transformLeafIdx(binIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, offset);
+        // transformLeafIdx(binIdx, nodeMgr, iBatch, offset);
         // const auto& leaves = nodeMgr.leavesBatch[iBatch];
         // const auto& interiors = nodeMgr.interiorsBatch[iBatch];
 
@@ -190,8 +188,8 @@ namespace pmkd {
             const hash_t* otherChildHash;
             getOtherChildHash(leaves, interiors, left, current, rBound, isRC, otherChildHash);
 
-            computeDigest(interiors.hash + current, childHash, otherChildHash,
-                interiors.splitDim[current], interiors.splitVal[current], interiors.removeState[current].load(std::memory_order_relaxed));
+            computeDigest(interiors.hash + current, isRC ? otherChildHash : childHash, isRC ? childHash : otherChildHash,
+                getSplitDim(interiors, current), getSplitVal(interiors, current), interiors.removeState[current].load(std::memory_order_relaxed));
 
             int parentCode = interiors.parent[current];
             if (parentCode < 0) {
@@ -216,7 +214,7 @@ namespace pmkd {
 
         int globalLeafIdx = binIdx[idx];
         int iBatch, localLeafIdx;
-        transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+        transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
 
         while (true) {
             const auto& leaves = nodeMgr.leavesBatch[iBatch];
@@ -224,6 +222,9 @@ namespace pmkd {
 
             int rBound = iBatch == 0 ? mainTreeLeafSize : leaves.treeLocalRangeR[localLeafIdx];
 
+            // a replaced leaf stands for the subtree replacing it
+            leaves.hash[localLeafIdx] = *childHash;
+
             int parent;
             bool isRC;
             decodeParentCode(leaves.parent[localLeafIdx], parent, isRC);
@@ -242,22 +243,21 @@ namespace pmkd {
                 const hash_t* otherChildHash;
                 getOtherChildHash(leaves, interiors, left, current, rBound, isRC, otherChildHash);
 
-                computeDigest(interiors.hash + current, childHash, otherChildHash,
-                    interiors.splitDim[current], interiors.splitVal[current], interiors.removeState[current].load(std::memory_order_relaxed));
+                computeDigest(interiors.hash + current, isRC ? otherChildHash : childHash, isRC ? childHash : otherChildHash,
+                    getSplitDim(interiors, current), getSplitVal(interiors, current), interiors.removeState[current].load(std::memory_order_relaxed));
 
                 childHash = interiors.hash + current;
 
                 int parentCode = interiors.parent[current];
-                decodeParentCode(parentCode, parent, isRC);
-
                 if (parentCode < 0) {
                     break;
                 }
+                decodeParentCode(parentCode, parent, isRC);
             }
             if (current != parent || iBatch == 0) break;  // does not reach sub root, or main root visited
 
             globalLeafIdx = leaves.derivedFrom[localLeafIdx];
-            transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
         }
     }
 
@@ -297,8 +297,8 @@ namespace pmkd {
                 const hash_t* otherChildHash;
                 getOtherChildHash(*leaves, *interiors, left, current, rBound, isRC, otherChildHash);
 
-                computeDigest(interiors->hash + current, childHash, otherChildHash,
-                    interiors->splitDim[current], interiors->splitVal[current], interiors->removeState[current].load(std::memory_order_relaxed));
+                computeDigest(interiors->hash + current, isRC ? otherChildHash : childHash, isRC ? childHash : otherChildHash,
+                    getSplitDim(*interiors, current), getSplitVal(*interiors, current), interiors->removeState[current].load(std::memory_order_relaxed));
 
                 childHash = interiors->hash + current;
 
@@ -318,7 +318,7 @@ namespace pmkd {
             isUpperLevel = true;
 
             globalLeafIdx = leaves->derivedFrom[localLeafIdx];
-            transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
 
             leaves = nodeMgr.leavesBatch + iBatch;
             interiors = nodeMgr.interiorsBatch + iBatch;
@@ -70,7 +70,7 @@ namespace pmkd {
             [&](size_t i) {
                     UpdateKernel::findLeafBin(
                         i, sizeInc, targetPts, primSize(),
-                        interiors.getRawRepr(), leaves.getRawRepr(),
+                        interiors.getRawRepr(), leaves.getRawRepr(), nodeMgr->getJumpTable(), nullptr,
                         binIdx.data());
                 });
         maxBin = parlay::reduce(binIdx, parlay::maximum<int>());
@@ -187,16 +187,39 @@ namespace pmkd {
         bufferPool->release(std::move(binIdx));
     }
 
-    void PMKDTree::execute(const vector<vec3f>& ptsRemove, const vector<vec3f>& ptsAdd) {
-        if (ptsRemove.empty()) {
-            insert(ptsAdd);
+    void PMKDTree::execute(const vector<vec3f>& ptsRequested, const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd) {
+        if (ptsRequested.empty()) {
+            insert(ptsAdd, payloadsAdd);
             return;
         }
         if (ptsAdd.empty()) {
-            remove(ptsRemove);
+            remove(ptsRequested);
+            return;
+        }
+        // the fused pass takes each leaf of the main tree for a single point
+        if (nodeMgr->isBucketed()) {
+            remove(ptsRequested);
+            insert(ptsAdd, payloadsAdd);
+            return;
+        }
+        finishCompaction(false);
+#ifdef ENABLE_MERKLE
+        // the fused update hashes eagerly
+        refreshMerkle();
+#endif
+        // with a point index only the stored points are removed, as in remove()
+        vector<vec3f> ptsStored;
+        if (pointIndex) ptsStored = takeFromPointIndex(ptsRequested);
+        const auto& ptsRemove = pointIndex ? ptsStored : ptsRequested;
+        if (ptsRemove.empty()) {
+            insert(ptsAdd, payloadsAdd);
             return;
         }
+        bool rebuild = needRebuild(ptsAdd.size(), ptsRemove.size());
+        logPendingUpdate(ptsRemove, ptsAdd, payloadsAdd);
+        if (pointIndex) addToPointIndex(ptsAdd);
         isStatic = false;
+        nodeMgr->prepareUpdates();
 
         // remove-----------------------------------
         size_t nRemove = ptsRemove.size();
@@ -215,13 +238,25 @@ namespace pmkd {
         }
 
         auto nodeMgrDevice = nodeMgr->getDeviceHandle();
+        vector<int> startNode;
+        if (config.optimize) startNode = findPacketStarts(target, nRemove);
 
         parlay::parallel_for(0, nRemove, [&](size_t i) {
-            UpdateKernel::removePoints_step1(i, nRemove, target, nodeMgrDevice, primSize(), removeBinIdx.data());
+            UpdateKernel::removePoints_step1(i, nRemove, target, nodeMgrDevice, primSize(),
+                startNode.empty() ? nullptr : startNode.data(), removeBinIdx.data());
             }
         );
 
         if (!ptsRemoveSorted.empty()) bufferPool->release(std::move(ptsRemoveSorted));
+        if (!startNode.empty()) bufferPool->release(std::move(startNode));
+
+        if (rebuild && !config.asyncRebuild) {
+            // the removed leaves are marked, the rebuild drops them and takes the new points
+            bufferPool->release(std::move(removeBinIdx));
+            rebuildUponInsert(ptsAdd, payloadsAdd);
+            isStatic = true;
+            return;
+        }
 
         // insert------------------------------------
         size_t ptNum = primSize();
@@ -244,15 +279,23 @@ namespace pmkd {
         );
         bufferPool->release<MortonType>(std::move(morton));
 
+        vector<Payload> payloadsAddSorted;
+        if (!payloadsAdd.empty()) {
+            payloadsAddSorted.resize(sizeInc);
+            parlay::parallel_for(0, sizeInc, [&](size_t i) { payloadsAddSorted[i] = payloadsAdd[primIdx[i]]; });
+        }
+
         //auto nodeMgrDevice = nodeMgr->getDeviceHandle();
         // find leaf bin
         int maxBin = -1;
+        startNode = findPacketStarts(ptsAddSorted.data(), sizeInc);
         parlay::parallel_for(0, sizeInc,
             [&](size_t i) {
                 UpdateKernel::findLeafBin(
                     i, sizeInc, ptsAddSorted.data(), primSize(),
-                    nodeMgrDevice, binIdx.data());
+                    nodeMgrDevice, startNode.empty() ? nullptr : startNode.data(), binIdx.data());
             });
+        if (!startNode.empty()) bufferPool->release(std::move(startNode));
         maxBin = parlay::reduce(binIdx, parlay::maximum<int>());
 
         // reset primIdx
@@ -263,7 +306,7 @@ namespace pmkd {
             if (gi >= ptNum) return mortonSorted[gi - ptNum].code;
 
             int iBatch, _offset;
-            transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+            transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
             return nodeMgrDevice.leavesBatch[iBatch].morton[_offset].code;
             };
 
@@ -286,17 +329,24 @@ namespace pmkd {
         // note: can be async
         Leaves leaves;
         leaves.resizePartial(batchLeafSize);
+        leaves.allocUpdateState();
         leaves.treeLocalRangeR.resize(batchLeafSize);
         leaves.derivedFrom.resize(batchLeafSize);
 
 
         Interiors interiors;
         interiors.resize(batchLeafSize - 1);
+        interiors.allocUpdateState();
 
         auto mapidx = bufferPool->acquire<int>(batchLeafSize - 1);
         auto metrics = bufferPool->acquire<uint8_t>(batchLeafSize - 1);
+#ifdef COMPACT_INTERIORS
+        auto split = bufferPool->acquire<int>(batchLeafSize - 1);
+        interiors.boundary = globalBoundary;
+#else
         auto splitDim = bufferPool->acquire<int>(batchLeafSize - 1);
         auto splitVal = bufferPool->acquire<mfloat>(batchLeafSize - 1);
+#endif
         auto parent = bufferPool->acquire<int>(batchLeafSize - 1);
 
         // build aid
@@ -342,7 +392,7 @@ namespace pmkd {
                 if (gi >= ptNum) ptsAddFinal[i] = ptsAddSorted[gi - ptNum];
                 else {
                     int iBatch, _offset;
-                    transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+                    transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
                     ptsAddFinal[i] = nodeMgrDevice.ptsBatch[iBatch][_offset];
                 }
             }
@@ -354,7 +404,7 @@ namespace pmkd {
                 if (gi >= ptNum) leaves.morton[i] = mortonSorted[gi - ptNum];
                 else {
                     int iBatch, _offset;
-                    transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+                    transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
                     leaves.morton[i] = nodeMgrDevice.leavesBatch[iBatch].morton[_offset];
                     // set removal
                     int r = nodeMgrDevice.leavesBatch[iBatch].replacedBy[_offset];
@@ -364,6 +414,7 @@ namespace pmkd {
         );
 
         bufferPool->release<vec3f>(std::move(ptsAddSorted));
+        auto payloadsFinal = gatherPayloads(finalPrimIdx.data(), batchLeafSize, ptNum, payloadsAddSorted);
         // note: leaf hash calculation can be boost
         // by recording leafBinIdx2finalPrimIdx and copying hash
         // to avoid some costly hash calculation
@@ -394,7 +445,7 @@ namespace pmkd {
         parlay::parallel_for(0, interiorToLeafIdx.size(), [&](size_t i) {
             DynamicBuildKernel::calcBuildMetrics(i, interiorToLeafIdx.size(), globalBoundary,
             leaves.morton.data(), interiorToLeafIdx.data(),
-            metrics.data(), interiors.splitDim.data(), interiors.splitVal.data());
+            metrics.data(), interiors.getRawRepr());
             });
 
         //---------------------------------------------------------------------
@@ -435,24 +486,41 @@ namespace pmkd {
         auto& rangeR = leafBuf;
         rangeR.resize(batchLeafSize - 1);
 
+        InteriorsRawRepr reordered{};
+        reordered.rangeL = rangeL.data();
+        reordered.rangeR = rangeR.data();
+        reordered.parent = parent.data();
+#ifdef COMPACT_INTERIORS
+        reordered.split = split.data();
+#else
+        reordered.splitDim = splitDim.data();
+        reordered.splitVal = splitVal.data();
+#endif
+
         parlay::parallel_for(0, batchLeafSize - 1,
             [&](size_t i) {
                 DynamicBuildKernel::reorderInteriors(
-                    i, batchLeafSize - 1, mapidx.data(), interiors.getRawRepr(),
-                    rangeL.data(), rangeR.data(),
-                    splitDim.data(), splitVal.data(), parent.data());
+                    i, batchLeafSize - 1, mapidx.data(), interiors.getRawRepr(), reordered);
             }
         );
         bufferPool->release<int>(std::move(interiors.rangeL));
         bufferPool->release<int>(std::move(interiors.rangeR));
+#ifdef COMPACT_INTERIORS
+        bufferPool->release<int>(std::move(interiors.split));
+#else
         bufferPool->release<int>(std::move(interiors.splitDim));
         bufferPool->release<mfloat>(std::move(interiors.splitVal));
+#endif
         bufferPool->release<int>(std::move(interiors.parent));
 
         interiors.rangeL = std::move(rangeL);
         interiors.rangeR = std::move(rangeR);
+#ifdef COMPACT_INTERIORS
+        interiors.split = std::move(split);
+#else
         interiors.splitDim = std::move(splitDim);
         interiors.splitVal = std::move(splitVal);
+#endif
         interiors.parent = std::move(parent);
 
         parlay::parallel_for(0, batchLeafSize,
@@ -468,7 +536,7 @@ namespace pmkd {
         parlay::parallel_for(0, nInsertBin, [&](size_t i) {
             int gi = leafIdxLeafSorted[i];
             int iBatch, _offset;
-            transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+            transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
             auto& binLeaves = nodeMgrDevice.leavesBatch[iBatch];
             const auto& binInteriors = nodeMgrDevice.interiorsBatch[iBatch];
 
@@ -478,11 +546,14 @@ namespace pmkd {
             interiors.parent[interiorCount[i]] = -parentCode;
             });
 
+        calcLiveCount(leaves, interiors, sizeInc);
+
 #ifdef ENABLE_MERKLE
         // calculate node hash
-        parlay::parallel_for(0, batchLeafSize,
+        size_t nLeafGroups = (batchLeafSize + DIGEST_LANES - 1) / DIGEST_LANES;
+        parlay::parallel_for(0, nLeafGroups,
             [&](size_t i) {
-                BuildKernel::calcLeafHash(i, batchLeafSize, ptsAddFinal.data(), leaves.replacedBy.data(), leaves.hash.data());
+                BuildKernel::calcLeafHashGroup(i, batchLeafSize, ptsAddFinal.data(), leaves.replacedBy.data(), leaves.hash.data());
             }
         );
         parlay::parallel_for(0, batchLeafSize,
@@ -495,7 +566,8 @@ namespace pmkd {
         // revert removal of bins to insert
         parlay::parallel_for(0, nInsertBin,
             [&](size_t i) {
-                UpdateKernel::revertRemoval(i, nInsertBin, leafIdxLeafSorted.data(), nodeMgrDevice);
+                UpdateKernel::revertRemoval(i, nInsertBin, leafIdxLeafSorted.data(),
+                    interiorCount.data(), sizeInc, nodeMgrDevice);
             }
         );
 
@@ -534,6 +606,10 @@ namespace pmkd {
 #endif
         bufferPool->release<int>(std::move(interiorCount));
 
-        nodeMgr->append(std::move(leaves), std::move(interiors), std::move(ptsAddFinal));
+        nodeMgr->append(std::move(leaves), std::move(interiors), std::move(ptsAddFinal), std::move(payloadsFinal));
+        nTotalRemoved += nRemove;
+        nTotalDInserted += sizeInc;
+        mergeLevels();
+        if (rebuild) compactAsync();
     }
 }
\ No newline at end of file
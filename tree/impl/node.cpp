@@ -1,8 +1,11 @@
 #include <exception>
+#include <parlay/parallel.h>
 #include <tree/node.h>
+#include <tree/device_helper.h>
 
 namespace pmkd {
-    void NodeMgr::append(Leaves&& leaves, Interiors&& interiors, vector<vec3f>&& pts, bool syncDevice) {
+    void NodeMgr::append(Leaves&& leaves, Interiors&& interiors, vector<vec3f>&& pts, vector<Payload>&& payload,
+        bool syncDevice) {
         if (interiors.size() == 0) return;
 
         size_t nb = numBatches();
@@ -16,12 +19,82 @@ namespace pmkd {
         }
 
         sizesAcc.push_back(acc);
+        // chunks starting past the previous batches all start in the new one
+        chunkBatch.resize(((acc - 1) >> LEAF_CHUNK_BITS) + 1, nb);
+        if (syncDevice) dChunkBatch = chunkBatch;
         leavesBatch.emplace_back(std::move(leaves));
         interiorsBatch.emplace_back(std::move(interiors));
         ptsBatch.emplace_back(std::move(pts));
+        if (!payload.empty() || hasPayload()) setPayload(nb, std::move(payload));
+    }
+
+    void NodeMgr::truncate(size_t numKept) {
+        if (numKept >= numBatches()) return;
+        if (numKept == 0) {
+            clear();
+            return;
+        }
+
+        leavesBatch.erase(leavesBatch.begin() + numKept, leavesBatch.end());
+        interiorsBatch.erase(interiorsBatch.begin() + numKept, interiorsBatch.end());
+        ptsBatch.erase(ptsBatch.begin() + numKept, ptsBatch.end());
+        sizesAcc.resize(numKept);
+        chunkBatch.resize(((sizesAcc.back() - 1) >> LEAF_CHUNK_BITS) + 1);
+        if (hasPayload()) payloadBatch.resize(numKept);
+
+        if (dLeavesBatch.size() > numKept) {
+            dLeavesBatch.resize(numKept);
+            dInteriorsBatch.resize(numKept);
+            dPtsBatch.resize(numKept);
+            dSizesAcc.resize(numKept);
+            dChunkBatch = chunkBatch;
+        }
+    }
+
+    void NodeMgr::setPayload(size_t batchIdx, vector<Payload>&& payload) {
+        if (payload.empty() && !hasPayload()) return;
+
+        payloadBatch.resize(numBatches());
+        for (size_t i = 0; i < numBatches(); i++) {
+            payloadBatch[i].resize(ptsBatch[i].size());
+        }
+        payload.resize(ptsBatch[batchIdx].size());
+        payloadBatch[batchIdx] = std::move(payload);
+    }
+
+    Payload NodeMgr::getPayload(int globalPointIdx) const {
+        if (!hasPayload()) return Payload{};
+        // see transformPointIdx
+        int mainPoints = ptsBatch[0].size();
+        if (globalPointIdx < mainPoints) return payloadBatch[0][globalPointIdx];
+        int iBatch, offset;
+        transformLeafIdx(globalPointIdx - mainPoints + leavesBatch[0].size(), const_cast<int*>(sizesAcc.data()), numBatches(),
+            iBatch, offset);
+        return payloadBatch[iBatch][offset];
+    }
+
+    vector<const Payload*> NodeMgr::getPayloadPtrs() const {
+        vector<const Payload*> ptrs;
+        ptrs.reserve(payloadBatch.size());
+        for (const auto& batch : payloadBatch) {
+            ptrs.push_back(batch.data());
+        }
+        return ptrs;
+    }
+
+    vector<Payload> NodeMgr::flattenPayloads() const {
+        if (!hasPayload()) return vector<Payload>(numPoints());
+
+        vector<Payload> payload;
+        payload.reserve(numPoints());
+        for (const auto& batch : payloadBatch) {
+            payload.insert(payload.end(), batch.begin(), batch.end());
+        }
+        return payload;
     }
 
     void NodeMgr::refitBatch(size_t batchIdx) {
+        if (batchIdx == 0) jumpTable.clear();
         const auto& leaves = leavesBatch[batchIdx];
         const auto& interiors = interiorsBatch[batchIdx];
         auto& pts = ptsBatch[batchIdx];
@@ -32,11 +105,24 @@ namespace pmkd {
             sizesAcc[i] += deltaSize;
         }
         dSizesAcc = sizesAcc;
+        updateChunkBatch();
+        dChunkBatch = chunkBatch;
         dLeavesBatch[batchIdx] = leaves.getRawRepr();
         dInteriorsBatch[batchIdx] = interiors.getRawRepr();
         dPtsBatch[batchIdx] = pts.data();
     }
 
+    void NodeMgr::prepareUpdates() {
+        for (size_t i = 0; i < numBatches(); i++) {
+            bool allocated = leavesBatch[i].allocUpdateState();
+            allocated |= interiorsBatch[i].allocUpdateState();
+            if (allocated && i < dLeavesBatch.size()) {
+                dLeavesBatch[i] = leavesBatch[i].getRawRepr();
+                dInteriorsBatch[i] = interiorsBatch[i].getRawRepr();
+            }
+        }
+    }
+
     NodeMgr::HostCopy NodeMgr::copyToHost() const {
         HostCopy nodeMgrH;
         nodeMgrH.interiorsBatch.reserve(numBatches());
@@ -57,9 +143,44 @@ namespace pmkd {
         return nodeMgrH;
     }
 
+    NodeMgr::LeafSnapshot NodeMgr::snapshotLeaves() const {
+        if (!isDeviceSyncronized()) {
+            throw std::runtime_error("Device is not syncronized");
+        }
+        LeafSnapshot snapshot;
+        snapshot.leavesBatch = dLeavesBatch;
+        snapshot.ptsBatch = dPtsBatch;
+        snapshot.sizesAcc = dSizesAcc;
+        snapshot.chunkBatch = dChunkBatch;
+        snapshot.payloadBatch = getPayloadPtrs();
+        snapshot.pointShift = numPoints() - numLeaves();
+
+        // later updates write replacedBy in place
+        snapshot.replacedBy.resize(numBatches());
+        for (size_t b = 0; b < numBatches(); b++) {
+            const auto& src = leavesBatch[b].replacedBy;
+            auto& dst = snapshot.replacedBy[b];
+            dst.resize(src.size());
+            parlay::parallel_for(0, src.size(), [&](size_t i) { dst[i] = src[i]; });
+            snapshot.leavesBatch[b].replacedBy = dst.empty() ? nullptr : dst.data();
+        }
+        return snapshot;
+    }
+
+    NodeMgrDevice NodeMgr::LeafSnapshot::getDeviceHandle() const {
+        NodeMgrDevice dNodeMgr;
+        dNodeMgr.numBatches = leavesBatch.size();
+        dNodeMgr.leavesBatch = const_cast<LeavesRawRepr*>(leavesBatch.data());
+        dNodeMgr.ptsBatch = const_cast<vec3f**>(ptsBatch.data());
+        dNodeMgr.sizesAcc = const_cast<int*>(sizesAcc.data());
+        dNodeMgr.chunkBatch = const_cast<int*>(chunkBatch.data());
+        dNodeMgr.pointShift = pointShift;
+        return dNodeMgr;
+    }
+
     vector<vec3f> NodeMgr::flattenPoints() const {
         vector<vec3f> pts;
-        pts.reserve(numLeaves());
+        pts.reserve(numPoints());
 
         for (const auto& batch : ptsBatch) {
             pts.insert(pts.end(), batch.begin(), batch.end());
@@ -98,6 +219,16 @@ namespace pmkd {
         memcpy(dInteriorsBatch.data(), hInteriorsBatch.data(), sizeof(InteriorsRawRepr) * interiorsBatch.size());
         memcpy(dPtsBatch.data(), hPtsBatch.data(), sizeof(vec3f*) * ptsBatch.size());
         memcpy(dSizesAcc.data(), sizesAcc.data(), sizeof(int) * sizesAcc.size());
+        dChunkBatch = chunkBatch;
+    }
+
+    void NodeMgr::updateChunkBatch() {
+        size_t numChunks = numLeaves() == 0 ? 0 : ((numLeaves() - 1) >> LEAF_CHUNK_BITS) + 1;
+        chunkBatch.resize(numChunks);
+        for (size_t c = 0, b = 0; c < numChunks; c++) {
+            while (int(c << LEAF_CHUNK_BITS) >= sizesAcc[b]) ++b;
+            chunkBatch[c] = b;
+        }
     }
 
     NodeMgrDevice NodeMgr::getDeviceHandle() const {
@@ -110,6 +241,49 @@ namespace pmkd {
         dNodeMgr.interiorsBatch = const_cast<InteriorsRawRepr*>(dInteriorsBatch.data());
         dNodeMgr.ptsBatch = const_cast<vec3f**>(dPtsBatch.data());
         dNodeMgr.sizesAcc = const_cast<int*>(dSizesAcc.data());
+        dNodeMgr.chunkBatch = const_cast<int*>(dChunkBatch.data());
+        dNodeMgr.jumpTable = getJumpTable();
+        dNodeMgr.pointShift = numPoints() - numLeaves();
         return dNodeMgr;
     }
+
+    void NodeMgr::buildJumpTable(const AABB& boundary) {
+        jumpTable.clear();
+        if (numBatches() == 0) return;
+
+        const auto leaves = leavesBatch[0].getRawRepr();
+        const auto interiors = interiorsBatch[0].getRawRepr();
+        int leafSize = sizesAcc[0];
+        constexpr int n = 1 << JUMP_TABLE_BITS;
+
+        jumpTable.resize(n * n * n);
+        jumpBoundary = boundary;
+        parlay::parallel_for(0, n * n * n, [&](size_t c) {
+            int q[3] = { int(c / (n * n)), int(c / n % n), int(c % n) };
+            AABB cell = calcJumpCellBox(boundary, q);
+
+            // sprout while the whole cell is on one side of the split
+            int node = 0;
+            for (int bin = 0; bin < leafSize; bin++) {
+                int L = leaves.segOffset[bin];
+                int R = bin == leafSize - 1 ? L : leaves.segOffset[bin + 1];
+                int interiorIdx;
+                bool onRight = false;
+                for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
+                    int splitDim;
+                    mfloat splitVal;
+                    getSplit(interiors, interiorIdx, splitDim, splitVal);
+                    onRight = cell.ptMin[splitDim] >= splitVal;
+                    if (onRight || cell.ptMax[splitDim] > splitVal) break;
+                }
+                if (!onRight) {
+                    // stop at the interior whose split cuts the cell, or at the leaf
+                    node = interiorIdx < R ? interiorIdx : ~bin;
+                    break;
+                }
+                bin = interiorIdx < R - 1 ? interiors.rangeR[interiorIdx + 1] : bin;
+            }
+            jumpTable[encodeJumpCell(q)] = node;
+            });
+    }
 }
\ No newline at end of file
@@ -23,6 +23,7 @@ namespace pmkd {
 
 		nodeMgr = std::make_unique<NodeMgr>();
 		bufferPool = std::make_unique<BufferPool>();
+		if (config.indexPoints) pointIndex = std::make_unique<PointIndex>(1024);
 		// set config
 		globalBoundary = config.globalBoundary;
 	}
@@ -30,14 +31,24 @@ namespace pmkd {
 	PMKDTree::~PMKDTree() { destroy(); }
 
 	void PMKDTree::destroy() {
+		// a pending compaction is outdated once the tree is cleared
+		if (pendingTree) {
+			pendingBuild.wait();
+			pendingTree.reset();
+			pendingUpdates.clear();
+		}
 		// release stored points
 		// release leaves and interiors
 		nodeMgr->clear();
+		if (pointIndex) pointIndex->clear();
 		//sceneBoundary.reset();
 		globalBoundary = config.globalBoundary;
 		isStatic = false;
 		nTotalDInserted = 0;
 		nTotalRemoved = 0;
+#ifdef ENABLE_MERKLE
+		dirtyLeaves.clear();
+#endif
 	}
 
 	void PMKDTree::sortPts(const vector<vec3f>& pts, vector<vec3f>& ptsSorted) const {
@@ -97,21 +108,30 @@ namespace pmkd {
 		parlay::parallel_for(0, nPts, [&](size_t i) {ptsSorted[i] = pts[primIdx[i]]; });
 	}
 
-	void PMKDTree::buildStatic(const vector<vec3f>& pts) {
+	vector<int> PMKDTree::findPacketStarts(const vec3f* pts, size_t n) const {
+		if (!config.packetTraversal || n == 0 || nodeMgr->numBatches() == 0) return {};
+
+		const auto& leaves = nodeMgr->getLeaves(0);
+		const auto& interiors = nodeMgr->getInteriors(0);
+		auto startNode = bufferPool->acquire<int>(n);
+		size_t nPackets = (n + PACKET_SIZE - 1) / PACKET_SIZE;
+		parlay::parallel_for(0, nPackets, [&](size_t i) {
+			SearchKernel::findPacketStarts(i, n, pts, leaves.size(), interiors.getRawRepr(), leaves.getRawRepr(),
+				nodeMgr->getJumpTable(), startNode.data());
+			});
+		return startNode;
+	}
+
+	void PMKDTree::buildStatic(const vector<vec3f>& pts, const vector<Payload>& payloads) {
 		size_t ptNum = pts.size();
 
 		// note: can be async
 		vector<vec3f> ptsSorted(ptNum);
-		// init leaves
+		// init leaves, the rest is allocated once the buckets are cut
 		Leaves leaves;
-		leaves.resizePartial(ptNum);  // note: can be async
+		leaves.morton.resize(ptNum);  // note: can be async
 		//leaves.segOffset.resize(ptNum);
 
-		// init interiors
-		Interiors interiors;
-		// note: allocation of interiors can be async
-		interiors.resize(ptNum - 1);
-
 		// get scene boundary
 		//sceneBoundary = reduce<AABB>(pts, MergeOp());
 		//globalBoundary.merge(sceneBoundary);
@@ -122,20 +142,77 @@ namespace pmkd {
 		sortPts(pts, ptsSorted, primIdx, _morton);
 		parlay::parallel_for(0, ptNum, [&](size_t i) {leaves.morton[i] = _morton[primIdx[i]];});
 
+		vector<Payload> payloadsSorted;
+		if (!payloads.empty()) {
+			payloadsSorted.resize(ptNum);
+			parlay::parallel_for(0, ptNum, [&](size_t i) {payloadsSorted[i] = payloads[primIdx[i]];});
+		}
+
 		bufferPool->release(std::move(primIdx));
 		bufferPool->release(std::move(_morton));
 
-#ifdef ENABLE_MERKLE
-		// calc leaf hash
-		parlay::parallel_for(0, ptNum,
-			[&](size_t i) {
-				BuildKernel::calcLeafHash(i, ptNum, ptsSorted.data(), leaves.replacedBy.data(), leaves.hash.data());
-			}
-		);
-#endif
+		prepareLeaves(leaves, ptsSorted);
+
+		// init interiors
+		Interiors interiors;
+		// note: allocation of interiors can be async
+		interiors.resize(leaves.size() - 1);
 
 		buildStatic_LeavesReady(leaves, interiors);
-		nodeMgr->append(std::move(leaves), std::move(interiors), std::move(ptsSorted));
+		nodeMgr->append(std::move(leaves), std::move(interiors), std::move(ptsSorted), std::move(payloadsSorted));
+		nodeMgr->buildJumpTable(globalBoundary);
+	}
+
+	void PMKDTree::prepareLeaves(Leaves& leaves, const vector<vec3f>& pts) const {
+		size_t ptNum = pts.size();
+		int bucketSize = std::min(config.bucketSize, MAX_BUCKET_SIZE);
+		if (bucketSize > 1 && ptNum > size_t(bucketSize)) {
+			// cut along the radix tree of the points, so that each bucket is one of its subtrees
+			auto metrics = bufferPool->acquire<uint8_t>(ptNum - 1);
+			auto isBound = bufferPool->acquire<uint8_t>(ptNum - 1);
+			parlay::parallel_for(0, ptNum - 1, [&](size_t i) {
+				metrics[i] = MortonType::calcMetric(leaves.morton[i], leaves.morton[i + 1]);
+				});
+			parlay::parallel_for(0, ptNum - 1, [&](size_t i) {
+				BucketKernel::markBucketBounds(i, ptNum - 1, metrics.data(), bucketSize, isBound.data());
+				});
+			auto bounds = parlay::pack_index<int>(isBound);
+			bufferPool->release(std::move(metrics));
+			bufferPool->release(std::move(isBound));
+
+			size_t nb = bounds.size() + 1;
+			auto& bucketOffset = leaves.bucketOffset;
+			bucketOffset.resize(nb + 1);
+			bucketOffset[0] = 0;
+			bucketOffset[nb] = ptNum;
+			parlay::parallel_for(0, nb - 1, [&](size_t i) { bucketOffset[i + 1] = bounds[i] + 1; });
+
+			// a bucket splits from its neighbors where its first point does
+			vector<MortonType> morton(nb);
+			parlay::parallel_for(0, nb, [&](size_t i) { morton[i] = leaves.morton[bucketOffset[i]]; });
+			leaves.morton = std::move(morton);
+		}
+		size_t leafSize = leaves.morton.size();
+		leaves.resizePartial(leafSize);
+
+#ifdef ENABLE_MERKLE
+		if (leaves.bucketOffset.empty()) {
+			// calc leaf hash, DIGEST_LANES leaves at a time
+			size_t nGroups = (leafSize + DIGEST_LANES - 1) / DIGEST_LANES;
+			parlay::parallel_for(0, nGroups,
+				[&](size_t i) {
+					BuildKernel::calcLeafHashGroup(i, leafSize, pts.data(), nullptr, leaves.hash.data());
+				}
+			);
+		}
+		else {
+			parlay::parallel_for(0, leafSize,
+				[&](size_t i) {
+					BucketKernel::calcBucketHash(i, leafSize, pts.data(), leaves.bucketOffset.data(), leaves.hash.data());
+				}
+			);
+		}
+#endif
 	}
 
 	void PMKDTree::buildStatic_LeavesReady(Leaves& leaves, Interiors& interiors) {
@@ -144,8 +221,13 @@ namespace pmkd {
 
 		auto metrics = bufferPool->acquire<uint8_t>(ptNum - 1);
 		auto mapidx = bufferPool->acquire<int>(ptNum - 1);
+#ifdef COMPACT_INTERIORS
+		auto split = bufferPool->acquire<int>(ptNum - 1);
+		interiors.boundary = globalBoundary;
+#else
 		auto splitDim = bufferPool->acquire<int>(ptNum - 1);
 		auto splitVal = bufferPool->acquire<mfloat>(ptNum - 1);
+#endif
 		auto parent = bufferPool->acquire<int>(ptNum - 1);
 
 		// build aid
@@ -158,7 +240,7 @@ namespace pmkd {
 			[&](size_t i) {
 				BuildKernel::calcBuildMetrics(
 					i, ptNum - 1, globalBoundary, leaves.morton.data(), metrics.data(),
-					interiors.splitDim.data(), interiors.splitVal.data());
+					interiors.getRawRepr());
 			}
 		);
 
@@ -206,25 +288,42 @@ namespace pmkd {
 		auto& rangeR = leafBuf;
 		rangeR.resize(ptNum - 1);
 
+		InteriorsRawRepr reordered{};
+		reordered.rangeL = rangeL.data();
+		reordered.rangeR = rangeR.data();
+		reordered.parent = parent.data();
+#ifdef COMPACT_INTERIORS
+		reordered.split = split.data();
+#else
+		reordered.splitDim = splitDim.data();
+		reordered.splitVal = splitVal.data();
+#endif
+
 		parlay::parallel_for(0, ptNum - 1,
 			[&](size_t i) {
 				BuildKernel::reorderInteriors(
-					i, ptNum - 1, mapidx.data(), interiors.getRawRepr(),
-					rangeL.data(), rangeR.data(),
-					splitDim.data(), splitVal.data(), parent.data());
+					i, ptNum - 1, mapidx.data(), interiors.getRawRepr(), reordered);
 			}
 		);
 
 		bufferPool->release<int>(std::move(interiors.rangeL));
 		bufferPool->release<int>(std::move(interiors.rangeR));
+#ifdef COMPACT_INTERIORS
+		bufferPool->release<int>(std::move(interiors.split));
+#else
 		bufferPool->release<int>(std::move(interiors.splitDim));
 		bufferPool->release<mfloat>(std::move(interiors.splitVal));
+#endif
 		bufferPool->release<int>(std::move(interiors.parent));
 
 		interiors.rangeL = std::move(rangeL);
 		interiors.rangeR = std::move(rangeR);
+#ifdef COMPACT_INTERIORS
+		interiors.split = std::move(split);
+#else
 		interiors.splitDim = std::move(splitDim);
 		interiors.splitVal = std::move(splitVal);
+#endif
 		interiors.parent = std::move(parent);
 
 
@@ -236,18 +335,45 @@ namespace pmkd {
 		);
 
 		bufferPool->release<int>(std::move(mapidx));
+
+		calcLiveCount(leaves, interiors, ptNum - 1);
 #ifdef ENABLE_MERKLE
-		// calc node hash
+		// calc node hash level by level from the bottom, so that nodes of a level are hashed DIGEST_LANES at a time
+		auto height = bufferPool->acquire<int>(ptNum - 1, 0);
 		parlay::parallel_for(0, ptNum,
 			[&](size_t i) {
-				BuildKernel::calcInteriorHash(i, ptNum, leaves.getRawRepr(),
-				interiors.getRawRepr(), visitCount.data());
+				BuildKernel::calcInteriorHeight(i, ptNum, leaves.getRawRepr(),
+				interiors.getRawRepr(), visitCount.data(), height.data());
 			}
 		);
+
+		auto order = bufferPool->acquire<int>(ptNum - 1);
+		parlay::parallel_for(0, ptNum - 1, [&](size_t i) { order[i] = i; });
+		parlay::integer_sort_inplace(order, [&](const auto& idx) { return static_cast<uint32_t>(height[idx]); });
+
+		auto isLevelStart = bufferPool->acquire<uint8_t>(ptNum - 1);
+		parlay::parallel_for(0, ptNum - 1,
+			[&](size_t i) { isLevelStart[i] = i == 0 || height[order[i]] != height[order[i - 1]]; });
+		auto levelStart = parlay::pack_index<int>(isLevelStart);
+		bufferPool->release<uint8_t>(std::move(isLevelStart));
+		bufferPool->release<int>(std::move(height));
+
+		for (size_t l = 0; l < levelStart.size(); l++) {
+			int levelSize = (l + 1 < levelStart.size() ? levelStart[l + 1] : ptNum - 1) - levelStart[l];
+			const int* nodes = order.data() + levelStart[l];
+			parlay::parallel_for(0, (levelSize + DIGEST_LANES - 1) / DIGEST_LANES,
+				[&](size_t i) {
+					BuildKernel::calcInteriorHashGroup(i, levelSize, nodes, ptNum,
+					leaves.getRawRepr(), interiors.getRawRepr());
+				}
+			);
+		}
+		bufferPool->release<int>(std::move(order));
 #endif
 	}
 
-	void PMKDTree::buildIncrement(const vector<vec3f>& ptsAdd) {
+	void PMKDTree::buildIncrement(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads) {
+		nodeMgr->prepareUpdates();
 		size_t ptNum = primSize();
 		size_t sizeInc = ptsAdd.size();
 		// note: memory allocation can be async
@@ -268,22 +394,30 @@ namespace pmkd {
 		);
 		bufferPool->release<MortonType>(std::move(morton));
 
+		vector<Payload> payloadsAddSorted;
+		if (!payloads.empty()) {
+			payloadsAddSorted.resize(sizeInc);
+			parlay::parallel_for(0, sizeInc, [&](size_t i) { payloadsAddSorted[i] = payloads[primIdx[i]]; });
+		}
+
 		auto nodeMgrDevice = nodeMgr->getDeviceHandle();
 		// find leaf bin
 		int maxBin = -1;
+		auto startNode = findPacketStarts(ptsAddSorted.data(), sizeInc);
 		parlay::parallel_for(0, sizeInc,
 			[&](size_t i) {
 				UpdateKernel::findLeafBin(
 					i, sizeInc, ptsAddSorted.data(), primSize(),
-					nodeMgrDevice, binIdx.data());
+					nodeMgrDevice, startNode.empty() ? nullptr : startNode.data(), binIdx.data());
 			});
+		if (!startNode.empty()) bufferPool->release(std::move(startNode));
 		maxBin = parlay::reduce(binIdx, parlay::maximum<int>());
 
 		auto getMortonCode = [&](int gi) {
 			if (gi >= ptNum) return mortonSorted[gi - ptNum].code;
 
 			int iBatch, _offset;
-			transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+			transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
 			return nodeMgrDevice.leavesBatch[iBatch].morton[_offset].code;
 			};
 
@@ -303,6 +437,7 @@ namespace pmkd {
 		// note: can be async
 		Leaves leaves;
 		leaves.resizePartial(batchLeafSize);
+		leaves.allocUpdateState();
 		leaves.treeLocalRangeR.resize(batchLeafSize);
 		leaves.derivedFrom.resize(batchLeafSize);
 
@@ -330,11 +465,17 @@ namespace pmkd {
 
 		Interiors interiors;
 		interiors.resize(batchLeafSize - 1);
+		interiors.allocUpdateState();
 
 		auto mapidx = bufferPool->acquire<int>(batchLeafSize - 1);
 		auto metrics = bufferPool->acquire<uint8_t>(batchLeafSize - 1);
+#ifdef COMPACT_INTERIORS
+		auto split = bufferPool->acquire<int>(batchLeafSize - 1);
+		interiors.boundary = globalBoundary;
+#else
 		auto splitDim = bufferPool->acquire<int>(batchLeafSize - 1);
 		auto splitVal = bufferPool->acquire<mfloat>(batchLeafSize - 1);
+#endif
 		auto parent = bufferPool->acquire<int>(batchLeafSize - 1);
 
 		// build aid
@@ -382,8 +523,9 @@ namespace pmkd {
 				if (gi >= ptNum) ptsAddFinal[i] = ptsAddSorted[gi - ptNum];
 				else {
 					int iBatch, _offset;
-					transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
-					ptsAddFinal[i] = nodeMgrDevice.ptsBatch[iBatch][_offset];
+					transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
+					// a bucket being split keeps its first point here, see splitBuckets
+					ptsAddFinal[i] = nodeMgrDevice.ptsBatch[iBatch][bucketBegin(nodeMgrDevice.leavesBatch[iBatch], _offset)];
 				}
 			}
 		);
@@ -394,7 +536,7 @@ namespace pmkd {
 				if (gi >= ptNum) leaves.morton[i] = mortonSorted[gi - ptNum];
 				else {
 					int iBatch, _offset;
-					transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+					transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
 					leaves.morton[i] = nodeMgrDevice.leavesBatch[iBatch].morton[_offset];
 					// set removal
 					int r = nodeMgrDevice.leavesBatch[iBatch].replacedBy[_offset];
@@ -430,7 +572,7 @@ namespace pmkd {
 		// 		int gi = finalPrimIdx[idx];
 
 		// 		int iBatch, _offset;
-		// 		transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+		// 		transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
 		// 		leaves.morton[idx] = nodeMgrDevice.leavesBatch[iBatch].morton[_offset];
 		// 		ptsAddFinal[idx] = nodeMgrDevice.ptsBatch[iBatch][_offset];
 		// 		// set removal
@@ -443,6 +585,7 @@ namespace pmkd {
 		// });
 
 		bufferPool->release<vec3f>(std::move(ptsAddSorted));
+		auto payloadsFinal = gatherPayloads(finalPrimIdx.data(), batchLeafSize, ptNum, payloadsAddSorted);
 		// note: leaf hash calculation can be boost
 		// by recording leafBinIdx2finalPrimIdx and copying hash
 		// to avoid some costly hash calculation
@@ -473,7 +616,7 @@ namespace pmkd {
 		parlay::parallel_for(0, interiorToLeafIdx.size(), [&](size_t i) {
 			DynamicBuildKernel::calcBuildMetrics(i, interiorToLeafIdx.size(), globalBoundary,
 			leaves.morton.data(), interiorToLeafIdx.data(),
-			metrics.data(), interiors.splitDim.data(), interiors.splitVal.data());
+			metrics.data(), interiors.getRawRepr());
 			});
 
 		//---------------------------------------------------------------------
@@ -530,24 +673,41 @@ namespace pmkd {
 		auto& rangeR = leafBuf;
 		rangeR.resize(batchLeafSize - 1);
 
+		InteriorsRawRepr reordered{};
+		reordered.rangeL = rangeL.data();
+		reordered.rangeR = rangeR.data();
+		reordered.parent = parent.data();
+#ifdef COMPACT_INTERIORS
+		reordered.split = split.data();
+#else
+		reordered.splitDim = splitDim.data();
+		reordered.splitVal = splitVal.data();
+#endif
+
 		parlay::parallel_for(0, batchLeafSize - 1,
 			[&](size_t i) {
 				DynamicBuildKernel::reorderInteriors(
-					i, batchLeafSize - 1, mapidx.data(), interiors.getRawRepr(),
-					rangeL.data(), rangeR.data(),
-					splitDim.data(), splitVal.data(), parent.data());
+					i, batchLeafSize - 1, mapidx.data(), interiors.getRawRepr(), reordered);
 			}
 		);
 		bufferPool->release<int>(std::move(interiors.rangeL));
 		bufferPool->release<int>(std::move(interiors.rangeR));
+#ifdef COMPACT_INTERIORS
+		bufferPool->release<int>(std::move(interiors.split));
+#else
 		bufferPool->release<int>(std::move(interiors.splitDim));
 		bufferPool->release<mfloat>(std::move(interiors.splitVal));
+#endif
 		bufferPool->release<int>(std::move(interiors.parent));
 
 		interiors.rangeL = std::move(rangeL);
 		interiors.rangeR = std::move(rangeR);
+#ifdef COMPACT_INTERIORS
+		interiors.split = std::move(split);
+#else
 		interiors.splitDim = std::move(splitDim);
 		interiors.splitVal = std::move(splitVal);
+#endif
 		interiors.parent = std::move(parent);
 
 		parlay::parallel_for(0, batchLeafSize,
@@ -563,7 +723,7 @@ namespace pmkd {
 		parlay::parallel_for(0, leafIdxLeafSorted.size(), [&](size_t i) {
 			int gi = leafIdxLeafSorted[i];
 			int iBatch, _offset;
-			transformLeafIdx(gi, nodeMgrDevice.sizesAcc, nodeMgrDevice.numBatches, iBatch, _offset);
+			transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
 			auto& binLeaves = nodeMgrDevice.leavesBatch[iBatch];
 			const auto& binInteriors = nodeMgrDevice.interiorsBatch[iBatch];
 
@@ -573,44 +733,169 @@ namespace pmkd {
 			interiors.parent[interiorCount[i]] = -parentCode;
 			});
 
+		calcLiveCount(leaves, interiors, sizeInc);
+
 #ifdef ENABLE_MERKLE
-		// calculate node hash
-		parlay::parallel_for(0, batchLeafSize,
-			[&](size_t i) {
-				BuildKernel::calcLeafHash(i, batchLeafSize, ptsAddFinal.data(), leaves.replacedBy.data(), leaves.hash.data());
-			}
-		);
-		parlay::parallel_for(0, batchLeafSize,
-			[&](size_t i) {
-				DynamicBuildKernel::calcInteriorHash_Batch(i, batchLeafSize,
-				leaves.getRawRepr(), interiors.getRawRepr());
-			}
-		);
+		if (config.lazyMerkle) {
+			// the whole batch is hashed by refreshMerkle(), its leaves follow the ptNum stored ones
+			size_t nDirty = dirtyLeaves.size();
+			dirtyLeaves.resize(nDirty + batchLeafSize);
+			parlay::parallel_for(0, batchLeafSize, [&](size_t i) { dirtyLeaves[nDirty + i] = ptNum + i; });
+		}
+		else {
+			// calculate node hash
+			size_t nLeafGroups = (batchLeafSize + DIGEST_LANES - 1) / DIGEST_LANES;
+			parlay::parallel_for(0, nLeafGroups,
+				[&](size_t i) {
+					BuildKernel::calcLeafHashGroup(i, batchLeafSize, ptsAddFinal.data(), leaves.replacedBy.data(), leaves.hash.data());
+				}
+			);
+			parlay::parallel_for(0, batchLeafSize,
+				[&](size_t i) {
+					DynamicBuildKernel::calcInteriorHash_Batch(i, batchLeafSize,
+					leaves.getRawRepr(), interiors.getRawRepr());
+				}
+			);
+		}
 #endif
 		// revert removal of bins to insert
 		parlay::parallel_for(0, leafIdxLeafSorted.size(),
 			[&](size_t i) {
-				UpdateKernel::revertRemoval(i, leafIdxLeafSorted.size(), leafIdxLeafSorted.data(), nodeMgrDevice);
+				UpdateKernel::revertRemoval(i, leafIdxLeafSorted.size(), leafIdxLeafSorted.data(),
+				interiorCount.data(), sizeInc, nodeMgrDevice);
 			}
 		);
 #ifdef ENABLE_MERKLE
 		// calculate node hash
-		parlay::parallel_for(0, interiorCount.size(),
-			[&](size_t i) {
-				DynamicBuildKernel::calcInteriorHash_Upper(i, interiorCount.size(), interiorCount.data(), leafIdxLeafSorted.data(),
-				interiors.getRawRepr(), nodeMgrDevice);
-			}
-		);
+		if (!config.lazyMerkle) {
+			parlay::parallel_for(0, interiorCount.size(),
+				[&](size_t i) {
+					DynamicBuildKernel::calcInteriorHash_Upper(i, interiorCount.size(), interiorCount.data(), leafIdxLeafSorted.data(),
+					interiors.getRawRepr(), nodeMgrDevice);
+				}
+			);
+		}
 		// auto rootHash = getRootHash();
 		// printf("root hash: %d,%d,%d\n", int(rootHash.byte[0]), int(rootHash.byte[1]), int(rootHash.byte[2]));
 		// printf("\n");
 #endif
 		bufferPool->release<int>(std::move(interiorCount));
 
-		nodeMgr->append(std::move(leaves), std::move(interiors), std::move(ptsAddFinal));
+		nodeMgr->append(std::move(leaves), std::move(interiors), std::move(ptsAddFinal), std::move(payloadsFinal));
+	}
+
+	void PMKDTree::splitBuckets(const vector<vec3f>& pts, const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd) {
+		parlay::sequence<int> buckets;
+		if (nodeMgr->isBucketed()) {
+			nodeMgr->prepareUpdates();
+			const auto leaves = nodeMgr->getLeaves(0).getRawRepr();
+			const auto interiors = nodeMgr->getInteriors(0).getRawRepr();
+			int leafSize = nodeMgr->getLeaves(0).size();
+
+			// leaves of the main tree on the paths of pts, this traversal leaves no marks for the Merkle update
+			size_t n = pts.size();
+			auto binIdx = bufferPool->acquire<int>(n);
+			parlay::parallel_for(0, n, [&](size_t i) {
+				UpdateKernel::findLeafBin(i, n, pts.data(), leafSize, interiors, leaves, nodeMgr->getJumpTable(), nullptr,
+					binIdx.data());
+				});
+			buckets = parlay::filter(parlay::remove_duplicate_integers(binIdx, leafSize), [&](int b) {
+				return getReplacedBy(leaves, b) == 0 && bucketEnd(leaves, b) - bucketBegin(leaves, b) > 1;
+				});
+			bufferPool->release(std::move(binIdx));
+		}
+		if (buckets.empty()) {
+			if (!ptsAdd.empty()) buildIncrement(ptsAdd, payloadsAdd);
+			return;
+		}
+
+		const auto leaves = nodeMgr->getLeaves(0).getRawRepr();
+		const auto interiors = nodeMgr->getInteriors(0).getRawRepr();
+		const auto& ptsMain = nodeMgr->getPtsBatch(0);
+		size_t nBuckets = buckets.size();
+		auto [restOffset, nRest] = parlay::scan(parlay::tabulate(nBuckets, [&](size_t i) {
+			return bucketEnd(leaves, buckets[i]) - bucketBegin(leaves, buckets[i]) - 1;
+			}));
+
+		// the rest of each bucket goes with ptsAdd, the live count of its leaf drops to its first point
+		size_t sizeAdd = ptsAdd.size();
+		bool hasPayload = nodeMgr->hasPayload() || !payloadsAdd.empty();
+		vector<vec3f> ptsInsert(sizeAdd + nRest);
+		vector<Payload> payloadsInsert(hasPayload ? sizeAdd + nRest : 0);
+		parlay::parallel_for(0, sizeAdd, [&](size_t i) {
+			ptsInsert[i] = ptsAdd[i];
+			if (!payloadsAdd.empty()) payloadsInsert[i] = payloadsAdd[i];
+			});
+		parlay::parallel_for(0, nBuckets, [&](size_t i) {
+			int b = buckets[i];
+			int first = bucketBegin(leaves, b), rest = bucketEnd(leaves, b) - first - 1;
+			for (int j = 0; j < rest; j++) {
+				ptsInsert[sizeAdd + restOffset[i] + j] = ptsMain[first + 1 + j];
+				if (nodeMgr->hasPayload()) payloadsInsert[sizeAdd + restOffset[i] + j] = nodeMgr->getPayload(first + 1 + j);
+			}
+			propagateLiveCount(b, -rest, leaves, interiors);
+			});
+		buildIncrement(ptsInsert, payloadsInsert);
+		isStatic = false;
+	}
+
+	vector<Payload> PMKDTree::gatherPayloads(const int* primIdx, size_t size, size_t ptNum,
+		const vector<Payload>& payloadsAdd) const {
+		auto nodes = nodeMgr->getDeviceHandle();
+		if (nodes.pointShift == 0 || (payloadsAdd.empty() && !nodeMgr->hasPayload()))
+			return gatherPayloads(nodes, nodeMgr->getPayloadPtrs(), primIdx, size, ptNum, payloadsAdd);
+
+		// a leaf of the main tree carries the payload of its first point
+		auto ptIdx = bufferPool->acquire<int>(size);
+		parlay::parallel_for(0, size, [&](size_t i) {
+			int gi = primIdx[i];
+			ptIdx[i] = gi < nodes.sizesAcc[0] ? bucketBegin(nodes.leavesBatch[0], gi) : gi + nodes.pointShift;
+			});
+		auto payloads = gatherPayloads(nodes, nodeMgr->getPayloadPtrs(), ptIdx.data(), size, ptNum + nodes.pointShift, payloadsAdd);
+		bufferPool->release(std::move(ptIdx));
+		return payloads;
 	}
 
-	void PMKDTree::buildIncrement_v2(const vector<vec3f>& ptsAdd) {
+	vector<Payload> PMKDTree::gatherPayloads(const NodeMgrDevice& nodes, const vector<const Payload*>& payloadBatch,
+		const int* primIdx, size_t size, size_t ptNum, const vector<Payload>& payloadsAdd) const {
+		vector<Payload> payloads;
+		bool hasStored = !payloadBatch.empty();
+		if (payloadsAdd.empty() && !hasStored) return payloads;
+
+		payloads.resize(size);
+		parlay::parallel_for(0, size, [&](size_t i) {
+			int gi = primIdx[i];
+			if (gi >= ptNum) {
+				if (!payloadsAdd.empty()) payloads[i] = payloadsAdd[gi - ptNum];
+			}
+			else if (hasStored) {
+				int iBatch, _offset;
+				transformPointIdx(gi, nodes, iBatch, _offset);
+				payloads[i] = payloadBatch[iBatch][_offset];
+			}
+			});
+		return payloads;
+	}
+
+	void PMKDTree::calcLiveCount(const Leaves& leaves, Interiors& interiors, size_t interiorSize) {
+		size_t leafSize = leaves.size();
+		auto validAcc = bufferPool->acquire<int>(leafSize + 1);
+		parlay::parallel_for(0, leafSize + 1, [&](size_t i) {
+			bool valid = i < leafSize && (leaves.replacedBy.empty() || leaves.replacedBy[i] == 0);
+			validAcc[i] = !valid ? 0 : leaves.bucketOffset.empty() ? 1 : leaves.bucketOffset[i + 1] - leaves.bucketOffset[i];
+			});
+		parlay::scan_inplace(validAcc);
+
+		parlay::parallel_for(0, interiorSize,
+			[&](size_t i) {
+				BuildKernel::calcLiveCount(i, interiorSize, validAcc.data(), interiors.getRawRepr());
+			}
+		);
+		bufferPool->release<int>(std::move(validAcc));
+	}
+
+	void PMKDTree::buildIncrement_v2(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads) {
+		nodeMgr->prepareUpdates();
 		auto& leaves = nodeMgr->getLeaves(0);
 		auto& interiors = nodeMgr->getInteriors(0);
 		auto& pts = nodeMgr->getPtsBatch(0);
@@ -640,8 +925,15 @@ namespace pmkd {
 		sortPts(ptsAdd, ptsAddSorted, primIdxAdd, mortonAdd);
 		parlay::parallel_for(0, sizeInc, [&](size_t i) { mortonAddSorted[i] = mortonAdd[primIdxAdd[i]];});
 
+		vector<Payload> payloadsAddSorted;
+		if (!payloads.empty()) {
+			payloadsAddSorted.resize(sizeInc);
+			parlay::parallel_for(0, sizeInc, [&](size_t i) { payloadsAddSorted[i] = payloads[primIdxAdd[i]]; });
+		}
+
 #ifdef ENABLE_MERKLE
-		parlay::parallel_for(0, sizeInc, [&](size_t i) { BuildKernel::calcLeafHash(i, sizeInc, ptsAddSorted.data(), hashAdd.data());});
+		parlay::parallel_for(0, (sizeInc + DIGEST_LANES - 1) / DIGEST_LANES,
+			[&](size_t i) { BuildKernel::calcLeafHashGroup(i, sizeInc, ptsAddSorted.data(), nullptr, hashAdd.data());});
 #endif
 		bufferPool->release<MortonType>(std::move(mortonAdd));
 
@@ -682,6 +974,7 @@ namespace pmkd {
 			});
 		hashAdd.clear();
 #endif
+		auto payloadsFinal = gatherPayloads(primIdxFinal.data(), ptNum + sizeInc, ptNum, payloadsAddSorted);
 		primIdxFinal.clear();
 
 		leaves.morton = std::move(mortonSortedFinal);
@@ -698,6 +991,8 @@ namespace pmkd {
 
 		buildStatic_LeavesReady(leaves, interiors);
 		nodeMgr->refitBatch(0);
+		nodeMgr->buildJumpTable(globalBoundary);
+		nodeMgr->setPayload(0, std::move(payloadsFinal));
 }
 
 	PMKD_PrintInfo PMKDTree::print(bool verbose) const {
@@ -791,8 +1086,9 @@ namespace pmkd {
 		if (verbose) {
 			// get primIdx
 			info.leafPoints = getStoredPoints();
-			info.splitDim.assign(interiors.splitDim.begin(), interiors.splitDim.end());
-			info.splitVal.assign(interiors.splitVal.begin(), interiors.splitVal.end());
+			info.splitDim.clear();
+			info.splitVal.clear();
+			interiors.appendSplits(info.splitDim, info.splitVal);
 		}
 		return info;
 	}
@@ -963,10 +1259,8 @@ namespace pmkd {
 				info.leafPoints.insert(info.leafPoints.end(), hostNodeMgr.ptsBatch[i].begin(), hostNodeMgr.ptsBatch[i].end());
 
 				const auto& interiors = hostNodeMgr.interiorsBatch[i];
-				info.splitDim.insert(info.splitDim.end(), interiors.splitDim.begin(), interiors.splitDim.end());
+				interiors.appendSplits(info.splitDim, info.splitVal);
 				info.splitDim.push_back(-1);
-
-				info.splitVal.insert(info.splitVal.end(), interiors.splitVal.begin(), interiors.splitVal.end());
 				info.splitVal.push_back(0);
 			}
 		}
@@ -995,6 +1289,39 @@ namespace pmkd {
 		size_t nq = queries.size();
 		QueryResponses responses(nq);
 
+		if (pointIndex) {
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				responses.exist[i] = pointIndex->Find(queries[i]).has_value();
+				});
+			return responses;
+		}
+
+		bool mergeJoin = isStatic && !nodeMgr->isBucketed() && (config.pointQueryEngine == PointQueryEngine::MergeJoin ||
+			(config.pointQueryEngine == PointQueryEngine::Auto && nq >= config.mergeJoinMinQueries));
+		if (mergeJoin) {
+			const auto& leaves = nodeMgr->getLeaves(0);
+			auto queriesSorted = bufferPool->acquire<vec3f>(nq);
+			auto morton = bufferPool->acquire<MortonType>(nq);
+			auto mortonSorted = bufferPool->acquire<MortonType>(nq);
+			auto rank = bufferPool->acquire<int>(nq);
+
+			sortPts(queries, queriesSorted, responses.queryIdx, morton);
+			parlay::parallel_for(0, nq, [&](size_t i) { mortonSorted[i] = morton[responses.queryIdx[i]]; });
+			mergeRank(mortonSorted, leaves.morton, rank.data(),
+				[](const MortonType& a, const MortonType& b) { return a.code < b.code; });
+
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchPointsByRank(i, nq, queriesSorted.data(), mortonSorted.data(), rank.data(),
+					nodeMgr->getPtsBatch(0).data(), primSize(), leaves.getRawRepr(), responses.exist.data());
+				});
+
+			bufferPool->release(std::move(queriesSorted));
+			bufferPool->release(std::move(morton));
+			bufferPool->release(std::move(mortonSorted));
+			bufferPool->release(std::move(rank));
+			return responses;
+		}
+
 		vector<Query> queriesSorted;
 		const Query* target = queries.data();
 		// sort queries to improve cache friendlyness
@@ -1003,27 +1330,46 @@ namespace pmkd {
 			sortPts(queries, queriesSorted, responses.queryIdx);
 			target = queriesSorted.data();
 		}
+		vector<int> startNode;
+		if (config.optimize) startNode = findPacketStarts(target, nq);
+		const int* start = startNode.empty() ? nullptr : startNode.data();
 
 		if (isStatic) {
 			assert(nodeMgr->numBatches() == 1);
 			const auto& leaves = nodeMgr->getLeaves(0);
 			const auto& interiors = nodeMgr->getInteriors(0);
 
-			parlay::parallel_for(0, nq,
-				[&](size_t i) {
-					SearchKernel::searchPoints(
-						i, nq, target, nodeMgr->getPtsBatch(0).data(), primSize(),
-						interiors.getRawRepr(), leaves.getRawRepr(), AABB::worldBox(), responses.exist.data());
-				}
-			);
+			int groupSize = std::min(config.prefetchGroupSize, MAX_PREFETCH_GROUP);
+			if (groupSize > 1) {
+				parlay::parallel_for(0, (nq + groupSize - 1) / groupSize,
+					[&](size_t i) {
+						SearchKernel::searchPointsGroup(
+							i, groupSize, nq, target, nodeMgr->getPtsBatch(0).data(), primSize(),
+							interiors.getRawRepr(), leaves.getRawRepr(), nodeMgr->getJumpTable(), start,
+							responses.exist.data());
+					}
+				);
+			}
+			else {
+				parlay::parallel_for(0, nq,
+					[&](size_t i) {
+						SearchKernel::searchPoints(
+							i, nq, target, nodeMgr->getPtsBatch(0).data(), primSize(),
+							interiors.getRawRepr(), leaves.getRawRepr(), nodeMgr->getJumpTable(), start, AABB::worldBox(),
+							responses.exist.data());
+					}
+				);
+			}
 		}
 		else {
 			parlay::parallel_for(0, nq, [&](size_t i) {
-				SearchKernel::searchPoints(i, nq, target, nodeMgr->getDeviceHandle(), primSize(), AABB::worldBox(), responses.exist.data());
+				SearchKernel::searchPoints(i, nq, target, nodeMgr->getDeviceHandle(), primSize(), start, AABB::worldBox(),
+					responses.exist.data());
 				});
 		}
 
 		if (!queriesSorted.empty()) bufferPool->release(std::move(queriesSorted));
+		if (!startNode.empty()) bufferPool->release(std::move(startNode));
 		return responses;
 	}
 
@@ -1058,6 +1404,115 @@ namespace pmkd {
 			bufferPool->release(std::move(morton));
 		}
 
+		if (isStatic) {
+			assert(nodeMgr->numBatches() == 1);
+			const auto& leaves = nodeMgr->getLeaves(0);
+			const auto& interiors = nodeMgr->getInteriors(0);
+			int leafSize = primSize();
+
+			int maxSpan = -1;  // never scan
+			bool scannable = !nodeMgr->isBucketed();  // the scan reads one point per leaf
+			if (scannable && config.rangeQueryEngine == RangeQueryEngine::MortonScan) maxSpan = leafSize;
+			else if (scannable && config.rangeQueryEngine == RangeQueryEngine::Auto)
+				maxSpan = config.mortonScanSpanFactor * (int)std::log2(std::max(leafSize, 2));
+
+			int groupSize = std::min(config.prefetchGroupSize, MAX_PREFETCH_GROUP);
+			if (maxSpan < 0 && groupSize > 1) {
+				parlay::parallel_for(0, (nq + groupSize - 1) / groupSize,
+					[&](size_t i) {
+						SearchKernel::searchRangesGroup(i, groupSize, nq, target, nodeMgr->getPtsBatch(0).data(), leafSize,
+							interiors.getRawRepr(), leaves.getRawRepr(), responses.getRawRepr());
+					}
+				);
+			}
+			else {
+				parlay::parallel_for(0, nq,
+					[&](size_t i) {
+						if (maxSpan >= 0 && SearchKernel::searchRangesByMorton(
+							i, nq, target, nodeMgr->getPtsBatch(0).data(), leafSize,
+							leaves.getRawRepr(), globalBoundary, maxSpan, responses.getRawRepr()))
+							return;
+						SearchKernel::searchRanges(
+							i, nq, target, nodeMgr->getPtsBatch(0).data(), leafSize,
+							interiors.getRawRepr(), leaves.getRawRepr(),
+							AABB::worldBox(), responses.getRawRepr());
+					}
+				);
+			}
+		}
+		else {
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchRanges(i, nq, target,
+				nodeMgr->getDeviceHandle(), primSize(), AABB::worldBox(),
+				responses.getRawRepr());
+				});
+		}
+	}
+
+	RangeQueryResponses PMKDTree::query(const vector<RangeQuery>& queries) const {
+		if (queries.empty()) return RangeQueryResponses(0);
+
+		RangeQueryResponses responses(queries.size());
+
+		mTimer("Range Search Time", [&] {this->_query(queries, responses);});
+
+		return responses;
+	}
+
+	CompactRangeQueryResponses PMKDTree::compactQuery(const vector<RangeQuery>& queries) const {
+		if (queries.empty()) return CompactRangeQueryResponses(0);
+
+		size_t nq = queries.size();
+		CompactRangeQueryResponses responses(nq);
+		size_t ptNum = primSize();
+		if (ptNum == 0) return responses;
+
+		if (isStatic) {
+			assert(nodeMgr->numBatches() == 1);
+			const auto& leaves = nodeMgr->getLeaves(0);
+			const auto& interiors = nodeMgr->getInteriors(0);
+			const vec3f* pts = nodeMgr->getPtsBatch(0).data();
+
+			// pass 1
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchRangesCompact_step1(
+					i, nq, queries.data(), pts, ptNum,
+					interiors.getRawRepr(), leaves.getRawRepr(), responses.respSize.data());
+				});
+			responses.initBuffer();
+
+			// pass 2
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchRangesCompact_step2(
+					i, nq, queries.data(), pts, ptNum,
+					interiors.getRawRepr(), leaves.getRawRepr(), responses.offset.data(), responses.buffer.data());
+				});
+		}
+		else {
+			NodeMgrDevice nodeMgrDevice = nodeMgr->getDeviceHandle();
+			// pass 1
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchRangesCompact_step1(
+					i, nq, queries.data(), nodeMgrDevice, ptNum, responses.respSize.data());
+				});
+			responses.initBuffer();
+
+			// pass 2
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchRangesCompact_step2(
+					i, nq, queries.data(), nodeMgrDevice, ptNum, responses.offset.data(), responses.buffer.data());
+				});
+		}
+		return responses;
+	}
+
+	RangeIndexQueryResponses PMKDTree::indexQuery(const vector<RangeQuery>& queries) const {
+		if (queries.empty()) return RangeIndexQueryResponses(0);
+
+		size_t nq = queries.size();
+		RangeIndexQueryResponses responses(nq);
+		if (primSize() == 0) return responses;
+
 		if (isStatic) {
 			assert(nodeMgr->numBatches() == 1);
 			const auto& leaves = nodeMgr->getLeaves(0);
@@ -1065,8 +1520,64 @@ namespace pmkd {
 
 			parlay::parallel_for(0, nq,
 				[&](size_t i) {
-					SearchKernel::searchRanges(
-						i, nq, target, nodeMgr->getPtsBatch(0).data(), primSize(),
+					SearchKernel::searchRangeIndices(
+						i, nq, queries.data(), nodeMgr->getPtsBatch(0).data(), primSize(),
+						interiors.getRawRepr(), leaves.getRawRepr(), responses.getRawRepr());
+				}
+			);
+		}
+		else {
+			NodeMgrDevice nodeMgrDevice = nodeMgr->getDeviceHandle();
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchRangeIndices(i, nq, queries.data(), nodeMgrDevice, primSize(), responses.getRawRepr());
+				});
+		}
+		return responses;
+	}
+
+	vector<uint32_t> PMKDTree::countQuery(const vector<RangeQuery>& queries) const {
+		size_t nq = queries.size();
+		vector<uint32_t> counts(nq, 0);
+		if (nq == 0 || primSize() == 0) return counts;
+
+		if (isStatic) {
+			assert(nodeMgr->numBatches() == 1);
+			const auto& leaves = nodeMgr->getLeaves(0);
+			const auto& interiors = nodeMgr->getInteriors(0);
+
+			parlay::parallel_for(0, nq,
+				[&](size_t i) {
+					SearchKernel::countRanges(
+						i, nq, queries.data(), nodeMgr->getPtsBatch(0).data(), primSize(),
+						interiors.getRawRepr(), leaves.getRawRepr(), AABB::worldBox(), counts.data());
+				}
+			);
+		}
+		else {
+			NodeMgrDevice nodeMgrDevice = nodeMgr->getDeviceHandle();
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::countRanges(i, nq, queries.data(), nodeMgrDevice, primSize(), AABB::worldBox(), counts.data());
+				});
+		}
+		return counts;
+	}
+
+	RangeQueryResponses PMKDTree::radiusQuery(const vector<Query>& centers, const vector<mfloat>& radii) const {
+		assert(centers.size() == radii.size());
+		if (centers.empty()) return RangeQueryResponses(0);
+
+		size_t nq = centers.size();
+		RangeQueryResponses responses(nq);
+
+		if (isStatic) {
+			assert(nodeMgr->numBatches() == 1);
+			const auto& leaves = nodeMgr->getLeaves(0);
+			const auto& interiors = nodeMgr->getInteriors(0);
+
+			parlay::parallel_for(0, nq,
+				[&](size_t i) {
+					SearchKernel::searchRadius(
+						i, nq, centers.data(), radii.data(), nodeMgr->getPtsBatch(0).data(), primSize(),
 						interiors.getRawRepr(), leaves.getRawRepr(),
 						AABB::worldBox(), responses.getRawRepr());
 				}
@@ -1074,31 +1585,94 @@ namespace pmkd {
 		}
 		else {
 			parlay::parallel_for(0, nq, [&](size_t i) {
-				SearchKernel::searchRanges(i, nq, target,
+				SearchKernel::searchRadius(i, nq, centers.data(), radii.data(),
 				nodeMgr->getDeviceHandle(), primSize(), AABB::worldBox(),
 				responses.getRawRepr());
 				});
 		}
+
+		return responses;
 	}
 
-	RangeQueryResponses PMKDTree::query(const vector<RangeQuery>& queries) const {
-		if (queries.empty()) return RangeQueryResponses(0);
+	KnnQueryResponses PMKDTree::knnQuery(const vector<Query>& queries, int k) const {
+		if (queries.empty() || k <= 0) return KnnQueryResponses(0, 0);
 
-		RangeQueryResponses responses(queries.size());
+		size_t nq = queries.size();
+		KnnQueryResponses responses(nq, k);
+		if (primSize() == 0) return responses;
 
-		mTimer("Range Search Time", [&] {this->_query(queries, responses);});
+		vector<Query> queriesSorted;
+		const Query* target = queries.data();
+		// sort queries to improve cache friendlyness
+		if (config.optimize) {
+			queriesSorted = bufferPool->acquire<vec3f>(nq);
+			sortPts(queries, queriesSorted, responses.queryIdx);
+			target = queriesSorted.data();
+		}
 
+		if (isStatic) {
+			assert(nodeMgr->numBatches() == 1);
+			const auto& leaves = nodeMgr->getLeaves(0);
+			const auto& interiors = nodeMgr->getInteriors(0);
+
+			parlay::parallel_for(0, nq,
+				[&](size_t i) {
+					SearchKernel::searchKnn(
+						i, nq, target, nodeMgr->getPtsBatch(0).data(), primSize(),
+						interiors.getRawRepr(), leaves.getRawRepr(), responses.getRawRepr());
+				}
+			);
+		}
+		else {
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				SearchKernel::searchKnn(i, nq, target, nodeMgr->getDeviceHandle(), primSize(), responses.getRawRepr());
+				});
+		}
+		// kernels work on squared distances
+		parlay::parallel_for(0, responses.dist.size(), [&](size_t i) {
+			responses.dist[i] = std::sqrt(responses.dist[i]);
+			});
+
+		if (!queriesSorted.empty()) bufferPool->release(std::move(queriesSorted));
 		return responses;
 	}
 
 #ifdef ENABLE_MERKLE
+	void PMKDTree::refreshMerkle() const {
+		if (dirtyLeaves.empty()) return;
+
+		// a leaf may be dirtied by several updates, and replaced leaves take the hash of their subtree on the way up
+		int ptNum = primSize();
+		auto nodeMgrDevice = nodeMgr->getDeviceHandle();
+		auto leafIdx = parlay::filter(parlay::remove_duplicate_integers(dirtyLeaves, ptNum), [&](int gi) {
+			int iBatch, localLeafIdx;
+			transformLeafIdx(gi, nodeMgrDevice, iBatch, localLeafIdx);
+			return getReplacedBy(nodeMgrDevice.leavesBatch[iBatch], localLeafIdx) <= 0;
+			});
+		dirtyLeaves.clear();
+		size_t n = leafIdx.size();
+
+		// the paths may be marked already by the updates, marking them again does no harm
+		parlay::parallel_for(0, n, [&](size_t i) {
+			UpdateKernel::markDirtyPath(i, n, leafIdx.data(), nodeMgrDevice);
+			});
+		parlay::parallel_for(0, n, [&](size_t i) {
+			UpdateKernel::calcSelectedLeafHash(i, n, leafIdx.data(), nodeMgrDevice);
+			});
+		parlay::parallel_for(0, n, [&](size_t i) {
+			UpdateKernel::updateMerkleHash(i, n, leafIdx.data(), nodeMgrDevice);
+			});
+	}
+
 	hash_t PMKDTree::getRootHash() const {
+		refreshMerkle();
 		return nodeMgr->getInteriors(0).hash[0];
 	}
 
 	VerifiableRangeQueryResponses
 		PMKDTree::verifiableQuery(const vector<RangeQuery>& queries) const {
 		if (queries.empty()) return VerifiableRangeQueryResponses();
+		refreshMerkle();
 
 		size_t nq = queries.size();
 		VerifiableRangeQueryResponses responses(nq);
@@ -1156,12 +1730,331 @@ namespace pmkd {
 	}
 #endif
 
-	void PMKDTree::rebuildUponInsert(const vector<vec3f>& ptsAdd) {
-
+	void PMKDTree::rebuildUponInsert(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads) {
+		compact(ptsAdd, payloads);
 	}
 
 	void PMKDTree::rebuildUponRemove(const vector<vec3f>& ptsRemove) {
+		size_t nq = ptsRemove.size();
+		auto binIdx = bufferPool->acquire<int>(nq);
+
+		// only mark leaves as removed, interiors are rebuilt right after
+		splitBuckets(ptsRemove, {}, {});
+		nodeMgr->prepareUpdates();
+		auto nodeMgrDevice = nodeMgr->getDeviceHandle();
+		parlay::parallel_for(0, nq, [&](size_t i) {
+			UpdateKernel::removePoints_step1(i, nq, ptsRemove.data(), nodeMgrDevice, primSize(), nullptr, binIdx.data());
+			});
+		bufferPool->release(std::move(binIdx));
+
+		compact({}, {});
+	}
+
+	void PMKDTree::compact(const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd) {
+		Leaves leaves;
+		vector<vec3f> pts;
+		vector<Payload> payloads;
+		gatherCompacted(nodeMgr->getDeviceHandle(), nodeMgr->getPayloadPtrs(), ptsAdd, payloadsAdd, leaves, pts, payloads);
 
+		// the stored points do not change, keep their index
+		auto index = std::move(pointIndex);
+		destroy();
+		pointIndex = std::move(index);
+		buildCompacted(leaves, pts, payloads);
+	}
+
+	void PMKDTree::gatherCompacted(const NodeMgrDevice& nodeMgrDevice, const vector<const Payload*>& payloadBatch,
+		const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd,
+		Leaves& leaves, vector<vec3f>& ptsFinal, vector<Payload>& payloadsFinal) const {
+		// gi indexes the stored points, see transformPointIdx
+		size_t nb = nodeMgrDevice.numBatches;
+		size_t ptNum = nb == 0 ? 0 : nodeMgrDevice.sizesAcc[nb - 1] + nodeMgrDevice.pointShift;
+		size_t mainSize = nb == 0 ? 0 : nodeMgrDevice.sizesAcc[0] + nodeMgrDevice.pointShift;
+		size_t sizeInc = ptsAdd.size();
+
+		auto mortonAdd = bufferPool->acquire<MortonType>(sizeInc);
+		parlay::parallel_for(0, sizeInc,
+			[&](size_t i) { BuildKernel::calcMortonCodes(i, sizeInc, ptsAdd.data(), &globalBoundary, mortonAdd.data()); }
+		);
+		// a bucket only keeps the code of its first point
+		vector<MortonType> mortonMain;
+		if (nb > 0 && nodeMgrDevice.pointShift > 0) {
+			mortonMain = bufferPool->acquire<MortonType>(mainSize);
+			parlay::parallel_for(0, mainSize,
+				[&](size_t i) { BuildKernel::calcMortonCodes(i, mainSize, nodeMgrDevice.ptsBatch[0], &globalBoundary, mortonMain.data()); }
+			);
+		}
+
+		// gi >= ptNum refers to ptsAdd[gi - ptNum]
+		auto getMorton = [&](int gi) {
+			if (size_t(gi) >= ptNum) return mortonAdd[gi - ptNum];
+			if (size_t(gi) < mortonMain.size()) return mortonMain[gi];
+
+			int iBatch, _offset;
+			transformPointIdx(gi, nodeMgrDevice, iBatch, _offset);
+			return nodeMgrDevice.leavesBatch[iBatch].morton[_offset];
+			};
+		auto getMortonCode = [&](int gi) { return getMorton(gi).code; };
+		auto isValid = [&](int gi) {
+			if (size_t(gi) >= ptNum) return true;
+
+			int iBatch, _offset;
+			transformPointIdx(gi, nodeMgrDevice, iBatch, _offset);
+			const auto& leaves = nodeMgrDevice.leavesBatch[iBatch];
+			int leafSize = nodeMgrDevice.sizesAcc[iBatch] - (iBatch > 0 ? nodeMgrDevice.sizesAcc[iBatch - 1] : 0);
+			return getReplacedBy(leaves, findBucket(leaves, leafSize, _offset)) == 0;
+			};
+
+		// valid leaves of the main tree are already sorted, only sort the rest and merge
+		auto mainIdx = parlay::filter(parlay::iota<int>(mainSize), isValid);
+		auto restIdx = parlay::filter(parlay::tabulate(ptNum + sizeInc - mainSize, [&](size_t i) {return int(mainSize + i);}), isValid);
+		parlay::integer_sort_inplace(restIdx, [&](const auto& gi) {return getMortonCode(gi);});
+		auto primIdx = parlay::merge(mainIdx, restIdx,
+			[&](int gi, int gj) { return getMortonCode(gi) < getMortonCode(gj); });
+		mainIdx.clear();
+		restIdx.clear();
+
+		size_t ptNumNew = primIdx.size();
+		ptsFinal.resize(ptNumNew);
+		// the rest of the leaves is allocated by buildCompacted
+		leaves.morton.resize(ptNumNew);
+
+		parlay::parallel_for(0, ptNumNew, [&](size_t i) {
+			int gi = primIdx[i];
+			leaves.morton[i] = getMorton(gi);
+			if (size_t(gi) >= ptNum) ptsFinal[i] = ptsAdd[gi - ptNum];
+			else {
+				int iBatch, _offset;
+				transformPointIdx(gi, nodeMgrDevice, iBatch, _offset);
+				ptsFinal[i] = nodeMgrDevice.ptsBatch[iBatch][_offset];
+			}
+			});
+		payloadsFinal = gatherPayloads(nodeMgrDevice, payloadBatch, primIdx.data(), ptNumNew, ptNum, payloadsAdd);
+		bufferPool->release<MortonType>(std::move(mortonAdd));
+		if (!mortonMain.empty()) bufferPool->release<MortonType>(std::move(mortonMain));
+	}
+
+	void PMKDTree::buildCompacted(Leaves& leaves, vector<vec3f>& ptsFinal, vector<Payload>& payloadsFinal) {
+		size_t ptNumNew = ptsFinal.size();
+		isStatic = true;
+		if (ptNumNew == 0) return;
+
+		prepareLeaves(leaves, ptsFinal);
+
+		Interiors interiors;
+		interiors.resize(leaves.size() - 1);
+		buildStatic_LeavesReady(leaves, interiors);
+		nodeMgr->append(std::move(leaves), std::move(interiors), std::move(ptsFinal), std::move(payloadsFinal));
+		nodeMgr->buildJumpTable(globalBoundary);
+	}
+
+	void PMKDTree::compactAsync() {
+		if (pendingTree || primSize() == 0) return;
+
+		// only replacedBy is copied here, the batches themselves are kept until the swap, see mergeLevels
+		auto snapshot = nodeMgr->snapshotLeaves();
+
+		PMKD_Config pendingConfig = config;
+		pendingConfig.asyncRebuild = false;
+		pendingConfig.indexPoints = false;  // the index of this tree stays valid across the swap
+		pendingTree = std::make_unique<PMKDTree>(pendingConfig);
+		pendingTree->globalBoundary = globalBoundary;
+
+		// the pending tree owns its node manager and buffer pool, only the snapshotted batches are read from this tree
+		pendingBuild = std::async(std::launch::async,
+			[tree = pendingTree.get(), snapshot = std::move(snapshot)]() {
+				Leaves leaves;
+				vector<vec3f> pts;
+				vector<Payload> payloads;
+				tree->gatherCompacted(snapshot.getDeviceHandle(), snapshot.payloadBatch, {}, {}, leaves, pts, payloads);
+				tree->buildCompacted(leaves, pts, payloads);
+			});
+	}
+
+	bool PMKDTree::finishCompaction(bool wait) {
+		if (!pendingTree) return false;
+		if (!wait && pendingBuild.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+		pendingBuild.get();
+
+		for (auto& update : pendingUpdates) {
+			pendingTree->remove(update.ptsRemove);
+			pendingTree->insert(update.ptsAdd, update.payloadsAdd);
+		}
+		pendingUpdates.clear();
+
+		std::swap(nodeMgr, pendingTree->nodeMgr);
+		isStatic = pendingTree->isStatic;
+		nTotalRemoved = pendingTree->nTotalRemoved;
+		nTotalDInserted = pendingTree->nTotalDInserted;
+#ifdef ENABLE_MERKLE
+		std::swap(dirtyLeaves, pendingTree->dirtyLeaves);
+#endif
+		pendingTree.reset();
+		return true;
+	}
+
+	void PMKDTree::addToPointIndex(const vector<vec3f>& pts) {
+		parlay::parallel_for(0, pts.size(), [&](size_t i) {
+			pointIndex->Upsert(pts[i], [](std::optional<int> cnt) { return cnt.value_or(0) + 1; });
+			});
+	}
+
+	vector<vec3f> PMKDTree::takeFromPointIndex(const vector<vec3f>& pts) {
+		size_t n = pts.size();
+		auto oldCount = bufferPool->acquire<int>(n);
+		parlay::parallel_for(0, n, [&](size_t i) {
+			auto cnt = pointIndex->Upsert(pts[i], [](std::optional<int> cnt) { return std::max(cnt.value_or(0) - 1, 0); });
+			oldCount[i] = cnt.value_or(0);
+			});
+		// a count reaches 0 iff one of its decrements started from 1 or less
+		parlay::parallel_for(0, n, [&](size_t i) {
+			if (oldCount[i] <= 1) pointIndex->Remove(pts[i]);
+			});
+
+		auto stored = parlay::filter(parlay::iota<int>(n), [&](int i) { return oldCount[i] > 0; });
+		vector<vec3f> ptsStored(stored.size());
+		parlay::parallel_for(0, stored.size(), [&](size_t i) { ptsStored[i] = pts[stored[i]]; });
+		bufferPool->release(std::move(oldCount));
+		return ptsStored;
+	}
+
+	void PMKDTree::mergeLevels() {
+		// a pending compaction reads the current batches, they are merged after the swap
+		// batches hanging off a bucketed main tree are kept apart, the merge takes each bin for a single point
+		if (config.levelRatio <= 0 || pendingTree || nodeMgr->isBucketed()) return;
+
+		while (nodeMgr->numBatches() > 2) {
+			size_t nb = nodeMgr->numBatches();
+			size_t newer = nodeMgr->getLeaves(nb - 1).size();
+			size_t older = nodeMgr->getLeaves(nb - 2).size();
+			if (older >= newer * config.levelRatio) break;
+			mergeBatches(nb - 2);
+		}
+	}
+
+	void PMKDTree::mergeBatches(size_t firstBatch) {
+		assert(firstBatch > 0 && firstBatch < nodeMgr->numBatches());
+#ifdef ENABLE_MERKLE
+		// the merge renumbers leaves and rehashes the bins eagerly
+		refreshMerkle();
+#endif
+		auto nodeMgrDevice = nodeMgr->getDeviceHandle();
+		int ptNum = primSize();
+		int tailBegin = nodeMgrDevice.sizesAcc[firstBatch - 1];
+
+		// leaves before firstBatch replaced by a subtree of the merged batches, one per subtree
+		auto bins = parlay::flatten(parlay::tabulate(nodeMgr->numBatches() - firstBatch, [&](size_t b) {
+			const auto& derivedFrom = nodeMgr->getLeaves(firstBatch + b).derivedFrom;
+			auto subRoots = parlay::filter(parlay::iota<int>(derivedFrom.size()), [&](int i) {
+				return derivedFrom[i] < tailBegin && (i == 0 || derivedFrom[i] != derivedFrom[i - 1]);
+				});
+			return parlay::map(subRoots, [&](int i) {return derivedFrom[i];});
+			}));
+		size_t nBins = bins.size();
+
+		// each bin takes over the state of its own copy in the merged batches, the copy is dropped
+		// bins whose subtree keeps no other live point get no subtree after the merge
+		auto isCopy = bufferPool->acquire<uint8_t>(ptNum - tailBegin, 0);
+		auto binsUnrefilled = bufferPool->acquire<int>(nBins);
+		parlay::parallel_for(0, nBins, [&](size_t i) {
+			int iBatch, localLeafIdx;
+			transformLeafIdx(bins[i], nodeMgrDevice, iBatch, localLeafIdx);
+			auto& replacedBy = nodeMgrDevice.leavesBatch[iBatch].replacedBy[localLeafIdx];
+			const vec3f& pt = nodeMgrDevice.ptsBatch[iBatch][localLeafIdx];
+
+			int subBatch, subLeafIdx;
+			transformLeafIdx(replacedBy, nodeMgrDevice, subBatch, subLeafIdx);
+			const auto& subLeaves = nodeMgrDevice.leavesBatch[subBatch];
+			const auto& subInteriors = nodeMgrDevice.interiorsBatch[subBatch];
+			int subRoot;
+			bool isRC;
+			decodeParentCode(subLeaves.parent[subLeafIdx], subRoot, isRC);
+			while (!isSubtreeRoot(subLeaves, subInteriors, subRoot, false))
+				decodeParentCode(subInteriors.parent[subRoot], subRoot, isRC);
+			int live = subInteriors.liveCount[subRoot].load(std::memory_order_relaxed);
+
+			// follow the copies of the bin through the merged batches
+			int state = -1;
+			for (int gi = replacedBy; gi > 0;) {
+				int cBatch, cLeafIdx;
+				transformLeafIdx(gi, nodeMgrDevice, cBatch, cLeafIdx);
+				const auto& cLeaves = nodeMgrDevice.leavesBatch[cBatch];
+				const vec3f* cPts = nodeMgrDevice.ptsBatch[cBatch];
+				int rBound = cLeaves.treeLocalRangeR[cLeafIdx];
+				int copyIdx = cLeafIdx;
+				while (copyIdx < rBound && !(cPts[copyIdx] == pt)) ++copyIdx;
+				if (copyIdx == rBound) break;
+
+				gi += copyIdx - cLeafIdx;
+				state = cLeaves.replacedBy[copyIdx];
+				if (state <= 0) {
+					isCopy[gi - tailBegin] = 1;
+					break;
+				}
+				gi = state;
+			}
+
+			int revived = state == 0;
+			propagateLiveCount(bins[i], revived - live, nodeMgrDevice);
+			binsUnrefilled[i] = live - revived == 0 ? bins[i] : -1;
+			replacedBy = revived ? 0 : -1;
+			});
+
+		// the remaining live points of the merged batches are inserted again
+		auto tailIdx = parlay::filter(parlay::tabulate(ptNum - tailBegin, [&](size_t i) {return int(tailBegin + i);}),
+			[&](int gi) {
+				int iBatch, _offset;
+				transformLeafIdx(gi, nodeMgrDevice, iBatch, _offset);
+				return nodeMgrDevice.leavesBatch[iBatch].replacedBy[_offset] == 0 && !isCopy[gi - tailBegin];
+			});
+		size_t sizeInc = tailIdx.size();
+		vector<vec3f> ptsAdd(sizeInc);
+		parlay::parallel_for(0, sizeInc, [&](size_t i) {
+			int iBatch, _offset;
+			transformLeafIdx(tailIdx[i], nodeMgrDevice, iBatch, _offset);
+			ptsAdd[i] = nodeMgrDevice.ptsBatch[iBatch][_offset];
+			});
+		auto payloadsAdd = gatherPayloads(tailIdx.data(), sizeInc, ptNum, {});
+		tailIdx.clear();
+		bufferPool->release(std::move(isCopy));
+
+		nodeMgr->truncate(firstBatch);
+
+#ifdef ENABLE_MERKLE
+		// bins refilled below get their hashes from buildIncrement, refresh the others here
+		auto binsRefresh = parlay::filter(binsUnrefilled, [](int bin) {return bin >= 0;});
+		size_t nRefresh = binsRefresh.size();
+		if (nRefresh > 0) {
+			auto ptsRefresh = bufferPool->acquire<vec3f>(nRefresh);
+			auto binIdx = bufferPool->acquire<int>(nRefresh);
+			nodeMgrDevice = nodeMgr->getDeviceHandle();
+			parlay::parallel_for(0, nRefresh, [&](size_t i) {
+				int iBatch, localLeafIdx;
+				transformLeafIdx(binsRefresh[i], nodeMgrDevice, iBatch, localLeafIdx);
+				ptsRefresh[i] = nodeMgrDevice.ptsBatch[iBatch][localLeafIdx];
+				});
+			// mark the paths top-down for the bottom-up hash update
+			parlay::parallel_for(0, nRefresh, [&](size_t i) {
+				UpdateKernel::findLeafBin(i, nRefresh, ptsRefresh.data(), primSize(), nodeMgrDevice, nullptr, binIdx.data());
+				});
+			parlay::parallel_for(0, nRefresh, [&](size_t i) {
+				UpdateKernel::calcSelectedLeafHash(i, nRefresh, binIdx.data(), nodeMgrDevice);
+				});
+			parlay::parallel_for(0, nRefresh, [&](size_t i) {
+				UpdateKernel::updateMerkleHash(i, nRefresh, binIdx.data(), nodeMgrDevice);
+				});
+			bufferPool->release(std::move(ptsRefresh));
+			bufferPool->release(std::move(binIdx));
+		}
+#endif
+		bufferPool->release(std::move(binsUnrefilled));
+
+		if (sizeInc > 0) buildIncrement(ptsAdd, payloadsAdd);
+	}
+
+	void PMKDTree::logPendingUpdate(const vector<vec3f>& ptsRemove, const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd) {
+		if (!pendingTree) return;
+		pendingUpdates.push_back({ ptsRemove, ptsAdd, payloadsAdd });
 	}
 
 	// rebuild strategy
@@ -1169,51 +2062,84 @@ namespace pmkd {
 		int nBatches = nodeMgr->numBatches();
 		if (nToDInsert > 0 && nBatches + 1 > config.maxNumBatches) return true;
 
-		float nValid = primSize() - nTotalRemoved;
+		float nValid = nodeMgr->numPoints() - nTotalRemoved;
 		float ratioI = (nToDInsert + nTotalDInserted) / nValid;
 		float ratioR = (nToRemove + nTotalRemoved) / nValid;
 		return ratioI >= config.maxDInsertedRatio || ratioR >= config.maxRemovedRatio;
 	}
 
-	void PMKDTree::insert(const vector<vec3f>& ptsAdd) {
+	void PMKDTree::insert(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads) {
 		if (ptsAdd.empty()) return;
+		assert(payloads.empty() || payloads.size() == ptsAdd.size());
 
+		finishCompaction(false);
 		int nStored = primSize();
 		if (nStored == 0) {
-			firstInsert(ptsAdd);
+			firstInsert(ptsAdd, payloads);
 			return;
 		}
+		if (pointIndex) addToPointIndex(ptsAdd);
 
-		if (needRebuild(ptsAdd.size(), 0)) {
-			rebuildUponInsert(ptsAdd);
+		bool rebuild = needRebuild(ptsAdd.size(), 0);
+		if (rebuild && !config.asyncRebuild) {
+			rebuildUponInsert(ptsAdd, payloads);
 			isStatic = true;
 		}
 		else {
+			logPendingUpdate({}, ptsAdd, payloads);
 			isStatic = false;
-			buildIncrement(ptsAdd);
+			splitBuckets(ptsAdd, ptsAdd, payloads);
 			nTotalDInserted += ptsAdd.size();
+			mergeLevels();
+			if (rebuild) compactAsync();
 		}
 	}
 
-	void PMKDTree::insert_v2(const vector<vec3f>& ptsAdd) {
+	void PMKDTree::insert_v2(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads) {
 		if (ptsAdd.empty()) return;
+		// the merge keeps one point per leaf
+		if (nodeMgr->isBucketed()) {
+			insert(ptsAdd, payloads);
+			return;
+		}
 
+		// the merge rewrites the batches a pending compaction reads, swap it in first
+		finishCompaction(true);
 		assert(isStatic);
-		buildIncrement_v2(ptsAdd);
+		if (pointIndex) addToPointIndex(ptsAdd);
+		buildIncrement_v2(ptsAdd, payloads);
 	}
 
-	void PMKDTree::firstInsert(const vector<vec3f>& pts) {
+	void PMKDTree::firstInsert(const vector<vec3f>& pts, const vector<Payload>& payloads) {
 		if (pts.empty()) return;
 
 		destroy();
 		isStatic = true;
-		buildStatic(pts);
+		buildStatic(pts, payloads);
+		if (pointIndex) addToPointIndex(pts);
 	}
 
 	void PMKDTree::remove(const vector<vec3f>& ptsRemove) {
+		finishCompaction(false);
+		if (ptsRemove.empty() || primSize() == 0) return;
+
+		if (pointIndex) removeStored(takeFromPointIndex(ptsRemove));
+		else removeStored(ptsRemove);
+	}
+
+	void PMKDTree::removeStored(const vector<vec3f>& ptsRemove) {
 		if (ptsRemove.empty()) return;
 
 		size_t nq = ptsRemove.size();
+		bool rebuild = needRebuild(0, nq);
+		if (rebuild && !config.asyncRebuild) {
+			rebuildUponRemove(ptsRemove);
+			return;
+		}
+		logPendingUpdate(ptsRemove, {}, {});
+		// a leaf is removed as a whole, so the buckets reached hold a single point first
+		splitBuckets(ptsRemove, {}, {});
+		nodeMgr->prepareUpdates();
 
 		vector<vec3f> ptsRemoveSorted;
 		const vec3f* target = ptsRemove.data();
@@ -1229,6 +2155,9 @@ namespace pmkd {
 		}
 
 		auto nodeMgrDeviceHandle = nodeMgr->getDeviceHandle();
+		vector<int> startNode;
+		if (config.optimize) startNode = findPacketStarts(target, nq);
+		const int* start = startNode.empty() ? nullptr : startNode.data();
 
 		if (isStatic) {
 			assert(nodeMgr->numBatches() == 1);
@@ -1238,47 +2167,85 @@ namespace pmkd {
 			parlay::parallel_for(0, nq,
 				[&](size_t i) {
 					UpdateKernel::removePoints_step1(i, nq, target, nodeMgr->getPtsBatch(0).data(), primSize(),
-					interiors.getRawRepr(), leaves.getRawRepr(), binIdx.data());
+					interiors.getRawRepr(), leaves.getRawRepr(), nodeMgr->getJumpTable(), start, binIdx.data());
 		}
 			);
 
 #ifdef ENABLE_MERKLE
-			parlay::parallel_for(0, nq, [&](size_t i) {
-				UpdateKernel::calcSelectedLeafHash(i, nq, binIdx.data(), nodeMgrDeviceHandle);
-				});
-#endif
-
+			if (config.lazyMerkle) {
+				parlay::parallel_for(0, nq, [&](size_t i) {
+					UpdateKernel::propagateRemoval(i, nq, binIdx.data(), leaves.getRawRepr(), interiors.getRawRepr());
+					});
+			}
+			else {
+				parlay::parallel_for(0, nq, [&](size_t i) {
+					UpdateKernel::calcSelectedLeafHash(i, nq, binIdx.data(), nodeMgrDeviceHandle);
+					});
+				parlay::parallel_for(0, nq, [&](size_t i) {
+					UpdateKernel::removePoints_step2(i, nq, primSize(), binIdx.data(), leaves.getRawRepr(), interiors.getRawRepr());
+					});
+			}
+#else
 			parlay::parallel_for(0, nq, [&](size_t i) {
 				UpdateKernel::removePoints_step2(i, nq, primSize(), binIdx.data(), leaves.getRawRepr(), interiors.getRawRepr());
 				});
+#endif
 		}
 		else {
 			parlay::parallel_for(0, nq, [&](size_t i) {
-				UpdateKernel::removePoints_step1(i, nq, target, nodeMgrDeviceHandle, primSize(), binIdx.data());
+				UpdateKernel::removePoints_step1(i, nq, target, nodeMgrDeviceHandle, primSize(), start, binIdx.data());
 				}
 			);
 
 #ifdef ENABLE_MERKLE
-			parlay::parallel_for(0, nq, [&](size_t i) {
-				UpdateKernel::calcSelectedLeafHash(i, nq, binIdx.data(), nodeMgrDeviceHandle);
-				});
-#endif
-
+			if (config.lazyMerkle) {
+				parlay::parallel_for(0, nq, [&](size_t i) {
+					UpdateKernel::propagateRemoval(i, nq, binIdx.data(), nodeMgrDeviceHandle);
+					});
+			}
+			else {
+				parlay::parallel_for(0, nq, [&](size_t i) {
+					UpdateKernel::calcSelectedLeafHash(i, nq, binIdx.data(), nodeMgrDeviceHandle);
+					});
+				parlay::parallel_for(0, nq, [&](size_t i) {
+					UpdateKernel::removePoints_step2(i, nq, binIdx.data(), nodeMgrDeviceHandle);
+					});
+			}
+#else
 			parlay::parallel_for(0, nq, [&](size_t i) {
 				UpdateKernel::removePoints_step2(i, nq, binIdx.data(), nodeMgrDeviceHandle);
 				});
+#endif
 				}
+#ifdef ENABLE_MERKLE
+		// hashed on the next refreshMerkle()
+		if (config.lazyMerkle) dirtyLeaves.insert(dirtyLeaves.end(), binIdx.begin(), binIdx.end());
+#endif
 		if (!ptsRemoveSorted.empty()) bufferPool->release(std::move(ptsRemoveSorted));
+		if (!startNode.empty()) bufferPool->release(std::move(startNode));
 		bufferPool->release(std::move(binIdx));
 
 		isStatic = false;
+		nTotalRemoved += nq;
+		if (rebuild) compactAsync();
 	}
 
-	void PMKDTree::remove_v2(const vector<vec3f>& ptsRemove) {
+	void PMKDTree::remove_v2(const vector<vec3f>& ptsRequested) {
+		// removed leaves are dropped from the main tree, which keeps one point per leaf
+		if (nodeMgr->isBucketed()) {
+			remove(ptsRequested);
+			return;
+		}
 		assert(isStatic);
 
+		// with a point index only the stored points are removed, as in remove()
+		vector<vec3f> ptsStored;
+		if (pointIndex) ptsStored = takeFromPointIndex(ptsRequested);
+		const auto& ptsRemove = pointIndex ? ptsStored : ptsRequested;
 		if (ptsRemove.empty()) return;
 
+		logPendingUpdate(ptsRemove, {}, {});
+		nodeMgr->prepareUpdates();
 		size_t nq = ptsRemove.size();
 
 		vector<vec3f> ptsRemoveSorted;
@@ -1342,6 +2309,7 @@ namespace pmkd {
 			hashFinal[i] = leaves.hash[primIdxNew[i]];
 			});
 #endif
+		auto payloadsFinal = gatherPayloads(primIdxNew.data(), ptNumNew, ptNum, {});
 		bufferPool->release(std::move(primIdxNew));
 
 		// 		leaves.morton = std::move(mortonFinal);
@@ -1364,14 +2332,16 @@ namespace pmkd {
 
 
 		Leaves leavesNew = std::move(leaves);
-		leavesNew.replacedBy.clear();
-		leavesNew.replacedBy.resize(ptNumNew, 0);
+		leavesNew.replacedBy = vector<int>();  // nothing is removed from the rebuilt tree
 		leavesNew.parent.resize(ptNumNew);
 
 		Interiors interiorsNew = std::move(interiors);
 		interiorsNew.resize(ptNumNew - 1);
 
+		// the removed points are already taken from the index, keep it for the rebuilt tree
+		auto index = std::move(pointIndex);
 		destroy();
+		pointIndex = std::move(index);
 		isStatic = true;
 
 		// get scene boundary
@@ -1384,6 +2354,7 @@ namespace pmkd {
 #endif
 
 		buildStatic_LeavesReady(leavesNew, interiorsNew);
-		nodeMgr->append(std::move(leavesNew), std::move(interiorsNew), std::move(ptsFinal));
+		nodeMgr->append(std::move(leavesNew), std::move(interiorsNew), std::move(ptsFinal), std::move(payloadsFinal));
+		nodeMgr->buildJumpTable(globalBoundary);
 	}
 }
\ No newline at end of file
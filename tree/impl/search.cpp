@@ -1,10 +1,90 @@
+#include <algorithm>
 #include <tree/device_helper.h>
+#include <tree/helper.h>
 #include <tree/kernel.h>
 
 namespace pmkd {
+	namespace {
+		// collect the leaves inside a sphere, see traverseSprouting
+		struct SpherePolicy {
+			static constexpr bool TRACK_REGION = false;
+			const vec3f& center;
+			mfloat radius;
+			mfloat sqRadius;
+			vec3f* out;
+			uint32_t& size;
+			uint32_t cap;
+
+			bool pruneLeft(int dim, mfloat val) const { return center[dim] - radius >= val; }
+			bool pruneRight(int dim, mfloat val) const { return center[dim] + radius < val; }
+			bool visit(const vec3f& pt, int) {
+				if (square_norm(pt - center) > sqRadius) return true;
+				out[size++] = pt;
+				return size < cap;
+			}
+		};
+
+		// keep the k nearest leaves, pruning by the distance to the current k-th neighbor
+		struct KnnPolicy {
+			static constexpr bool TRACK_REGION = false;
+			const vec3f& pt;
+			int* nbrIdx;
+			mfloat* nbrDist;
+			uint32_t& size;
+			uint32_t k;
+
+			bool pruneLeft(int dim, mfloat val) const {
+				mfloat gap = pt[dim] - val;
+				return gap > 0 && gap * gap >= worstNeighborDist(nbrDist, size, k);
+			}
+			bool pruneRight(int dim, mfloat val) const {
+				mfloat gap = val - pt[dim];
+				return gap > 0 && gap * gap >= worstNeighborDist(nbrDist, size, k);
+			}
+			bool visit(const vec3f& leafPt, int ptIdx) {
+				insertNeighbor(nbrIdx, nbrDist, size, k, ptIdx, square_norm(leafPt - pt));
+				return true;
+			}
+		};
+
+		// stop at the first point of the first valid leaf on the path of pt
+		struct LocatePolicy {
+			static constexpr bool TRACK_REGION = false;
+			const vec3f& pt;
+			int ptIdx = -1;
+
+			bool pruneLeft(int dim, mfloat val) const { return pt[dim] >= val; }
+			bool pruneRight(int dim, mfloat val) const { return pt[dim] < val; }
+			bool visit(const vec3f&, int idx) {
+				ptIdx = idx;
+				return false;
+			}
+		};
+
+		// count the leaves inside a box, subtrees whose region lies inside it are counted as a whole
+		struct CountPolicy {
+			static constexpr bool TRACK_REGION = true;
+			const AABB& box;
+			const AABB& boundary;
+			uint32_t n = 0;
+
+			bool pruneLeft(int dim, mfloat val) const { return box.ptMin[dim] >= val; }
+			bool pruneRight(int dim, mfloat val) const { return box.ptMax[dim] < val; }
+			bool visit(const vec3f& pt, int) {
+				n += box.include(pt);
+				return true;
+			}
+			bool takeSubtree(const AABB& region, int liveCount) {
+				if (!box.include(region)) return false;
+				n += liveCount;
+				return true;
+			}
+		};
+	}
 
 	void SearchKernel::searchPoints(int qIdx, int qSize, const Query* qPts, const vec3f* pts, int leafSize,
-		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const AABB& boundary, uint8_t* exist) {
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
+		const AABB& boundary, uint8_t* exist) {
 		if (qIdx >= qSize) return;
 		const vec3f& pt = qPts[qIdx];
 		if (!boundary.include(pt)) return;
@@ -13,17 +93,20 @@ namespace pmkd {
 		int L = 0, R = 0;
 		bool onRight;
 		int interiorIdx = 0;
-		for (int begin = 0; begin < leafSize; begin++) {
-			L = leaves.segOffset[begin];
+		int start, skip;
+		findTraversalStart(jump, startNode, qIdx, pt, leaves, interiors, leafSize, start, skip);
+		for (int begin = start; begin < leafSize; begin++) {
+			L = std::max(leaves.segOffset[begin], skip);
 			R = begin == leafSize - 1 ? L : leaves.segOffset[begin + 1];
 			onRight = false;
 			for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-				if (isInteriorRemoved(interiors.removeState[interiorIdx])) {
+				if (isInteriorRemoved(interiors, interiorIdx)) {
 					return;
 				}
 
-				int splitDim = interiors.splitDim[interiorIdx];
-				mfloat splitVal = interiors.splitVal[interiorIdx];
+				int splitDim;
+				mfloat splitVal;
+				getSplit(interiors, interiorIdx, splitDim, splitVal);
 				onRight = pt[splitDim] >= splitVal;
 				if (onRight) {
 					// goto right child
@@ -37,14 +120,134 @@ namespace pmkd {
 			if (!onRight) {
 				// hit leaf with index <begin>
 				//resp[qIdx].exist = pts[leaves.primIdx[begin]] == pt;
-				exist[qIdx] = leaves.replacedBy[begin] == 0 && pts[begin] == pt;
+				exist[qIdx] = getReplacedBy(leaves, begin) == 0 && bucketHolds(leaves, pts, begin, pt);
 				break;
 			}
 		}
 	}
 
+	void SearchKernel::searchPointsGroup(int gIdx, int groupSize, int qSize, const Query* qPts, const vec3f* pts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
+		uint8_t* exist) {
+		int first = gIdx * groupSize;
+		if (first >= qSize) return;
+		int n = std::min({ groupSize, qSize - first, MAX_PREFETCH_GROUP });
+
+		// per query: the leaf whose segment is visited next and the stage of the visit
+		// stage 0 reads the bounds of the segment, stage 1 walks its interiors, stage 2 is done
+		int bin[MAX_PREFETCH_GROUP], skip[MAX_PREFETCH_GROUP], L[MAX_PREFETCH_GROUP], R[MAX_PREFETCH_GROUP];
+		uint8_t stage[MAX_PREFETCH_GROUP];
+		for (int i = 0; i < n; i++) {
+			findTraversalStart(jump, startNode, first + i, qPts[first + i], leaves, interiors, leafSize, bin[i], skip[i]);
+			stage[i] = 0;
+			prefetch(leaves.segOffset + bin[i]);
+		}
+
+		for (int active = n; active > 0;) {
+			for (int i = 0; i < n; i++) {
+				if (stage[i] == 2) continue;
+				if (stage[i] == 0) {
+					L[i] = std::max(leaves.segOffset[bin[i]], skip[i]);
+					R[i] = bin[i] == leafSize - 1 ? L[i] : leaves.segOffset[bin[i] + 1];
+					prefetchSplit(interiors, L[i]);
+					if (interiors.removeState) prefetch(interiors.removeState + L[i]);
+					prefetch(interiors.rangeR + L[i]);
+					if (leaves.replacedBy) prefetch(leaves.replacedBy + bin[i]);
+					prefetch(pts + bucketBegin(leaves, bin[i]));
+					stage[i] = 1;
+					continue;
+				}
+
+				const vec3f& pt = qPts[first + i];
+				bool onRight = false, removed = false;
+				for (int interiorIdx = L[i]; interiorIdx < R[i]; interiorIdx++) {
+					if (isInteriorRemoved(interiors, interiorIdx)) {
+						removed = true;
+						break;
+					}
+					int splitDim;
+					mfloat splitVal;
+					getSplit(interiors, interiorIdx, splitDim, splitVal);
+					onRight = pt[splitDim] >= splitVal;
+					if (onRight) {
+						// goto right child
+						bin[i] = interiorIdx < R[i] - 1 ? interiors.rangeR[interiorIdx + 1] : bin[i];
+						break;
+					}
+				}
+				if (onRight && !removed) {
+					++bin[i];
+					stage[i] = 0;
+					prefetch(leaves.segOffset + bin[i]);
+					continue;
+				}
+				// hit leaf with index <bin>
+				if (!removed) exist[first + i] = getReplacedBy(leaves, bin[i]) == 0 && bucketHolds(leaves, pts, bin[i], pt);
+				stage[i] = 2;
+				--active;
+			}
+		}
+	}
+
+	void SearchKernel::searchPointsByRank(int qIdx, int qSize, const Query* qPts, const MortonType* qMorton, INPUT(int*) rank,
+		const vec3f* pts, int leafSize, const LeavesRawRepr leaves, uint8_t* exist) {
+		if (qIdx >= qSize) return;
+		const vec3f& pt = qPts[qIdx];
+
+		for (int i = rank[qIdx]; i < leafSize && leaves.morton[i].code == qMorton[qIdx].code; i++) {
+			if (getReplacedBy(leaves, i) == 0 && pts[i] == pt) {
+				exist[qIdx] = true;
+				return;
+			}
+		}
+	}
+
+	void SearchKernel::findPacketStarts(int pIdx, int qSize, const vec3f* qPts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump,
+		OUTPUT(int*) startNode) {
+		int first = pIdx * PACKET_SIZE;
+		if (first >= qSize) return;
+		int n = std::min(PACKET_SIZE, qSize - first);
+		const vec3f* pts = qPts + first;
+
+		// the packet starts from the jump table if all its points share a cell
+		int cell = jump.node ? calcJumpCell(jump.boundary, pts[0]) : -1;
+		for (int i = 1; i < n && cell >= 0; i++) {
+			if (calcJumpCell(jump.boundary, pts[i]) != cell) cell = -1;
+		}
+		int node = cell >= 0 ? jump.node[cell] : 0;
+
+		if (node >= 0) {
+			PointPacket packet(pts, n);
+			constexpr int all = (1 << PACKET_SIZE) - 1;
+
+			// do sprouting with the whole packet
+			int start, skip;
+			decodeStartNode(node, leaves, interiors, leafSize, start, skip);
+			for (int bin = start; bin < leafSize; bin++) {
+				int L = std::max(leaves.segOffset[bin], skip);
+				int R = bin == leafSize - 1 ? L : leaves.segOffset[bin + 1];
+				int interiorIdx, mask = 0;
+				for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
+					int splitDim;
+					mfloat splitVal;
+					getSplit(interiors, interiorIdx, splitDim, splitVal);
+					mask = packet.onRightMask(splitDim, splitVal);
+					if (mask != 0) break;
+				}
+				if (mask != all) {
+					// the packet splits at interiorIdx, or all of it reaches leaf bin
+					node = interiorIdx < R ? interiorIdx : ~bin;
+					break;
+				}
+				bin = interiorIdx < R - 1 ? interiors.rangeR[interiorIdx + 1] : bin;
+			}
+		}
+		for (int i = 0; i < n; i++) startNode[first + i] = node;
+	}
+
 	void SearchKernel::searchPoints(int qIdx, int qSize, const Query* qPts, const NodeMgrDevice nodeMgr, int totalLeafSize,
-		const AABB& boundary, uint8_t* exist) {
+		INPUT(int*) startNode, const AABB& boundary, uint8_t* exist) {
 		if (qIdx >= qSize) return;
 		const vec3f& pt = qPts[qIdx];
 		if (!boundary.include(pt)) return;
@@ -57,9 +260,11 @@ namespace pmkd {
 		int interiorIdx = 0;
 
 
-		int globalLeafIdx = 0;
+		int globalLeafIdx, skip;  // skip only applies to the main tree
+		findTraversalStart(nodeMgr.jumpTable, startNode, qIdx, pt, nodeMgr.leavesBatch[0], nodeMgr.interiorsBatch[0],
+			mainTreeLeafSize, globalLeafIdx, skip);
 		while (globalLeafIdx < totalLeafSize) {
-			transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+			transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
 
 			const auto& leaves = nodeMgr.leavesBatch[iBatch];
 			const auto& interiors = nodeMgr.interiorsBatch[iBatch];
@@ -70,15 +275,16 @@ namespace pmkd {
  			while (localLeafIdx < rBound) {
 				int oldLocalLeafIdx = localLeafIdx;
 				
-				L = leaves.segOffset[localLeafIdx];
+				L = std::max(leaves.segOffset[localLeafIdx], skip);
 				R = localLeafIdx == rBound - 1 ? L : leaves.segOffset[localLeafIdx + 1];
 				onRight = false;
 				for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-					if (isInteriorRemoved(interiors.removeState[interiorIdx]))
+					if (isInteriorRemoved(interiors, interiorIdx))
 					 	return;
 					
-					int splitDim = interiors.splitDim[interiorIdx];
-					mfloat splitVal = interiors.splitVal[interiorIdx];
+					int splitDim;
+					mfloat splitVal;
+					getSplit(interiors, interiorIdx, splitDim, splitVal);
 					onRight = pt[splitDim] >= splitVal;
 					if (onRight) {
 						// goto right child
@@ -87,13 +293,14 @@ namespace pmkd {
 					}
 				}
 				if (!onRight) {
-					int globalSubstitute = leaves.replacedBy[localLeafIdx];
+					int globalSubstitute = getReplacedBy(leaves, localLeafIdx);
 					if (globalSubstitute <= 0) { // this leaf is valid or removed (i.e. not replaced)
-						exist[qIdx] = !(globalSubstitute < 0) && nodeMgr.ptsBatch[iBatch][localLeafIdx] == pt;
+						exist[qIdx] = !(globalSubstitute < 0) && bucketHolds(leaves, nodeMgr.ptsBatch[iBatch], localLeafIdx, pt);
 						return;
 					}
 					// leaf is replaced
 					globalLeafIdx = globalSubstitute;
+					skip = 0;
 					break;
 				}
 				++localLeafIdx;
@@ -110,60 +317,145 @@ namespace pmkd {
 		const AABB& box = qRanges[qIdx];
 		if (!boundary.overlap(box)) return;
 
-		// do sprouting
-		int L = 0, R = 0;
-		bool onRight;
-		int interiorIdx = 0;
-		int splitDim;
-		mfloat splitVal;
-		for (int begin = 0; begin < leafSize; begin++) {
-			L = leaves.segOffset[begin];
-			R = begin == leafSize - 1 ? L : leaves.segOffset[begin + 1];
-			onRight = false;
+		vec3f* out = resps.getBufPtr(qIdx);
+		uint32_t& respSize = *(resps.getSizePtr(qIdx));
+		forEachPointInRange(box, pts, leafSize, interiors, leaves,
+			[&](const vec3f& pt, int) { out[respSize++] = pt; return respSize < resps.capPerResponse; });
+	}
+
+	void SearchKernel::searchRangesGroup(int gIdx, int groupSize, int qSize, const RangeQuery* qRanges, const vec3f* pts,
+		int leafSize, const InteriorsRawRepr interiors, const LeavesRawRepr leaves, RangeQueryResponsesRawRepr resps) {
+		int first = gIdx * groupSize;
+		if (first >= qSize) return;
+		int n = std::min({ groupSize, qSize - first, MAX_PREFETCH_GROUP });
+
+		// per query: the leaf whose segment is visited next and the stage of the visit, as in searchPointsGroup
+		int begin[MAX_PREFETCH_GROUP], L[MAX_PREFETCH_GROUP], R[MAX_PREFETCH_GROUP];
+		uint8_t stage[MAX_PREFETCH_GROUP];
+		for (int i = 0; i < n; i++) {
+			begin[i] = 0;
+			stage[i] = 0;
+		}
 
-			// skip if box does not overlap the subtree rooted at L
-			if (L > 0 && L < R) {
-				int parent;
-				bool isRC;
-				decodeParentCode(interiors.parent[L], parent, isRC);
-				splitDim = interiors.splitDim[parent];
-				splitVal = interiors.splitVal[parent];
-				if (box.ptMax[splitDim] < splitVal) {
-					begin = interiors.rangeR[L];
+		auto loadSegment = [&](int i) {
+			L[i] = leaves.segOffset[begin[i]];
+			R[i] = begin[i] == leafSize - 1 ? L[i] : leaves.segOffset[begin[i] + 1];
+		};
+
+		for (int active = n; active > 0;) {
+			for (int i = 0; i < n; i++) {
+				if (stage[i] == 2) continue;
+				if (stage[i] == 0) {
+					if (begin[i] >= leafSize) {
+						stage[i] = 2;
+						--active;
+						continue;
+					}
+					loadSegment(i);
+					prefetch(interiors.parent + L[i]);
+					prefetchSplit(interiors, L[i]);
+					if (interiors.removeState) prefetch(interiors.removeState + L[i]);
+					prefetch(interiors.rangeR + L[i]);
+					if (leaves.replacedBy) prefetch(leaves.replacedBy + begin[i]);
+					prefetch(pts + bucketBegin(leaves, begin[i]));
+					stage[i] = 1;
 					continue;
 				}
-			}
 
-			for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-				bool isRemoved = isInteriorRemoved(interiors.removeState[interiorIdx]); // removed
-				if (!isRemoved) {
-					splitDim = interiors.splitDim[interiorIdx];
-					splitVal = interiors.splitVal[interiorIdx];
+				// visit segments until the traversal jumps away, the next segment is adjacent and likely cached
+				const AABB& box = qRanges[first + i];
+				int& b = begin[i];
+				while (true) {
+					int visited = b;
 
-					onRight = box.ptMin[splitDim] >= splitVal;
-				}
-				onRight = onRight || isRemoved;
+					// skip if box does not overlap the subtree rooted at L
+					bool skipped = false;
+					if (L[i] > 0 && L[i] < R[i]) {
+						int parent;
+						bool isRC;
+						decodeParentCode(interiors.parent[L[i]], parent, isRC);
+						int splitDim;
+						mfloat splitVal;
+						getSplit(interiors, parent, splitDim, splitVal);
+						if (box.ptMax[splitDim] < splitVal) {
+							b = interiors.rangeR[L[i]];
+							skipped = true;
+						}
+					}
 
-				if (onRight) {
-					//begin = interiorIdx < R - 1 && !isRemoved ? interiors.rangeR[interiorIdx + 1] : begin + isRemoved;
-					if (interiorIdx < R - 1 || isRemoved) {
-						begin = interiors.rangeR[interiorIdx + (1 - isRemoved)];
+					bool onRight = false;
+					for (int interiorIdx = L[i]; !skipped && interiorIdx < R[i]; interiorIdx++) {
+						bool isRemoved = isInteriorRemoved(interiors, interiorIdx);
+						if (!isRemoved) {
+							int splitDim;
+							mfloat splitVal;
+							getSplit(interiors, interiorIdx, splitDim, splitVal);
+							onRight = box.ptMin[splitDim] >= splitVal;
+						}
+						onRight = onRight || isRemoved;
+
+						if (onRight) {
+							if (interiorIdx < R[i] - 1 || isRemoved) {
+								b = interiors.rangeR[interiorIdx + (1 - isRemoved)];
+							}
+							break;
+						}
 					}
-					break;
+
+					// hit leaf with index <b>
+					if (!skipped && !onRight && getReplacedBy(leaves, b) >= 0) {
+						auto& respSize = *(resps.getSizePtr(first + i));
+						for (int p = bucketBegin(leaves, b); p < bucketEnd(leaves, b) && respSize < resps.capPerResponse; p++)
+							if (box.include(pts[p])) resps.getBufPtr(first + i)[respSize++] = pts[p];
+						if (respSize >= resps.capPerResponse) {
+							stage[i] = 2;
+							--active;
+							break;
+						}
+					}
+					++b;
+					if (b != visited + 1 || b >= leafSize) {
+						stage[i] = 0;
+						prefetch(leaves.segOffset + b);
+						break;
+					}
+					loadSegment(i);
 				}
 			}
-			if (onRight) continue;
+		}
+	}
 
-			// hit leaf with index <begin>
-			if (leaves.replacedBy[begin] < 0) continue;  // leaf is removed
+	bool SearchKernel::searchRangesByMorton(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+		const LeavesRawRepr leaves, const AABB& gBoundary, int maxSpan, RangeQueryResponsesRawRepr resps) {
+		if (qIdx >= qSize) return true;
+		const AABB& box = qRanges[qIdx];
 
-			const auto& target = pts[begin];
-			if (box.include(target)) {
-				auto& respSize = *(resps.getSizePtr(qIdx));
-				resps.getBufPtr(qIdx)[respSize++] = target;  // note: check correctness on GPU
+		// quantization is monotonic, so every point in the box has its code in the box of the corner codes
+		uint64_t zmin = BuildKernel::calcMortonCode(box.ptMin, gBoundary).code;
+		uint64_t zmax = BuildKernel::calcMortonCode(box.ptMax, gBoundary).code;
+
+		const MortonType* first = leaves.morton;
+		const MortonType* last = leaves.morton + leafSize;
+		auto codeLess = [](const MortonType& m, uint64_t code) { return m.code < code; };
+		int begin = std::lower_bound(first, last, zmin, codeLess) - first;
+		int end = std::upper_bound(first, last, zmax, [](uint64_t code, const MortonType& m) { return code < m.code; }) - first;
+		if (end - begin > maxSpan) return false;
+
+		auto& respSize = *(resps.getSizePtr(qIdx));
+		for (int i = begin; i < end;) {
+			uint64_t code = leaves.morton[i].code;
+			if (!MortonType::inBox(code, zmin, zmax)) {
+				// jump over the part of the interval outside the box
+				i = std::lower_bound(first + i + 1, first + end, MortonType::bigMin(code, zmin, zmax), codeLess) - first;
+				continue;
+			}
+			if (getReplacedBy(leaves, i) == 0 && box.include(pts[i])) {
+				resps.getBufPtr(qIdx)[respSize++] = pts[i];
 				if (respSize >= resps.capPerResponse) break;
 			}
+			++i;
 		}
+		return true;
 	}
 
 	void SearchKernel::searchRanges(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr, int totalLeafSize,
@@ -173,99 +465,168 @@ namespace pmkd {
 		const AABB& box = qRanges[qIdx];
 		if (!boundary.overlap(box)) return;
 
-		// do sprouting
-		int iBatch = 0, localLeafIdx = 0;
-		int mainTreeLeafSize = nodeMgr.sizesAcc[0];
-		
-		int L = 0, R = 0;
-		bool onRight;
-		int interiorIdx = 0;
-		int splitDim;
-		mfloat splitVal;
+		vec3f* out = resps.getBufPtr(qIdx);
+		uint32_t& respSize = *(resps.getSizePtr(qIdx));
+		forEachPointInRange(box, nodeMgr, totalLeafSize,
+			[&](const vec3f& pt, int) { out[respSize++] = pt; return respSize < resps.capPerResponse; });
+	}
 
-		int globalLeafIdx = 0;
-		int state = 0;   // 0: init, 1: deeper, 2: stack return
+	void SearchKernel::searchRangesCompact_step1(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, OUTPUT(uint32_t*) cnt) {
+		if (qIdx >= qSize) return;
+		uint32_t n = 0;
+		forEachPointInRange(qRanges[qIdx], pts, leafSize, interiors, leaves,
+			[&](const vec3f&, int) { ++n; return true; });
+		cnt[qIdx] = n;
+	}
 
-		while (globalLeafIdx < totalLeafSize) {
-			transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+	void SearchKernel::searchRangesCompact_step1(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+		int totalLeafSize, OUTPUT(uint32_t*) cnt) {
+		if (qIdx >= qSize) return;
+		uint32_t n = 0;
+		forEachPointInRange(qRanges[qIdx], nodeMgr, totalLeafSize,
+			[&](const vec3f&, int) { ++n; return true; });
+		cnt[qIdx] = n;
+	}
 
-			const auto& leaves = nodeMgr.leavesBatch[iBatch];
-			const auto& interiors = nodeMgr.interiorsBatch[iBatch];
-			//const auto& treeLocalRangeR = nodeMgr.treeLocalRangeR[iBatch];
+	void SearchKernel::searchRangesCompact_step2(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, INPUT(size_t*) offset, vec3f* buffer) {
+		if (qIdx >= qSize) return;
+		vec3f* out = buffer + offset[qIdx];
+		forEachPointInRange(qRanges[qIdx], pts, leafSize, interiors, leaves,
+			[&](const vec3f& pt, int) { *out++ = pt; return true; });
+	}
 
-			int rBound = iBatch == 0 ? mainTreeLeafSize : leaves.treeLocalRangeR[localLeafIdx];
-			if (state == 2) {
-				globalLeafIdx++;
-				localLeafIdx++;
-			}
-			state = 2;
+	void SearchKernel::searchRangesCompact_step2(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+		int totalLeafSize, INPUT(size_t*) offset, vec3f* buffer) {
+		if (qIdx >= qSize) return;
+		vec3f* out = buffer + offset[qIdx];
+		forEachPointInRange(qRanges[qIdx], nodeMgr, totalLeafSize,
+			[&](const vec3f& pt, int) { *out++ = pt; return true; });
+	}
 
-			int oldLocalLeafIdx = localLeafIdx;
-			for (;localLeafIdx < rBound;globalLeafIdx += ++localLeafIdx - oldLocalLeafIdx) {
-				oldLocalLeafIdx = localLeafIdx;
+	void SearchKernel::searchRangeIndices(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, RangeIndexQueryResponsesRawRepr resps) {
+		if (qIdx >= qSize) return;
+		int* out = resps.getBufPtr(qIdx);
+		uint32_t& respSize = *(resps.getSizePtr(qIdx));
+		forEachPointInRange(qRanges[qIdx], pts, leafSize, interiors, leaves,
+			[&](const vec3f&, int ptIdx) { out[respSize++] = ptIdx; return respSize < resps.capPerResponse; });
+	}
 
-				L = leaves.segOffset[localLeafIdx];
-				R = localLeafIdx == rBound - 1 ? L : leaves.segOffset[localLeafIdx + 1];
+	void SearchKernel::searchRangeIndices(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+		int totalLeafSize, RangeIndexQueryResponsesRawRepr resps) {
+		if (qIdx >= qSize) return;
+		int* out = resps.getBufPtr(qIdx);
+		uint32_t& respSize = *(resps.getSizePtr(qIdx));
+		forEachPointInRange(qRanges[qIdx], nodeMgr, totalLeafSize,
+			[&](const vec3f&, int ptIdx) { out[respSize++] = ptIdx; return respSize < resps.capPerResponse; });
+	}
 
-				
+	void SearchKernel::countRanges(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const AABB& boundary, OUTPUT(uint32_t*) cnt) {
 
-				onRight = false;
-				
-				//if (L < R) {
-				int parentCode = L < R ? interiors.parent[L] : leaves.parent[localLeafIdx];
-					if (parentCode >= 0) {
-						int parent;
-						bool isRC;
-						decodeParentCode(parentCode, parent, isRC);
-						splitDim = interiors.splitDim[parent];
-						splitVal = interiors.splitVal[parent];
-						if (box.ptMax[splitDim] < splitVal) {
-							if (L < R) localLeafIdx = interiors.rangeR[L];
-							continue;
-						}
-					}
-				//}
+		if (qIdx >= qSize) return;
+		CountPolicy policy{ qRanges[qIdx], boundary };
+		traverseSprouting(policy, pts, leafSize, interiors, leaves);
+		cnt[qIdx] = policy.n;
+	}
 
-				for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-					bool isRemoved = isInteriorRemoved(interiors.removeState[interiorIdx]);   // note: judging removaL may not increase performance
-					if (!isRemoved) {
-						splitDim = interiors.splitDim[interiorIdx];
-						splitVal = interiors.splitVal[interiorIdx];
-						onRight = box.ptMin[splitDim] >= splitVal;
-					}
-					onRight = onRight || isRemoved;
+	void SearchKernel::countRanges(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+		int totalLeafSize, const AABB& boundary, OUTPUT(uint32_t*) cnt) {
 
-					if (onRight) {
-						//localLeafIdx = interiorIdx < R - 1 && !isRemoved ? interiors.rangeR[interiorIdx + 1] : localLeafIdx + isRemoved;
-						if (interiorIdx < R - 1 || isRemoved) {
-							localLeafIdx = interiors.rangeR[interiorIdx + (1 - isRemoved)];
-						}
-						break;
-					}
-				}
-				if (!onRight) {
-					int globalSubstitute = leaves.replacedBy[localLeafIdx];
-					if (globalSubstitute == 0) { // this leaf is valid (i.e. not replaced or removed)
-						const auto& target = nodeMgr.ptsBatch[iBatch][localLeafIdx];
-						if (box.include(target)) {
-							auto& respSize = *(resps.getSizePtr(qIdx));
-							resps.getBufPtr(qIdx)[respSize++] = target;  // note: check correctness on GPU
-							if (respSize >= resps.capPerResponse) return;
-						}
-					}
-					else if (globalSubstitute > 0) {
-						// leaf is replaced
-						globalLeafIdx = globalSubstitute;
-						state = 1;
-						break;
-					}
-				}
+		if (qIdx >= qSize) return;
+		CountPolicy policy{ qRanges[qIdx], boundary };
+		traverseSprouting(policy, nodeMgr, totalLeafSize);
+		cnt[qIdx] = policy.n;
+	}
+
+	void SearchKernel::searchRadius(int qIdx, int qSize, const Query* qCenters, const mfloat* qRadii, const vec3f* pts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const AABB& boundary,
+		RangeQueryResponsesRawRepr resps) {
+
+		if (qIdx >= qSize) return;
+		const vec3f& center = qCenters[qIdx];
+		const mfloat radius = qRadii[qIdx];
+		if (radius < 0 || !boundary.overlap(AABB(center - vec3f(radius), center + vec3f(radius)))) return;
+
+		SpherePolicy policy{ center, radius, radius * radius, resps.getBufPtr(qIdx), *(resps.getSizePtr(qIdx)), resps.capPerResponse };
+		traverseSprouting(policy, pts, leafSize, interiors, leaves);
+	}
+
+	void SearchKernel::searchRadius(int qIdx, int qSize, const Query* qCenters, const mfloat* qRadii, const NodeMgrDevice nodeMgr,
+		int totalLeafSize, const AABB& boundary, RangeQueryResponsesRawRepr resps) {
+
+		if (qIdx >= qSize) return;
+		const vec3f& center = qCenters[qIdx];
+		const mfloat radius = qRadii[qIdx];
+		if (radius < 0 || !boundary.overlap(AABB(center - vec3f(radius), center + vec3f(radius)))) return;
+
+		SpherePolicy policy{ center, radius, radius * radius, resps.getBufPtr(qIdx), *(resps.getSizePtr(qIdx)), resps.capPerResponse };
+		traverseSprouting(policy, nodeMgr, totalLeafSize);
+	}
+
+	void SearchKernel::searchKnn(int qIdx, int qSize, const Query* qPts, const vec3f* pts, int leafSize,
+		const InteriorsRawRepr interiors, const LeavesRawRepr leaves, KnnQueryResponsesRawRepr resps) {
+
+		if (qIdx >= qSize) return;
+		const vec3f& pt = qPts[qIdx];
+		const uint32_t k = resps.k;
+		if (k == 0) return;
+
+		int* nbrIdx = resps.getIdxPtr(qIdx);
+		mfloat* nbrDist = resps.getDistPtr(qIdx);
+		uint32_t& nbrSize = *(resps.getSizePtr(qIdx));
+
+		// points are sorted by morton code, so neighbors of the first point found give a tight initial bound
+		LocatePolicy locate{ pt };
+		traverseSprouting(locate, pts, leafSize, interiors, leaves);
+		if (locate.ptIdx >= 0) {
+			int seedL = std::max(0, locate.ptIdx - (int)k);
+			int seedR = std::min(bucketEnd(leaves, leafSize - 1), locate.ptIdx + (int)k + 1);
+			for (int i = seedL; i < seedR; i++) {
+				if (getReplacedBy(leaves, findBucket(leaves, leafSize, i)) < 0) continue;  // leaf is removed
+				insertNeighbor(nbrIdx, nbrDist, nbrSize, k, i, square_norm(pts[i] - pt));
 			}
-			if (state == 2) {
-				// equal to stack return
-				globalLeafIdx = iBatch > 0 ? leaves.derivedFrom[rBound - 1] : totalLeafSize;
+		}
+
+		KnnPolicy policy{ pt, nbrIdx, nbrDist, nbrSize, k };
+		traverseSprouting(policy, pts, leafSize, interiors, leaves);
+	}
+
+	void SearchKernel::searchKnn(int qIdx, int qSize, const Query* qPts, const NodeMgrDevice nodeMgr, int totalLeafSize,
+		KnnQueryResponsesRawRepr resps) {
+
+		if (qIdx >= qSize) return;
+		const vec3f& pt = qPts[qIdx];
+		const uint32_t k = resps.k;
+		if (k == 0) return;
+
+		int* nbrIdx = resps.getIdxPtr(qIdx);
+		mfloat* nbrDist = resps.getDistPtr(qIdx);
+		uint32_t& nbrSize = *(resps.getSizePtr(qIdx));
+
+		LocatePolicy locate{ pt };
+		traverseSprouting(locate, nodeMgr, totalLeafSize);
+		if (locate.ptIdx >= 0) {
+			// points of a batch are sorted by morton code, so neighbors of the point give a tight initial bound
+			int iBatch, localPtIdx;
+			transformPointIdx(locate.ptIdx, nodeMgr, iBatch, localPtIdx);
+			const auto& leaves = nodeMgr.leavesBatch[iBatch];
+			const auto& pts = nodeMgr.ptsBatch[iBatch];
+			int globalOffset = locate.ptIdx - localPtIdx;
+			int batchLeafSize = nodeMgr.sizesAcc[iBatch] - (iBatch > 0 ? nodeMgr.sizesAcc[iBatch - 1] : 0);
+
+			int seedL = std::max(0, localPtIdx - (int)k);
+			int seedR = std::min(bucketEnd(leaves, batchLeafSize - 1), localPtIdx + (int)k + 1);
+			for (int i = seedL; i < seedR; i++) {
+				if (getReplacedBy(leaves, findBucket(leaves, batchLeafSize, i)) != 0) continue;  // leaf is removed or replaced
+				insertNeighbor(nbrIdx, nbrDist, nbrSize, k, globalOffset + i, square_norm(pts[i] - pt));
 			}
 		}
+
+		KnnPolicy policy{ pt, nbrIdx, nbrDist, nbrSize, k };
+		traverseSprouting(policy, nodeMgr, totalLeafSize);
 	}
 
 #ifdef ENABLE_MERKLE
@@ -290,7 +651,7 @@ namespace pmkd {
 		int state = 0;   // 0: init, 1: deeper, 2: stack return
 
 		while (globalLeafIdx < totalLeafSize) {
-			transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+			transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
 
 			const auto& leaves = nodeMgr.leavesBatch[iBatch];
 			const auto& interiors = nodeMgr.interiorsBatch[iBatch];
@@ -318,8 +679,7 @@ namespace pmkd {
 					int parent;
 					bool isRC;
 					decodeParentCode(parentCode, parent, isRC);
-					splitDim = interiors.splitDim[parent];
-					splitVal = interiors.splitVal[parent];
+					getSplit(interiors, parent, splitDim, splitVal);
 					if (box.ptMax[splitDim] < splitVal) {
 						if (L < R) localLeafIdx = interiors.rangeR[L];
 						hc++;
@@ -328,10 +688,9 @@ namespace pmkd {
 				}
 
 				for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-					bool isRemoved = isInteriorRemoved(interiors.removeState[interiorIdx]);   // note: judging removaL may not increase performance
+					bool isRemoved = isInteriorRemoved(interiors, interiorIdx);   // note: judging removaL may not increase performance
 					if (!isRemoved) {
-						splitDim = interiors.splitDim[interiorIdx];
-						splitVal = interiors.splitVal[interiorIdx];
+						getSplit(interiors, interiorIdx, splitDim, splitVal);
 						onRight = box.ptMin[splitDim] >= splitVal;
 
 						mc++;
@@ -349,9 +708,9 @@ namespace pmkd {
 					}
 				}
 				if (!onRight) {
-					int globalSubstitute = leaves.replacedBy[localLeafIdx];
+					int globalSubstitute = getReplacedBy(leaves, localLeafIdx);
 					if (globalSubstitute <= 0) { // this leaf is not replaced
-						fc++;
+						fc += bucketEnd(leaves, localLeafIdx) - bucketBegin(leaves, localLeafIdx);
 					}
 					else {
 						// leaf is replaced
@@ -392,7 +751,7 @@ namespace pmkd {
 		int state = 0;   // 0: init, 1: deeper, 2: stack return
 
 		while (globalLeafIdx < totalLeafSize) {
-			transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+			transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
 			uint32_t globalOffset = globalLeafIdx - localLeafIdx;
 
 			const auto& leaves = nodeMgr.leavesBatch[iBatch];
@@ -421,8 +780,7 @@ namespace pmkd {
 					int parent;
 					bool isRC;
 					decodeParentCode(parentCode, parent, isRC);
-					splitDim = interiors.splitDim[parent];
-					splitVal = interiors.splitVal[parent];
+					getSplit(interiors, parent, splitDim, splitVal);
 					if (box.ptMax[splitDim] < splitVal) {
 						hash_t* _hash;
 						if (L < R) {
@@ -438,10 +796,9 @@ namespace pmkd {
 				}
 
 				for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-					bool isRemoved = isInteriorRemoved(interiors.removeState[interiorIdx]);
+					bool isRemoved = isInteriorRemoved(interiors, interiorIdx);
 					if (!isRemoved) {
-						splitDim = interiors.splitDim[interiorIdx];
-						splitVal = interiors.splitVal[interiorIdx];
+						getSplit(interiors, interiorIdx, splitDim, splitVal);
 						onRight = box.ptMin[splitDim] >= splitVal;
 
 						mNodes.fromInterior(interiors, mi++, interiorIdx, globalOffset, iBatch);
@@ -471,9 +828,10 @@ namespace pmkd {
 					}
 				}
 				if (!onRight) {
-					int globalSubstitute = leaves.replacedBy[localLeafIdx];
+					int globalSubstitute = getReplacedBy(leaves, localLeafIdx);
 					if (globalSubstitute <= 0) { // this leaf is not replaced
-						fNodes.fromLeaf(leaves, nodeMgr.ptsBatch[iBatch], fi++, localLeafIdx, globalOffset);
+						for (int p = bucketBegin(leaves, localLeafIdx); p < bucketEnd(leaves, localLeafIdx); p++)
+							fNodes.fromLeaf(leaves, nodeMgr.ptsBatch[iBatch], fi++, localLeafIdx, p, globalOffset);
 					}
 					else {
 						// leaf is replaced
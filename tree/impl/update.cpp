@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <common/util/atomic_ext.h>
 #include <tree/helper.h>
 #include <tree/device_helper.h>
@@ -6,7 +7,7 @@
 namespace pmkd {
 
     void UpdateKernel::findLeafBin(int qIdx, int qSize, const vec3f* qPts, int leafSize,
-        const InteriorsRawRepr interiors, const LeavesRawRepr leaves,
+        const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
         OUTPUT(int*) binIdx) {
 
         if (qIdx >= qSize) return;
@@ -21,8 +22,10 @@ namespace pmkd {
         //int onRight_256[8];
         bool onRight;
 
-        for (int bin = 0; bin < leafSize; bin++) {
-            L = leaves.segOffset[bin];
+        int start, skip;
+        findTraversalStart(jump, startNode, qIdx, pt, leaves, interiors, leafSize, start, skip);
+        for (int bin = start; bin < leafSize; bin++) {
+            L = std::max(leaves.segOffset[bin], skip);
             R = bin == leafSize - 1 ? L : leaves.segOffset[bin + 1];
             onRight = false;
 
@@ -44,8 +47,9 @@ namespace pmkd {
             // }
             //else {
                 for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-                    int splitDim = interiors.splitDim[interiorIdx];
-                    mfloat splitVal = interiors.splitVal[interiorIdx];
+                    int splitDim;
+                    mfloat splitVal;
+                    getSplit(interiors, interiorIdx, splitDim, splitVal);
                     onRight = pt[splitDim] >= splitVal;
                     if (onRight) {
                         break;
@@ -80,8 +84,9 @@ namespace pmkd {
             onRight = false;
 
             for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-                int splitDim = interiors.splitDim[interiorIdx];
-                mfloat splitVal = interiors.splitVal[interiorIdx];
+                int splitDim;
+                mfloat splitVal;
+                getSplit(interiors, interiorIdx, splitDim, splitVal);
                 onRight = pt[splitDim] >= splitVal;
                 if (onRight) {
                     break;
@@ -98,7 +103,7 @@ namespace pmkd {
     }
 
     void UpdateKernel::findLeafBin(int qIdx, int qSize, const vec3f* qPts, int totalLeafSize,
-        const NodeMgrDevice nodeMgr, OUTPUT(int*) binIdx) {
+        const NodeMgrDevice nodeMgr, INPUT(int*) startNode, OUTPUT(int*) binIdx) {
         if (qIdx >= qSize) return;
         const vec3f& pt = qPts[qIdx];
 
@@ -110,9 +115,14 @@ namespace pmkd {
         int interiorIdx = 0;
 
 
-        int globalLeafIdx = 0;
+        int globalLeafIdx, skip;  // skip only applies to the main tree
+        findTraversalStart(nodeMgr.jumpTable, startNode, qIdx, pt, nodeMgr.leavesBatch[0], nodeMgr.interiorsBatch[0],
+            mainTreeLeafSize, globalLeafIdx, skip);
+#ifdef ENABLE_MERKLE
+        markJumpedPath(nodeMgr.leavesBatch[0], nodeMgr.interiorsBatch[0], mainTreeLeafSize, globalLeafIdx, skip);
+#endif
         while (globalLeafIdx < totalLeafSize) {
-            transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
 
             const auto& leaves = nodeMgr.leavesBatch[iBatch];
             auto& interiors = nodeMgr.interiorsBatch[iBatch];
@@ -122,12 +132,13 @@ namespace pmkd {
             while (localLeafIdx < rBound) {
                 int oldLocalLeafIdx = localLeafIdx;
 
-                L = leaves.segOffset[localLeafIdx];
+                L = std::max(leaves.segOffset[localLeafIdx], skip);
                 R = localLeafIdx == rBound - 1 ? L : leaves.segOffset[localLeafIdx + 1];
                 onRight = false;
                 for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-                    int splitDim = interiors.splitDim[interiorIdx];
-                    mfloat splitVal = interiors.splitVal[interiorIdx];
+                    int splitDim;
+                    mfloat splitVal;
+                    getSplit(interiors, interiorIdx, splitDim, splitVal);
                     onRight = pt[splitDim] >= splitVal;
 #ifdef ENABLE_MERKLE
                     setVisitStateTopDown(interiors.visitStateTopDown, interiorIdx, onRight);
@@ -140,13 +151,14 @@ namespace pmkd {
                     }
                 }
                 if (!onRight) {
-                    int globalSubstitute = leaves.replacedBy[localLeafIdx];
+                    int globalSubstitute = getReplacedBy(leaves, localLeafIdx);
                     if (globalSubstitute <= 0) { // this leaf is valid or removed (i.e. not replaced)
                         binIdx[qIdx] = globalLeafIdx;
                         return;
                     }
                     // leaf is replaced
                     globalLeafIdx = globalSubstitute;
+                    skip = 0;
                     break;
                 }
                 ++localLeafIdx;
@@ -155,16 +167,21 @@ namespace pmkd {
         }
     }
 
-    void UpdateKernel::revertRemoval(int qIdx, int qSize, INPUT(int*) binIdx, NodeMgrDevice nodeMgr) {
+    void UpdateKernel::revertRemoval(int qIdx, int qSize, INPUT(int*) binIdx, INPUT(int*) binInsertOffset, int numInserted,
+        NodeMgrDevice nodeMgr) {
         if (qIdx >= qSize) return;
 
         int globalLeafIdx = binIdx[qIdx];
 
+        // the replaced leaf keeps its own state in the new batch, so its ancestors gain the inserted points
+        int numInsertedToBin = (qIdx < qSize - 1 ? binInsertOffset[qIdx + 1] : numInserted) - binInsertOffset[qIdx];
+        propagateLiveCount(globalLeafIdx, numInsertedToBin, nodeMgr);
+
         int mainTreeLeafSize = nodeMgr.sizesAcc[0];
 
         while (true) {
             int iBatch, localLeafIdx;
-            transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
             const auto& leaves = nodeMgr.leavesBatch[iBatch];
             auto& interiors = nodeMgr.interiorsBatch[iBatch];
 
@@ -202,7 +219,7 @@ namespace pmkd {
 
         while (true) {
             int iBatch, localLeafIdx;
-            transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
             const auto& leaves = nodeMgr.leavesBatch[iBatch];
             auto& interiors = nodeMgr.interiorsBatch[iBatch];
 
@@ -227,8 +244,8 @@ namespace pmkd {
                 const hash_t* otherChildHash;
                 getOtherChildHash(leaves, interiors, left, current, rBound, isRC, otherChildHash);
 
-                computeDigest(interiors.hash + current, childHash, otherChildHash,
-                    interiors.splitDim[current], interiors.splitVal[current], interiors.removeState[current].load(std::memory_order_relaxed));
+                computeDigest(interiors.hash + current, isRC ? otherChildHash : childHash, isRC ? childHash : otherChildHash,
+                    getSplitDim(interiors, current), getSplitVal(interiors, current), interiors.removeState[current].load(std::memory_order_relaxed));
 
                 childHash = interiors.hash + current;
 
@@ -242,13 +259,44 @@ namespace pmkd {
             if (current != parent || iBatch == 0) break;  // does not reach sub root, or main root visited
 
             globalLeafIdx = leaves.derivedFrom[localLeafIdx];
+
+            // a replaced leaf stands for the subtree replacing it
+            int subBatch, subLeafIdx;
+            transformLeafIdx(globalLeafIdx, nodeMgr, subBatch, subLeafIdx);
+            nodeMgr.leavesBatch[subBatch].hash[subLeafIdx] = interiors.hash[current];
+        }
+    }
+
+    void UpdateKernel::markDirtyPath(int idx, int size, INPUT(int*) leafIdx, NodeMgrDevice nodeMgr) {
+        if (idx >= size) return;
+
+        int globalLeafIdx = leafIdx[idx];
+
+        while (true) {
+            int iBatch, localLeafIdx;
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
+            const auto& leaves = nodeMgr.leavesBatch[iBatch];
+            auto& interiors = nodeMgr.interiorsBatch[iBatch];
+
+            int parent;
+            bool isRC;
+            int parentCode = leaves.parent[localLeafIdx];
+            while (parentCode >= 0) {
+                decodeParentCode(parentCode, parent, isRC);
+                setVisitStateTopDown(interiors.visitStateTopDown, parent, isRC);
+                parentCode = interiors.parent[parent];
+            }
+            if (iBatch == 0) break;  // main root marked
+
+            globalLeafIdx = leaves.derivedFrom[localLeafIdx];
         }
     }
 #endif
 
 
     void UpdateKernel::removePoints_step1(int rIdx, int rSize, const vec3f* rPts, const vec3f* pts, int leafSize,
-        InteriorsRawRepr interiors, LeavesRawRepr leaves, OUTPUT(int*) binIdx) {
+        InteriorsRawRepr interiors, LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
+        OUTPUT(int*) binIdx) {
         
         if (rIdx >= rSize) return;
         const vec3f& pt = rPts[rIdx];
@@ -257,13 +305,19 @@ namespace pmkd {
         int L = 0, R = 0;
         bool onRight;
         int interiorIdx = 0;
-        for (int begin = 0; begin < leafSize; begin++) {
-            L = leaves.segOffset[begin];
+        int start, skip;
+        findTraversalStart(jump, startNode, rIdx, pt, leaves, interiors, leafSize, start, skip);
+#ifdef ENABLE_MERKLE
+        markJumpedPath(leaves, interiors, leafSize, start, skip);
+#endif
+        for (int begin = start; begin < leafSize; begin++) {
+            L = std::max(leaves.segOffset[begin], skip);
             R = begin == leafSize - 1 ? L : leaves.segOffset[begin + 1];
             onRight = false;
             for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-                int splitDim = interiors.splitDim[interiorIdx];
-                mfloat splitVal = interiors.splitVal[interiorIdx];
+                int splitDim;
+                mfloat splitVal;
+                getSplit(interiors, interiorIdx, splitDim, splitVal);
                 onRight = pt[splitDim] >= splitVal;
 
 #ifdef ENABLE_MERKLE
@@ -278,7 +332,9 @@ namespace pmkd {
             }
             if (!onRight) {
                 // hit leaf with index <begin>
-                leaves.replacedBy[begin] = -1;  // mark as removed. Note: need to recompute leaf hash
+                // mark as removed. Note: need to recompute leaf hash
+                if (std::atomic_ref<int>(leaves.replacedBy[begin]).exchange(-1, std::memory_order_relaxed) == 0)
+                    propagateLiveCount(begin, -1, leaves, interiors);
                 binIdx[rIdx] = begin;
                 break;
             }
@@ -286,7 +342,7 @@ namespace pmkd {
     }
 
     void UpdateKernel::removePoints_step1(int rIdx, int rSize, const vec3f* rPts, const NodeMgrDevice nodeMgr,
-        int totalLeafSize, OUTPUT(int*) binIdx) {
+        int totalLeafSize, INPUT(int*) startNode, OUTPUT(int*) binIdx) {
 
         if (rIdx >= rSize) return;
         const vec3f& pt = rPts[rIdx];
@@ -299,9 +355,14 @@ namespace pmkd {
         int interiorIdx = 0;
 
 
-        int globalLeafIdx = 0;
+        int globalLeafIdx, skip;  // skip only applies to the main tree
+        findTraversalStart(nodeMgr.jumpTable, startNode, rIdx, pt, nodeMgr.leavesBatch[0], nodeMgr.interiorsBatch[0],
+            mainTreeLeafSize, globalLeafIdx, skip);
+#ifdef ENABLE_MERKLE
+        markJumpedPath(nodeMgr.leavesBatch[0], nodeMgr.interiorsBatch[0], mainTreeLeafSize, globalLeafIdx, skip);
+#endif
         while (globalLeafIdx < totalLeafSize) {
-            transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
 
             const auto& leaves = nodeMgr.leavesBatch[iBatch];
             auto& interiors = nodeMgr.interiorsBatch[iBatch];
@@ -312,12 +373,13 @@ namespace pmkd {
             while (localLeafIdx < rBound) {
                 int oldLocalLeafIdx = localLeafIdx;
 
-                L = leaves.segOffset[localLeafIdx];
+                L = std::max(leaves.segOffset[localLeafIdx], skip);
                 R = localLeafIdx == rBound - 1 ? L : leaves.segOffset[localLeafIdx + 1];
                 onRight = false;
                 for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-                    int splitDim = interiors.splitDim[interiorIdx];
-                    mfloat splitVal = interiors.splitVal[interiorIdx];
+                    int splitDim;
+                    mfloat splitVal;
+                    getSplit(interiors, interiorIdx, splitDim, splitVal);
                     onRight = pt[splitDim] >= splitVal;
 
 #ifdef ENABLE_MERKLE
@@ -332,12 +394,15 @@ namespace pmkd {
                 if (!onRight) {
                     int globalSubstitute = leaves.replacedBy[localLeafIdx];
                     if (globalSubstitute <= 0) { // this leaf is valid or removed (i.e. not replaced)
-                        leaves.replacedBy[localLeafIdx] = -1;  // mark as removed. Note: need to recompute leaf hash
+                        // mark as removed. Note: need to recompute leaf hash
+                        if (std::atomic_ref<int>(leaves.replacedBy[localLeafIdx]).exchange(-1, std::memory_order_relaxed) == 0)
+                            propagateLiveCount(globalLeafIdx, -1, nodeMgr);
                         binIdx[rIdx] = globalLeafIdx;
                         return;
                     }
                     // leaf is replaced
                     globalLeafIdx = globalSubstitute;
+                    skip = 0;
                     break;
                 }
                 ++localLeafIdx;
@@ -372,8 +437,8 @@ namespace pmkd {
             const hash_t* otherChildHash;
             getOtherChildHash(leaves, interiors, left, current, leafSize, isRC, otherChildHash);
 
-            computeDigest(interiors.hash + current, childHash, otherChildHash,
-                interiors.splitDim[current], interiors.splitVal[current], interiors.removeState[current].load(std::memory_order_relaxed));
+            computeDigest(interiors.hash + current, isRC ? otherChildHash : childHash, isRC ? childHash : otherChildHash,
+                getSplitDim(interiors, current), getSplitVal(interiors, current), interiors.removeState[current].load(std::memory_order_relaxed));
 
             if (current == 0) break; // root
 
@@ -402,11 +467,11 @@ namespace pmkd {
         int globalLeafIdx = binIdx[rIdx];
 
         int mainTreeLeafSize = nodeMgr.sizesAcc[0];
-        bool prevRemoved = false;
+        bool prevRemoved = true;  // the leaf itself is removed
 
         while (true) {
             int iBatch, localLeafIdx;
-            transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
             const auto& leaves = nodeMgr.leavesBatch[iBatch];
             auto& interiors = nodeMgr.interiorsBatch[iBatch];
 
@@ -439,8 +504,8 @@ namespace pmkd {
                 const hash_t* otherChildHash;
                 getOtherChildHash(leaves, interiors, left, current, rBound, isRC, otherChildHash);
 
-                computeDigest(interiors.hash + current, childHash, otherChildHash,
-                    interiors.splitDim[current], interiors.splitVal[current], interiors.removeState[current].load(std::memory_order_relaxed));
+                computeDigest(interiors.hash + current, isRC ? otherChildHash : childHash, isRC ? childHash : otherChildHash,
+                    getSplitDim(interiors, current), getSplitVal(interiors, current), interiors.removeState[current].load(std::memory_order_relaxed));
 
                 childHash = interiors.hash + current;
 #endif
@@ -459,9 +524,66 @@ namespace pmkd {
             if (current != parent || iBatch == 0) break;  // does not reach sub root, or main root visited
 
             globalLeafIdx = leaves.derivedFrom[localLeafIdx];
+#ifdef ENABLE_MERKLE
+            // the replaced leaf takes the hash and the removal of its subtree
+            prevRemoved = isInteriorRemoved(interiors.removeState[current]);
+            int subBatch, subLeafIdx;
+            transformLeafIdx(globalLeafIdx, nodeMgr, subBatch, subLeafIdx);
+            nodeMgr.leavesBatch[subBatch].hash[subLeafIdx] = interiors.hash[current];
+#endif
         }
     }
 
+#ifdef ENABLE_MERKLE
+    void UpdateKernel::propagateRemoval(int rIdx, int rSize, INPUT(int*) binIdx, const LeavesRawRepr leaves,
+        InteriorsRawRepr interiors) {
+        if (rIdx >= rSize) return;
+        int idx = binIdx[rIdx];
+
+        bool isRC;
+        int parent;
+        decodeParentCode(leaves.parent[idx], parent, isRC);
+
+        while (setCheckRemoveStateBottomUp(interiors.removeState[parent], isRC))
+        {
+            if (parent == 0) break; // root
+
+            decodeParentCode(interiors.parent[parent], parent, isRC);
+        }
+    }
+
+    void UpdateKernel::propagateRemoval(int rIdx, int rSize, INPUT(int*) binIdx, NodeMgrDevice nodeMgr) {
+        if (rIdx >= rSize) return;
+        int globalLeafIdx = binIdx[rIdx];
+
+        while (true) {
+            int iBatch, localLeafIdx;
+            transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
+            const auto& leaves = nodeMgr.leavesBatch[iBatch];
+            auto& interiors = nodeMgr.interiorsBatch[iBatch];
+
+            bool isRC;
+            int parent;
+            decodeParentCode(leaves.parent[localLeafIdx], parent, isRC);
+
+            int current = -2;
+            while (setCheckRemoveStateBottomUp(interiors.removeState[parent], isRC))
+            {
+                current = parent;
+
+                int parentCode = interiors.parent[current];
+                if (parentCode < 0) {
+                    break;
+                }
+                decodeParentCode(parentCode, parent, isRC);
+            }
+            if (current != parent || iBatch == 0) break;  // does not reach sub root, or main root visited
+
+            globalLeafIdx = leaves.derivedFrom[localLeafIdx];
+        }
+    }
+#endif
+
     // removal v2
     void UpdateKernel::removePoints_v2_step1(int rIdx, int rSize, const vec3f* rPts, const vec3f* pts, int leafSize,
         InteriorsRawRepr interiors, LeavesRawRepr leaves) {
@@ -477,8 +599,9 @@ namespace pmkd {
             R = begin == leafSize - 1 ? L : leaves.segOffset[begin + 1];
             onRight = false;
             for (interiorIdx = L; interiorIdx < R; interiorIdx++) {
-                int splitDim = interiors.splitDim[interiorIdx];
-                mfloat splitVal = interiors.splitVal[interiorIdx];
+                int splitDim;
+                mfloat splitVal;
+                getSplit(interiors, interiorIdx, splitDim, splitVal);
                 onRight = pt[splitDim] >= splitVal;
 
 
@@ -503,12 +626,13 @@ namespace pmkd {
         int globalLeafIdx = binIdx[rIdx];
 
         int iBatch, localLeafIdx;
-        transformLeafIdx(globalLeafIdx, nodeMgr.sizesAcc, nodeMgr.numBatches, iBatch, localLeafIdx);
+        transformLeafIdx(globalLeafIdx, nodeMgr, iBatch, localLeafIdx);
         auto& leaves = nodeMgr.leavesBatch[iBatch];
         const auto& pts = nodeMgr.ptsBatch[iBatch];
 
-        computeDigest(leaves.hash + localLeafIdx,
-            pts[localLeafIdx].x, pts[localLeafIdx].y, pts[localLeafIdx].z, leaves.replacedBy[localLeafIdx] == -1);
+        int begin = bucketBegin(leaves, localLeafIdx);
+        computeBucketDigest(leaves.hash + localLeafIdx, pts + begin, bucketEnd(leaves, localLeafIdx) - begin,
+            leaves.replacedBy[localLeafIdx] == -1);
     }
 #endif
 }
\ No newline at end of file
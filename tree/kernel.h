@@ -27,7 +27,7 @@ namespace pmkd {
 			OUTPUT(MortonType*) morton);
 		
 		static void calcBuildMetrics(int idx, int interiorSize, const AABB& gBoundary, INPUT(MortonType*) morton,
-			OUTPUT(uint8_t*) metrics, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal);
+			OUTPUT(uint8_t*) metrics, InteriorsRawRepr interiors);
 
 		static void buildInteriors(int idx, int leafSize, const LeavesRawRepr leaves,
 			InteriorsRawRepr interiors, BuildAid aid);
@@ -40,12 +40,15 @@ namespace pmkd {
 		static void calcInteriorNewIdx(int idx, int size, const LeavesRawRepr leaves, const InteriorsRawRepr interiors,
 			INPUT(int*) segLen, INPUT(int*) leftLeafCount, OUTPUT(int*) mapidx);
 
-		// in place
+		// writes the ranges, split planes and parents of reordered
 		static void reorderInteriors(int idx, int interiorSize, INPUT(int*) mapidx, const InteriorsRawRepr interiors,
-			OUTPUT(int*) rangeL, OUTPUT(int*) rangeR, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal, OUTPUT(int*) parent);
+			InteriorsRawRepr reordered);
 
 		static void remapLeafParents(int idx, int leafSize, INPUT(int*) mapidx, LeavesRawRepr leaves);
 
+		// validAcc: exclusive scan of the points of valid leaves, sized leafSize + 1
+		static void calcLiveCount(int idx, int interiorSize, INPUT(int*) validAcc, InteriorsRawRepr interiors);
+
 #ifdef ENABLE_MERKLE
 		static void calcLeafHash(int idx, int size, INPUT(vec3f*) pts, INPUT(int*) removeFlag, OUTPUT(hash_t*) leafHash);
 
@@ -53,6 +56,20 @@ namespace pmkd {
 
 		static void calcInteriorHash(int idx, int leafSize, const LeavesRawRepr leaves,
 			InteriorsRawRepr interiors, OUTPUT(AtomicCount*) visitCount);
+
+		// hashes leaves [groupIdx * DIGEST_LANES, groupIdx * DIGEST_LANES + DIGEST_LANES) together
+		// removeFlag may be null when no leaf is removed
+		static void calcLeafHashGroup(int groupIdx, int size, INPUT(vec3f*) pts, INPUT(int*) removeFlag,
+			OUTPUT(hash_t*) leafHash);
+
+		// height of an interior is 1 + the larger height of its children, leaves are of height 0
+		// height must be zero-initialized, visitCount is the one left by buildInteriors
+		static void calcInteriorHeight(int idx, int leafSize, const LeavesRawRepr leaves,
+			const InteriorsRawRepr interiors, OUTPUT(AtomicCount*) visitCount, OUTPUT(int*) height);
+
+		// hashes a group of interiors of the same height, their children are hashed already
+		static void calcInteriorHashGroup(int groupIdx, int size, INPUT(int*) nodes, int leafSize,
+			const LeavesRawRepr leaves, InteriorsRawRepr interiors);
 #endif
 	};
 
@@ -60,7 +77,7 @@ namespace pmkd {
 	struct DynamicBuildKernel {
 		static void calcBuildMetrics(int idx, int interiorRealSize, const AABB& gBoundary,
 			INPUT(MortonType*) morton, INPUT(int*) interiorToLeafIdx,
-			OUTPUT(uint8_t*) metrics, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal);
+			OUTPUT(uint8_t*) metrics, InteriorsRawRepr interiors);
 
 		static void buildInteriors(int idx, int batchLeafSize, INPUT(int*) localRangeL, const LeavesRawRepr leaves,
 			InteriorsRawRepr interiors, BuildAid aid);
@@ -73,7 +90,7 @@ namespace pmkd {
 			INPUT(int*) segLen, INPUT(int*) leftLeafCount, OUTPUT(int*) mapidx);
 
 		static void reorderInteriors(int idx, int batchInteriorSize, INPUT(int*) mapidx, const InteriorsRawRepr interiors,
-			OUTPUT(int*) rangeL, OUTPUT(int*) rangeR, OUTPUT(int*) splitDim, OUTPUT(mfloat*) splitVal, OUTPUT(int*) parent);
+			InteriorsRawRepr reordered);
 
 		static void remapLeafParents(int idx, int batchLeafSize, INPUT(int*) mapidx, LeavesRawRepr leaves);
 
@@ -94,12 +111,32 @@ namespace pmkd {
 	};
 
 
+	// most queries a worker interleaves in the group prefetching traversals
+	constexpr int MAX_PREFETCH_GROUP = 32;
+
 	struct SearchKernel {
 		static void searchPoints(int qIdx, int qSize, const Query* qPts, const vec3f* pts, int leafSize,
-			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const AABB& boundary, uint8_t* exist);
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
+			const AABB& boundary, uint8_t* exist);
 
 		static void searchPoints(int qIdx, int qSize, const Query* qPts, const NodeMgrDevice nodeMgr, int totalLeafSize,
-			const AABB& boundary, uint8_t* exist);
+			INPUT(int*) startNode, const AABB& boundary, uint8_t* exist);
+
+		// group prefetching: queries [gIdx * groupSize, (gIdx + 1) * groupSize) are traversed in turns, one segment
+		// at a time, and the memory of each query's next segment is prefetched while the others run
+		static void searchPointsGroup(int gIdx, int groupSize, int qSize, const Query* qPts, const vec3f* pts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
+			uint8_t* exist);
+
+		// descend the main tree with packets of PACKET_SIZE consecutive (sorted) queries until their paths split
+		// startNode of each query is where the traversal of its packet stopped, ready for the traversal kernels
+		static void findPacketStarts(int pIdx, int qSize, const vec3f* qPts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump,
+			OUTPUT(int*) startNode);
+
+		// exact match among the leaves with the same morton code, rank is the first leaf with code >= the query's
+		static void searchPointsByRank(int qIdx, int qSize, const Query* qPts, const MortonType* qMorton, INPUT(int*) rank,
+			const vec3f* pts, int leafSize, const LeavesRawRepr leaves, uint8_t* exist);
 
 		static void searchRanges(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
 			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const AABB& boundary,
@@ -108,6 +145,55 @@ namespace pmkd {
 		static void searchRanges(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr, int totalLeafSize,
 			const AABB& boundary, RangeQueryResponsesRawRepr resps);
 
+		// group prefetching version of searchRanges on a static tree, see searchPointsGroup
+		static void searchRangesGroup(int gIdx, int groupSize, int qSize, const RangeQuery* qRanges, const vec3f* pts,
+			int leafSize, const InteriorsRawRepr interiors, const LeavesRawRepr leaves, RangeQueryResponsesRawRepr resps);
+
+		// scan the leaves whose morton codes fall in the box's z-order interval, skipping gaps with BIGMIN
+		// returns false without searching when the interval holds more than maxSpan leaves
+		static bool searchRangesByMorton(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+			const LeavesRawRepr leaves, const AABB& gBoundary, int maxSpan, RangeQueryResponsesRawRepr resps);
+
+		// count-then-fill range search producing exact, compactly stored responses
+		static void searchRangesCompact_step1(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, OUTPUT(uint32_t*) cnt);
+
+		static void searchRangesCompact_step1(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+			int totalLeafSize, OUTPUT(uint32_t*) cnt);
+
+		static void searchRangesCompact_step2(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, INPUT(size_t*) offset, vec3f* buffer);
+
+		static void searchRangesCompact_step2(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+			int totalLeafSize, INPUT(size_t*) offset, vec3f* buffer);
+
+		// same as searchRanges, but output global leaf indices
+		static void searchRangeIndices(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, RangeIndexQueryResponsesRawRepr resps);
+
+		static void searchRangeIndices(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+			int totalLeafSize, RangeIndexQueryResponsesRawRepr resps);
+
+		// number of valid points inside each range, without collecting them
+		static void countRanges(int qIdx, int qSize, const RangeQuery* qRanges, const vec3f* pts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const AABB& boundary, OUTPUT(uint32_t*) cnt);
+
+		static void countRanges(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr,
+			int totalLeafSize, const AABB& boundary, OUTPUT(uint32_t*) cnt);
+
+		static void searchRadius(int qIdx, int qSize, const Query* qCenters, const mfloat* qRadii, const vec3f* pts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const AABB& boundary,
+			RangeQueryResponsesRawRepr resps);
+
+		static void searchRadius(int qIdx, int qSize, const Query* qCenters, const mfloat* qRadii, const NodeMgrDevice nodeMgr,
+			int totalLeafSize, const AABB& boundary, RangeQueryResponsesRawRepr resps);
+
+		static void searchKnn(int qIdx, int qSize, const Query* qPts, const vec3f* pts, int leafSize,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, KnnQueryResponsesRawRepr resps);
+
+		static void searchKnn(int qIdx, int qSize, const Query* qPts, const NodeMgrDevice nodeMgr, int totalLeafSize,
+			KnnQueryResponsesRawRepr resps);
+
 #ifdef ENABLE_MERKLE
 		static void searchRangesVerifiable_step1(int qIdx, int qSize, const RangeQuery* qRanges, const NodeMgrDevice nodeMgr, int totalLeafSize,
 			OUTPUT(int*) fCnt, OUTPUT(int*) mCnt, OUTPUT(int*) hCnt);
@@ -121,7 +207,7 @@ namespace pmkd {
 	struct UpdateKernel {
 		// for insertion
 		static void findLeafBin(int qIdx, int qSize, const vec3f* qPts, int leafSize,
-			const InteriorsRawRepr interiors, const LeavesRawRepr leaves,
+			const InteriorsRawRepr interiors, const LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
 			OUTPUT(int*) binIdx);
 
 		static void findLeafBin(int qIdx, int qSize, const vec3f* qPts, int leafSize,
@@ -129,19 +215,25 @@ namespace pmkd {
 			OUTPUT(int*) binIdx, std::atomic<int>* maxBin);
 
 		static void findLeafBin(int qIdx, int qSize, const vec3f* qPts, int totalLeafSize,
-			const NodeMgrDevice nodeMgr, OUTPUT(int*) binIdx);
+			const NodeMgrDevice nodeMgr, INPUT(int*) startNode, OUTPUT(int*) binIdx);
 
-		static void revertRemoval(int qIdx, int qSize, INPUT(int*) binIdx, NodeMgrDevice nodeMgr);
+		// binInsertOffset: exclusive scan of the number of points inserted into each bin
+		static void revertRemoval(int qIdx, int qSize, INPUT(int*) binIdx, INPUT(int*) binInsertOffset, int numInserted,
+			NodeMgrDevice nodeMgr);
 #ifdef ENABLE_MERKLE
-		// depricated
+		// recompute the hashes on the marked paths bottom-up from the given leaves, whose hashes are up to date
 		static void updateMerkleHash(int mIdx, int mSize, INPUT(int*) mixOpBinIdx, NodeMgrDevice nodeMgr);
+
+		// mark the paths from the main tree root down to the given leaves for updateMerkleHash
+		static void markDirtyPath(int idx, int size, INPUT(int*) leafIdx, NodeMgrDevice nodeMgr);
 #endif
 		// for removal
 		static void removePoints_step1(int rIdx, int rSize, const vec3f* rPts, const vec3f* pts, int leafSize,
-			InteriorsRawRepr interiors, LeavesRawRepr leaves, OUTPUT(int*) binIdx);
+			InteriorsRawRepr interiors, LeavesRawRepr leaves, const JumpTableDevice& jump, INPUT(int*) startNode,
+			OUTPUT(int*) binIdx);
 
 		static void removePoints_step1(int rIdx, int rSize, const vec3f* rPts, const NodeMgrDevice nodeMgr,
-			int totalLeafSize, OUTPUT(int*) binIdx);
+			int totalLeafSize, INPUT(int*) startNode, OUTPUT(int*) binIdx);
 
 #ifdef ENABLE_MERKLE
 		static void calcSelectedLeafHash(int rIdx, int rSize, INPUT(int*) binIdx,
@@ -153,11 +245,30 @@ namespace pmkd {
 		
 		static void removePoints_step2(int rIdx, int rSize, INPUT(int*) binIdx,	NodeMgrDevice nodeMgr);
 
+#ifdef ENABLE_MERKLE
+		// removePoints_step2 without hash updates, for lazy Merkle maintenance
+		static void propagateRemoval(int rIdx, int rSize, INPUT(int*) binIdx, const LeavesRawRepr leaves,
+			InteriorsRawRepr interiors);
+
+		static void propagateRemoval(int rIdx, int rSize, INPUT(int*) binIdx, NodeMgrDevice nodeMgr);
+#endif
+
 		// removal v2
 		static void removePoints_v2_step1(int rIdx, int rSize, const vec3f* rPts, const vec3f* pts, int leafSize,
 			InteriorsRawRepr interiors, LeavesRawRepr leaves);
 	};
 
+	struct BucketKernel {
+		// boundary idx lies between sorted leaves idx and idx + 1, it bounds a bucket iff the radix tree node splitting
+		// there covers more than bucketSize leaves, so every bucket is a whole subtree and keeps its split planes valid
+		static void markBucketBounds(int idx, int size, INPUT(uint8_t*) metrics, int bucketSize, OUTPUT(uint8_t*) isBound);
+
+#ifdef ENABLE_MERKLE
+		// see computeBucketDigest
+		static void calcBucketHash(int idx, int size, INPUT(vec3f*) pts, INPUT(int*) bucketOffset, OUTPUT(hash_t*) leafHash);
+#endif
+	};
+
 	struct VerifyKernel {
 
 	};
@@ -62,7 +62,7 @@ namespace pmkd {
 			return 32 - clz32(mc1.code ^ mc2.code);
 		}
 
-		static inline void calcSplit(uint8_t metric, Morton<32> rm, const vec3f& ptMin, const vec3f& ptMax,
+		static inline void calcSplit(uint8_t metric, const Morton<32>& rm, const vec3f& ptMin, const vec3f& ptMax,
 			int* splitDim, mfloat* splitVal) {
 
 			metric = 32 - metric;
@@ -123,21 +123,70 @@ namespace pmkd {
 			return 64 - clz64(mc1.code ^ mc2.code);
 		}
 
-		static inline void calcSplit(uint8_t metric, Morton<64> rm, const vec3f& ptMin, const vec3f& ptMax,
-			int* splitDim, mfloat* splitVal) {
+		// bits of the code holding coordinate dim (0: z, 1: y, 2: x)
+		static constexpr uint64_t dimMask(int dim) { return 0x1249249249249249ull << dim; }
+
+		// whether code lies in the box spanned by the codes of its min and max corners
+		static inline bool inBox(uint64_t code, uint64_t zmin, uint64_t zmax) {
+			for (int dim = 0; dim < 3; dim++) {
+				uint64_t m = dimMask(dim);
+				if ((code & m) < (zmin & m) || (code & m) > (zmax & m)) return false;
+			}
+			return true;
+		}
+
+		// BIGMIN: smallest code greater than code inside the box [zmin, zmax], code must be outside the box
+		// Tropf & Herzog, multidimensional range search in dynamically balanced trees
+		static inline uint64_t bigMin(uint64_t code, uint64_t zmin, uint64_t zmax) {
+			uint64_t result = ~0ull;
+			for (int bit = 62; bit >= 0; bit--) {
+				uint64_t b = 1ull << bit;
+				uint64_t lower = dimMask(bit % 3) & (b - 1);
+				int c = (code & b) ? 1 : 0, lo = (zmin & b) ? 1 : 0, hi = (zmax & b) ? 1 : 0;
+				if (!c && !lo && hi) {
+					result = (zmin | b) & ~lower;
+					zmax = (zmax & ~b) | lower;
+				}
+				else if (!c && lo && hi) {
+					return zmin;
+				}
+				else if (c && !lo && !hi) {
+					return result;
+				}
+				else if (c && !lo && hi) {
+					zmin = (zmin | b) & ~lower;
+				}
+			}
+			return result;
+		}
+
+		// bits of the split value's fraction of the boundary, see calcSplitCode
+		static constexpr int SPLIT_FRAC_BITS = 22;
 
+		// split plane packed as (numerator << 2) | dim, its value lies numerator / 2^SPLIT_FRAC_BITS of the way
+		// from ptMin[dim] to ptMax[dim] of the boundary
+		static inline int calcSplitCode(uint8_t metric, const Morton<64>& rm) {
 			metric = 64 - metric - 1;
 			int dim = metric % 3;
-			*splitDim = dim;
-			mfloat val = 0;
-			mfloat x = 0.5;
+			uint32_t num = 0;
 			for (int i = 1; i <= metric / 3 + 1; ++i) {
 				int idx = 3 * (i - 1) + dim;
-				val += ((rm.code >> (62 - idx)) & 1) * x;
-				x /= 2;
+				if (idx <= 62) num |= uint32_t((rm.code >> (62 - idx)) & 1) << (SPLIT_FRAC_BITS - i);
 			}
-			val = val * (ptMax[dim] - ptMin[dim]) + ptMin[dim];
-			*splitVal = val;
+			return int(num << 2) | dim;
+		}
+
+		// the fraction is exact in mfloat, so decoding reproduces the value of calcSplit bit for bit
+		static inline void decodeSplit(int code, const vec3f& ptMin, const vec3f& ptMax, int* splitDim, mfloat* splitVal) {
+			int dim = code & 3;
+			*splitDim = dim;
+			mfloat val = mfloat(code >> 2) / mfloat(1 << SPLIT_FRAC_BITS);
+			*splitVal = val * (ptMax[dim] - ptMin[dim]) + ptMin[dim];
+		}
+
+		static inline void calcSplit(uint8_t metric, const Morton<64>& rm, const vec3f& ptMin, const vec3f& ptMax,
+			int* splitDim, mfloat* splitVal) {
+			decodeSplit(calcSplitCode(metric, rm), ptMin, ptMax, splitDim, splitVal);
 		}
 
 		static inline void calcSplit(uint8_t metric, const vec3f& pt, int* splitDim, mfloat* splitVal) {
@@ -4,13 +4,19 @@
 #include <vector>
 
 #include <morton.h>
-#include <auth/sha.h>
+#include <auth/digest.h>
+#include <common/geometry/aabb.h>
 
 
+#ifndef PMKD_PAYLOAD_TYPE
+#define PMKD_PAYLOAD_TYPE uint64_t
+#endif
+
 namespace pmkd {
 	
 	using MortonType = Morton<64>;
 	using TreeIdx = uint32_t;
+	using Payload = PMKD_PAYLOAD_TYPE;  // user value stored with each point, e.g. a record id
 
 	template<typename T>
 	//using vector = parlay::sequence<T>;
@@ -24,10 +30,10 @@ namespace pmkd {
 	};
 	// using atomic_t = std::atomic<int>;
 	using atomic_t = std::atomic_uint8_t;
-	using hash_t = sha256_t;
 
 
 	using BottomUpState = atomic_t;
+	using LiveCount = std::atomic<int>;
 
 	struct TopDownStates {
 		uint8_t* __restrict_arr child[2];
@@ -42,6 +48,7 @@ namespace pmkd {
 		int* __restrict_arr treeLocalRangeR;
 		int* __restrict_arr replacedBy;
 		int* __restrict_arr derivedFrom;
+		int* __restrict_arr bucketOffset;  // null if each leaf holds one point
 #ifdef ENABLE_MERKLE
 		hash_t* __restrict_arr hash;
 #endif
@@ -50,11 +57,17 @@ namespace pmkd {
 	struct InteriorsRawRepr {
 		int* __restrict_arr rangeL;
 		int* __restrict_arr rangeR;
+#ifdef COMPACT_INTERIORS
+		int* __restrict_arr split;  // see MortonType::calcSplitCode
+		AABB boundary;              // the split codes are relative to
+#else
 		int* __restrict_arr splitDim;
 		mfloat* __restrict_arr splitVal;
+#endif
 		int* __restrict_arr parent;
 		// for dynamic tree
 		BottomUpState* __restrict_arr removeState;
+		LiveCount* __restrict_arr liveCount;
 #ifdef ENABLE_MERKLE
 		BottomUpState* __restrict_arr visitState;
 		TopDownStates visitStateTopDown;
@@ -62,6 +75,56 @@ namespace pmkd {
 #endif
 	};
 
+	// split plane of interior idx
+	inline void getSplit(const InteriorsRawRepr& interiors, int idx, int& dim, mfloat& val) {
+#ifdef COMPACT_INTERIORS
+		MortonType::decodeSplit(interiors.split[idx], interiors.boundary.ptMin, interiors.boundary.ptMax, &dim, &val);
+#else
+		dim = interiors.splitDim[idx];
+		val = interiors.splitVal[idx];
+#endif
+	}
+
+	inline int getSplitDim(const InteriorsRawRepr& interiors, int idx) {
+#ifdef COMPACT_INTERIORS
+		return interiors.split[idx] & 3;
+#else
+		return interiors.splitDim[idx];
+#endif
+	}
+
+	inline mfloat getSplitVal(const InteriorsRawRepr& interiors, int idx) {
+		int dim;
+		mfloat val;
+		getSplit(interiors, idx, dim, val);
+		return val;
+	}
+
+	// set the split plane of interior idx from its metric and the morton code of the first leaf on its right
+	inline void setSplit(InteriorsRawRepr& interiors, int idx, uint8_t metric, const MortonType& rm, const AABB& gBoundary) {
+#ifdef COMPACT_INTERIORS
+		interiors.split[idx] = MortonType::calcSplitCode(metric, rm);
+#else
+		MortonType::calcSplit(metric, rm, gBoundary.ptMin, gBoundary.ptMax,
+			interiors.splitDim + idx, interiors.splitVal + idx);
+#endif
+	}
+
+	inline void copySplit(InteriorsRawRepr& dst, int dstIdx, const InteriorsRawRepr& src, int srcIdx) {
+#ifdef COMPACT_INTERIORS
+		dst.split[dstIdx] = src.split[srcIdx];
+#else
+		dst.splitDim[dstIdx] = src.splitDim[srcIdx];
+		dst.splitVal[dstIdx] = src.splitVal[srcIdx];
+#endif
+	}
+
+	// data of an array that is only allocated on the first update, null before that
+	template<typename T>
+	inline T* lazyData(const vector<T>& v, size_t offset) {
+		return v.empty() ? nullptr : const_cast<T*>(v.data()) + offset;
+	}
+
 	struct Leaves {
 		//vector<int> primIdx;
 		parlay::sequence<int> segOffset;
@@ -71,6 +134,9 @@ namespace pmkd {
 		vector<int> treeLocalRangeR;  // exclusive, i.e. [L, R)
 		vector<int> replacedBy; // 0: not replaced, -1: removed, positive: replaced
 		vector<int> derivedFrom;
+		// leaf i holds points [bucketOffset[i], bucketOffset[i + 1]), empty if each leaf holds one point
+		// only a static main tree has buckets, see PMKD_Config::bucketSize
+		vector<int> bucketOffset;
 #ifdef ENABLE_MERKLE
 		vector<hash_t> hash;
 #endif
@@ -98,9 +164,9 @@ namespace pmkd {
 #endif
 		}
 
+		// replacedBy is left to allocUpdateState
 		void resizePartial(size_t size) {
 			morton.resize(size);
-			replacedBy.resize(size, 0);
 			parent.resize(size);
 #ifdef ENABLE_MERKLE
 			hash.resize(size);
@@ -115,6 +181,13 @@ namespace pmkd {
 			derivedFrom.resize(size);
 		}
 
+		// allocate the arrays only updates need, return false if they already are
+		bool allocUpdateState() {
+			if (replacedBy.size() == size()) return false;
+			replacedBy.assign(size(), 0);
+			return true;
+		}
+
 		Leaves copyToHost() const {
 			Leaves res;
             res.segOffset = segOffset;
@@ -123,6 +196,7 @@ namespace pmkd {
 			res.treeLocalRangeR = treeLocalRangeR;
             res.replacedBy = replacedBy;
 			res.derivedFrom = derivedFrom;
+			res.bucketOffset = bucketOffset;
 #ifdef ENABLE_MERKLE
 			res.hash = hash;
 #endif
@@ -135,8 +209,9 @@ namespace pmkd {
 				morton.data() + offset,
 				parent.data() + offset,
 				treeLocalRangeR.data() + offset,
-				replacedBy.data() + offset,
+				lazyData(replacedBy, offset),
 				derivedFrom.data() + offset,
+				bucketOffset.empty() ? nullptr : bucketOffset.data() + offset,
 				#ifdef ENABLE_MERKLE
 				hash.data() + offset,
                 #endif
@@ -149,8 +224,9 @@ namespace pmkd {
 				const_cast<MortonType*>(morton.data()) + offset,
 				const_cast<int*>(parent.data()) + offset,
 				const_cast<int*>(treeLocalRangeR.data()) + offset,
-				const_cast<int*>(replacedBy.data()) + offset,
+				lazyData(replacedBy, offset),
 				const_cast<int*>(derivedFrom.data()) + offset,
+				bucketOffset.empty() ? nullptr : const_cast<int*>(bucketOffset.data()) + offset,
 				#ifdef ENABLE_MERKLE
 				const_cast<hash_t*>(hash.data()) + offset,
                 #endif
@@ -160,13 +236,21 @@ namespace pmkd {
 
 	struct Interiors {
 		vector<int> rangeL, rangeR;
+#ifdef COMPACT_INTERIORS
+		// split planes packed into 4 bytes and decoded on the fly, see MortonType::calcSplitCode
+		vector<int> split;
+		AABB boundary;
+#else
 		vector<int> splitDim;
 		vector<mfloat> splitVal;
+#endif
 		vector<int> parent;
 		// for dynamic tree
 		// remove states
 		// 01b: lc removed, 10b: rc removed, 11b: both removed
 		vector<BottomUpState> removeState;
+		// number of valid leaves in the subtree, including those in subtrees that replace its leaves
+		vector<LiveCount> liveCount;
 #ifdef ENABLE_MERKLE
 		vector<BottomUpState> visitState;  // make sure is cleared before use
 		vector<uint8_t> vsLeftChild;
@@ -186,8 +270,12 @@ namespace pmkd {
 		void reserve(size_t capacity) {
 			rangeL.reserve(capacity);
 			rangeR.reserve(capacity);
+#ifdef COMPACT_INTERIORS
+			split.reserve(capacity);
+#else
 			splitDim.reserve(capacity);
 			splitVal.reserve(capacity);
+#endif
 			parent.reserve(capacity);
 
 #ifdef ENABLE_MERKLE
@@ -200,33 +288,82 @@ namespace pmkd {
 		void resize(size_t size) {
 			rangeL.resize(size);
 			rangeR.resize(size);
+#ifdef COMPACT_INTERIORS
+			split.resize(size);
+#else
 			splitDim.resize(size);
 			splitVal.resize(size);
+#endif
 			parent.resize(size);
 			
-			removeState = vector<BottomUpState>(size);
+			liveCount = vector<LiveCount>(size);
+			// stale update state is dropped, allocUpdateState allocates it again
+			removeState = vector<BottomUpState>();
 #ifdef ENABLE_MERKLE
-			visitState = vector<BottomUpState>(size);
-			vsLeftChild.clear();
-			vsLeftChild.resize(size, 0);
-			vsRightChild.clear();
-			vsRightChild.resize(size, 0);
+			visitState = vector<BottomUpState>();
+			vsLeftChild = vector<uint8_t>();
+			vsRightChild = vector<uint8_t>();
 			hash.resize(size);
 #endif
 		}
 
+		// allocate the arrays only updates need, return false if they already are
+		bool allocUpdateState() {
+			if (removeState.size() == size()) return false;
+			removeState = vector<BottomUpState>(size());
+#ifdef ENABLE_MERKLE
+			visitState = vector<BottomUpState>(size());
+			vsLeftChild.assign(size(), 0);
+			vsRightChild.assign(size(), 0);
+#endif
+			return true;
+		}
+
+		// split plane of interior i
+		void getSplit(size_t i, int& dim, mfloat& val) const {
+#ifdef COMPACT_INTERIORS
+			MortonType::decodeSplit(split[i], boundary.ptMin, boundary.ptMax, &dim, &val);
+#else
+			dim = splitDim[i];
+			val = splitVal[i];
+#endif
+		}
+
+		// append the decoded split planes of all interiors
+		void appendSplits(vector<int>& dims, vector<mfloat>& vals) const {
+			size_t n = rangeR.size();
+			dims.reserve(dims.size() + n);
+			vals.reserve(vals.size() + n);
+			for (size_t i = 0; i < n; i++) {
+				int dim;
+				mfloat val;
+				getSplit(i, dim, val);
+				dims.push_back(dim);
+				vals.push_back(val);
+			}
+		}
+
 		Interiors copyToHost() const {
 			Interiors res;
             res.rangeL = rangeL;
             res.rangeR = rangeR;
+#ifdef COMPACT_INTERIORS
+            res.split = split;
+            res.boundary = boundary;
+#else
             res.splitDim = splitDim;
             res.splitVal = splitVal;
+#endif
             res.parent = parent;
 
 			res.removeState = vector<BottomUpState>(removeState.size());
 			for (size_t i = 0; i < removeState.size(); ++i) {
 				res.removeState[i] = removeState[i].load(std::memory_order_relaxed);
 			}
+			res.liveCount = vector<LiveCount>(liveCount.size());
+			for (size_t i = 0; i < liveCount.size(); ++i) {
+				res.liveCount[i] = liveCount[i].load(std::memory_order_relaxed);
+			}
 #ifdef ENABLE_MERKLE
 			res.hash = hash;
 #endif
@@ -236,12 +373,17 @@ namespace pmkd {
 		InteriorsRawRepr getRawRepr(size_t offset = 0u) {
 			return InteriorsRawRepr{
 				rangeL.data() + offset, rangeR.data() + offset,
+				#ifdef COMPACT_INTERIORS
+				split.data() + offset, boundary,
+				#else
 				splitDim.data() + offset,splitVal.data() + offset,
+				#endif
 				parent.data() + offset,
-				removeState.data() + offset,
+				lazyData(removeState, offset),
+				liveCount.data() + offset,
 				#ifdef ENABLE_MERKLE
-				visitState.data() + offset,
-				{vsLeftChild.data() + offset, vsRightChild.data() + offset},
+				lazyData(visitState, offset),
+				{lazyData(vsLeftChild, offset), lazyData(vsRightChild, offset)},
 				hash.data() + offset
 				#endif
 			};
@@ -250,21 +392,32 @@ namespace pmkd {
 		InteriorsRawRepr getRawRepr(size_t offset = 0u) const {
 			return InteriorsRawRepr{
 				const_cast<int*>(rangeL.data())+offset, const_cast<int*>(rangeR.data())+offset,
+				#ifdef COMPACT_INTERIORS
+				const_cast<int*>(split.data()) + offset, boundary,
+				#else
 				const_cast<int*>(splitDim.data())+offset,const_cast<mfloat*>(splitVal.data())+offset,
+				#endif
 				const_cast<int*>(parent.data()) + offset,
-				const_cast<BottomUpState*>(removeState.data()) + offset,
+				lazyData(removeState, offset),
+				const_cast<LiveCount*>(liveCount.data()) + offset,
 				#ifdef ENABLE_MERKLE
-				const_cast<BottomUpState*>(visitState.data()) + offset,
-				{
-					const_cast<uint8_t*>(vsLeftChild.data()) + offset,
-				    const_cast<uint8_t*>(vsRightChild.data()) + offset
-				},
+				lazyData(visitState, offset),
+				{ lazyData(vsLeftChild, offset), lazyData(vsRightChild, offset) },
 				const_cast<hash_t*>(hash.data()) + offset
 				#endif
 			};
 		}
 	};
 
+	// the grid of the jump table has 2^JUMP_TABLE_BITS cells per dimension, i.e. the top 3 * JUMP_TABLE_BITS morton bits
+	constexpr int JUMP_TABLE_BITS = 5;
+
+	// deepest main tree node containing each grid cell, where traversals of points in the cell may start
+	struct JumpTableDevice {
+		const int* node = nullptr;  // interior index, or ~leaf index. null if there is no table
+		AABB boundary;
+	};
+
 	struct NodeMgrDevice {
 		// stored on device
 		size_t numBatches = 0;
@@ -272,13 +425,37 @@ namespace pmkd {
 		InteriorsRawRepr* interiorsBatch = nullptr;
 		vec3f** ptsBatch = nullptr;
 		int* sizesAcc = nullptr;
+		int* chunkBatch = nullptr;
+		JumpTableDevice jumpTable;
+		// points of the main tree minus its leaves, each leaf of a later batch holds one point
+		int pointShift = 0;
 	};
 
+	// global leaf indices are grouped into chunks of 2^LEAF_CHUNK_BITS leaves for batch lookup
+	constexpr int LEAF_CHUNK_BITS = 8;
+
 	inline void transformLeafIdx(int globalIdx, int* sizesAcc, size_t numBatches, int& iBatch, int& offset) {
 		iBatch = std::upper_bound(sizesAcc, sizesAcc + numBatches, globalIdx) - sizesAcc;
 		offset = globalIdx - (iBatch > 0 ? sizesAcc[iBatch-1] : 0);
 	}
 
+	// start from the batch of the first leaf in the chunk, only batches smaller than a chunk need extra steps
+	inline void transformLeafIdx(int globalIdx, const NodeMgrDevice& nodeMgr, int& iBatch, int& offset) {
+		iBatch = nodeMgr.chunkBatch[globalIdx >> LEAF_CHUNK_BITS];
+		while (globalIdx >= nodeMgr.sizesAcc[iBatch]) ++iBatch;
+		offset = globalIdx - (iBatch > 0 ? nodeMgr.sizesAcc[iBatch - 1] : 0);
+	}
+
+	// batch and offset of a global point index, i.e. an index into NodeMgr::flattenPoints()
+	inline void transformPointIdx(int globalIdx, const NodeMgrDevice& nodeMgr, int& iBatch, int& offset) {
+		if (globalIdx < nodeMgr.sizesAcc[0] + nodeMgr.pointShift) {
+			iBatch = 0;
+			offset = globalIdx;
+			return;
+		}
+		transformLeafIdx(globalIdx - nodeMgr.pointShift, nodeMgr, iBatch, offset);
+	}
+
 	class NodeMgr {
 	private:
 		// handles stored on host, data stored on device
@@ -286,18 +463,30 @@ namespace pmkd {
 		vector<Interiors> interiorsBatch;
 		vector<vector<vec3f>> ptsBatch;
 		vector<int> sizesAcc; // inclusive prefix sum of the sizes of each leaf batch
+		vector<int> chunkBatch; // batch of the first leaf in each chunk of global leaf indices
+		vector<vector<Payload>> payloadBatch;  // empty until a payload is given
 
 		// handles stored on device
 		vector<LeavesRawRepr> dLeavesBatch;
 		vector<InteriorsRawRepr> dInteriorsBatch;
 		vector<vec3f*> dPtsBatch;
 		vector<int> dSizesAcc;
+		vector<int> dChunkBatch;
+
+		// jump table of the main tree, indexed by morton prefix
+		vector<int> jumpTable;
+		AABB jumpBoundary;
+
+		void updateChunkBatch();
 
 		void clearHost() {
 			leavesBatch.clear();
 			interiorsBatch.clear();
 			ptsBatch.clear();
 			sizesAcc.clear();
+			chunkBatch.clear();
+			payloadBatch.clear();
+			jumpTable.clear();
 		}
 
 		void clearDevice() {
@@ -305,6 +494,7 @@ namespace pmkd {
 			dInteriorsBatch.clear();
 			dPtsBatch.clear();
 			dSizesAcc.clear();
+			dChunkBatch.clear();
         }
 	public:
 		size_t numBatches() const { return leavesBatch.size(); }
@@ -314,13 +504,24 @@ namespace pmkd {
 			return nB == 0 ? 0 : sizesAcc[nB - 1];
 		}
 
-		void append(Leaves&& leaves, Interiors&& interiors, vector<vec3f>&& pts, bool syncDevice = true);
+		// leaves of the main tree may hold several points, see Leaves::bucketOffset
+		bool isBucketed() const { return numBatches() > 0 && !leavesBatch[0].bucketOffset.empty(); }
+
+		size_t numPoints() const {
+			return numBatches() == 0 ? 0 : numLeaves() + ptsBatch[0].size() - leavesBatch[0].size();
+		}
+
+		void append(Leaves&& leaves, Interiors&& interiors, vector<vec3f>&& pts, vector<Payload>&& payload = {},
+			bool syncDevice = true);
 
 		void clear() {
 			clearHost();
             clearDevice();
 		}
 
+		// drop all batches after the first numKept ones
+		void truncate(size_t numKept);
+
 		const Leaves& getLeaves(size_t batchIdx) const { return leavesBatch[batchIdx]; }
 		Leaves& getLeaves(size_t batchIdx) { return leavesBatch[batchIdx]; }
 
@@ -332,6 +533,20 @@ namespace pmkd {
 
 		vector<vec3f> flattenPoints() const;
 
+		bool hasPayload() const { return !payloadBatch.empty(); }
+
+		const vector<Payload>& getPayloadBatch(size_t batchIdx) const { return payloadBatch[batchIdx]; }
+
+		// payload array of each batch, empty if there are no payloads
+		vector<const Payload*> getPayloadPtrs() const;
+
+		// missing payloads, including those of batches appended before the first payload, are default valued
+		void setPayload(size_t batchIdx, vector<Payload>&& payload);
+
+		Payload getPayload(int globalPointIdx) const;
+
+		vector<Payload> flattenPayloads() const;
+
 		// quick judge, not accurate
 		bool isDeviceSyncronized() const { return dLeavesBatch.size() == leavesBatch.size(); }
 
@@ -339,6 +554,18 @@ namespace pmkd {
 
 		void refitBatch(size_t batchIdx);
 
+		// allocate the update-only arrays of all batches, which static builds leave out
+		// call before the first update, the device handles of the batches are refreshed
+		void prepareUpdates();
+
+		// (re)build the jump table of the main tree over the grid spanning boundary
+		// the table is dropped whenever the main tree changes
+		void buildJumpTable(const AABB& boundary);
+
+		JumpTableDevice getJumpTable() const {
+			return JumpTableDevice{ jumpTable.empty() ? nullptr : jumpTable.data(), jumpBoundary };
+		}
+
 		NodeMgrDevice getDeviceHandle() const;
 
 		struct HostCopy {
@@ -349,6 +576,23 @@ namespace pmkd {
 		};
 
 		HostCopy copyToHost() const;
+
+		// leaves, points and payloads of the current batches for a reader that runs alongside updates
+		// replacedBy is copied, morton, points and payloads are shared and stay valid while no batch is dropped
+		struct LeafSnapshot {
+			vector<LeavesRawRepr> leavesBatch;
+			vector<vec3f*> ptsBatch;
+			vector<int> sizesAcc;
+			vector<int> chunkBatch;
+			vector<const Payload*> payloadBatch;  // empty if there are no payloads
+			vector<vector<int>> replacedBy;
+			int pointShift = 0;
+
+			// no interiors, only leaf lookups are valid
+			NodeMgrDevice getDeviceHandle() const;
+		};
+
+		LeafSnapshot snapshotLeaves() const;
 	};
 
 	struct BuildAid {
@@ -2,13 +2,30 @@
 #include <queue>
 #include <vector>
 #include <memory>
+#include <future>
+#include <type_traits>
+#include <cstring>
 #include <parlay/sequence.h>
+#include <parlay_hash/unordered_map.h>
 
 #include <node.h>
 #include <query_response.h>
+#include <device_helper.h>
 
 namespace pmkd {
 
+	enum class PointQueryEngine {
+		Traversal,  // one root-to-leaf traversal per query
+		MergeJoin,  // merge the sorted queries with the sorted leaves, static tree without buckets only
+		Auto        // MergeJoin on the static tree for at least mergeJoinMinQueries queries
+	};
+
+	enum class RangeQueryEngine {
+		Traversal,  // top-down sprouting over the tree
+		MortonScan, // scan the box's z-order interval of the leaves, static tree without buckets only
+		Auto        // MortonScan per query on the static tree when the interval is short enough
+	};
+
 	struct PMKD_Config {
 		AABB globalBoundary;
 		bool optimize = true;
@@ -16,8 +33,49 @@ namespace pmkd {
 		int maxNumBatches = 20;
 		float maxRemovedRatio = 1.0f; // total removed / total valid before this removal
 		float maxDInsertedRatio = 1.0f; // total dynamically inserted / total valid before this insertion
+		// rebuild in the background instead of stalling the update that triggers it
+		bool asyncRebuild = false;
+		// merge the two newest dynamic batches while the older one is less than levelRatio times larger
+		// keeps the number of batches logarithmic, 0 disables
+		int levelRatio = 0;
+		// keep a hash index of stored points, point queries and remove() look up points there first
+		bool indexPoints = false;
+		PointQueryEngine pointQueryEngine = PointQueryEngine::Traversal;
+		size_t mergeJoinMinQueries = 1 << 16;
+		RangeQueryEngine rangeQueryEngine = RangeQueryEngine::Traversal;
+		// Auto scans a box's interval when it holds at most mortonScanSpanFactor * log2(n) leaves
+		int mortonScanSpanFactor = 16;
+		// descend the main tree with SIMD packets of sorted queries before the per-query traversal
+		// used by point queries, insertion and removal when optimize is on
+		bool packetTraversal = false;
+		// static point and range queries interleave this many queries per worker and prefetch their next nodes
+		// hides memory latency on trees larger than the cache, at most MAX_PREFETCH_GROUP, 0 disables
+		int prefetchGroupSize = 0;
+		// insert() and remove() only record the leaves whose hashes changed, the hashes on their paths
+		// are recomputed once on the next getRootHash() or verifiableQuery()
+		bool lazyMerkle = false;
+		// leaves of the main tree hold up to bucketSize points that are contiguous in z-order, at most MAX_BUCKET_SIZE
+		// divides the interiors of a static tree by about bucketSize, an update splits the buckets it reaches into leaves
+		int bucketSize = 1;
 	};
 
+	struct PointHash {
+		size_t operator()(const vec3f& pt) const {
+			uint64_t h = 0;
+			for (int i = 0; i < 3; i++) {
+				mfloat v = pt[i] + mfloat(0);  // -0 and +0 compare equal, hash them equally
+				uint64_t bits = 0;
+				std::memcpy(&bits, &v, sizeof(v));
+				h = (h ^ bits) * 0x9E3779B97F4A7C15ull;
+				h ^= h >> 32;
+			}
+			return h;
+		}
+	};
+
+	// stored point -> number of live copies
+	using PointIndex = parlay::parlay_unordered_map<vec3f, int, PointHash>;
+
 	struct PMKD_PrintInfo;
 
 	class PMKDTree {
@@ -43,6 +101,23 @@ namespace pmkd {
 		bool isStatic;
 		int nTotalRemoved;
 		int nTotalDInserted;
+
+		// async rebuild, updates arriving during the build are logged and replayed before swapping
+		struct PendingUpdate {
+			vector<vec3f> ptsRemove;
+			vector<vec3f> ptsAdd;
+			vector<Payload> payloadsAdd;
+		};
+		std::unique_ptr<PMKDTree> pendingTree;
+		std::future<void> pendingBuild;
+		vector<PendingUpdate> pendingUpdates;
+
+		std::unique_ptr<PointIndex> pointIndex;  // null unless config.indexPoints
+
+#ifdef ENABLE_MERKLE
+		// global indices of leaves with stale hashes, see PMKD_Config::lazyMerkle
+		mutable vector<int> dirtyLeaves;
+#endif
 	public:
 		PMKDTree();
 
@@ -62,11 +137,39 @@ namespace pmkd {
 
 		std::vector<vec3f> getStoredPoints() const;
 
+		// payloads aligned with getStoredPoints(), default valued if none was given
+		std::vector<Payload> getStoredPayloads() const { return nodeMgr->flattenPayloads(); }
+
+		// payload of an index into getStoredPoints(), as returned by indexQuery(), knnQuery() and forEachInRange()
+		Payload getPayload(int ptIdx) const { return nodeMgr->getPayload(ptIdx); }
+
 		QueryResponses query(const vector<Query>& queries) const;
 
 		RangeQueryResponses query(const vector<RangeQuery>& queries) const;
 
+		// exact results without a per-response capacity, at the cost of traversing twice
+		CompactRangeQueryResponses compactQuery(const vector<RangeQuery>& queries) const;
+
+		// same as query(), but return indices into getStoredPoints() instead of copying points
+		RangeIndexQueryResponses indexQuery(const vector<RangeQuery>& queries) const;
+
+		// number of stored points inside each range, points are not collected
+		vector<uint32_t> countQuery(const vector<RangeQuery>& queries) const;
+
+		// call visit(queryIdx, pt, ptIdx) on every stored point inside queries[queryIdx] without buffering
+		// ptIdx is an index into getStoredPoints()
+		// queries are processed in parallel, visit may return false to stop its query early
+		template<typename Visitor>
+		void forEachInRange(const vector<RangeQuery>& queries, Visitor&& visit) const;
+
+		// points within radii[i] of centers[i]
+		RangeQueryResponses radiusQuery(const vector<Query>& centers, const vector<mfloat>& radii) const;
+
+		// neighbor indices refer to getStoredPoints()
+		KnnQueryResponses knnQuery(const vector<Query>& queries, int k) const;
+
 #ifdef ENABLE_MERKLE
+		// with lazyMerkle, these two bring the hashes up to date first and must not run concurrently with other queries
 		VerifiableRangeQueryResponses
 			verifiableQuery(const vector<RangeQuery>& queries) const;
 
@@ -75,18 +178,29 @@ namespace pmkd {
 
 		void findBin_Experiment(const vector<vec3f>& pts, int version, bool print = false);
 
-		void insert(const vector<vec3f>& ptsAdd);
+		// payloads are optional, payloads[i] is stored with ptsAdd[i]
+		void insert(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads = {});
 
-		void insert_v2(const vector<vec3f>& ptsAdd);
+		void insert_v2(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads = {});
 
-		void firstInsert(const vector<vec3f>& ptsAdd);
+		void firstInsert(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads = {});
 
 		void remove(const vector<vec3f>& ptsRemove);
 
 		void remove_v2(const vector<vec3f>& ptsRemove);
 
 		// mixed operations
-		void execute(const vector<vec3f>& ptsRemove, const vector<vec3f>& ptsAdd);
+		void execute(const vector<vec3f>& ptsRemove, const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd = {});
+
+		// start compacting a snapshot of the tree in the background, no-op if a compaction is pending
+		// queries and updates keep using the current tree until the result is swapped in
+		void compactAsync();
+
+		// swap in the pending compaction after replaying the updates logged since its snapshot
+		// return false if there is none, or if wait is false and it is not finished yet
+		bool finishCompaction(bool wait = true);
+
+		bool isCompacting() const { return pendingTree != nullptr; }
 
 	private:
 		void init();
@@ -94,18 +208,69 @@ namespace pmkd {
 		void sortPts(const vector<vec3f>& pts, vector<vec3f>& ptsSorted) const;
 		void sortPts(const vector<vec3f>& pts, vector<vec3f>& ptsSorted, vector<int>& primIdxInited) const;
 		void sortPts(const vector<vec3f>& pts, vector<vec3f>& ptsSorted, vector<int>& primIdx, vector<MortonType>& mortons) const;
+		// start nodes of the traversals of sorted points, empty if packet traversal is off
+		vector<int> findPacketStarts(const vec3f* pts, size_t n) const;
+
+		// payloads of a new batch, index gi >= ptNum refers to payloadsAdd[gi - ptNum], otherwise to a stored leaf,
+		// which carries the payload of its first point
+		vector<Payload> gatherPayloads(const int* primIdx, size_t size, size_t ptNum, const vector<Payload>& payloadsAdd) const;
+		// same with stored point indices, see transformPointIdx, only reads the given batches
+		vector<Payload> gatherPayloads(const NodeMgrDevice& nodes, const vector<const Payload*>& payloadBatch,
+			const int* primIdx, size_t size, size_t ptNum, const vector<Payload>& payloadsAdd) const;
 
-		void rebuildUponInsert(const vector<vec3f>& ptsAdd);
+		void rebuildUponInsert(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads);
 
 		void rebuildUponRemove(const vector<vec3f>& ptsRemove);
 
-		void buildStatic(const vector<vec3f>& pts);
+		// merge all batches and ptsAdd into a single static batch without removed or replaced leaves
+		void compact(const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd);
+
+		// sorted points with their codes in leaves.morton and payloads of the compacted tree, only reads the given batches
+		void gatherCompacted(const NodeMgrDevice& nodes, const vector<const Payload*>& payloadBatch,
+			const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd,
+			Leaves& leaves, vector<vec3f>& pts, vector<Payload>& payloads) const;
+
+		// build interiors for gathered points as the only batch of an empty tree
+		void buildCompacted(Leaves& leaves, vector<vec3f>& pts, vector<Payload>& payloads);
+
+		void logPendingUpdate(const vector<vec3f>& ptsRemove, const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd);
+
+#ifdef ENABLE_MERKLE
+		// recompute the hashes of the dirty leaves and their paths, deduplicated across updates
+		void refreshMerkle() const;
+#endif
+
+		// remove points that are not stored, ptsRemove is filtered by the point index if there is one
+		void removeStored(const vector<vec3f>& ptsRemove);
+
+		void addToPointIndex(const vector<vec3f>& pts);
+
+		// decrement the counts of pts in the point index and return those that were stored
+		vector<vec3f> takeFromPointIndex(const vector<vec3f>& pts);
+
+		// leveled merging of dynamic batches, see PMKD_Config::levelRatio
+		void mergeLevels();
+
+		// merge batches [firstBatch, numBatches) into one, earlier batches only have their replaced leaves updated
+		void mergeBatches(size_t firstBatch);
+
+		void buildStatic(const vector<vec3f>& pts, const vector<Payload>& payloads);
+
+		// cut sorted points with their codes in leaves.morton into buckets if configured, then hash the leaves
+		void prepareLeaves(Leaves& leaves, const vector<vec3f>& pts) const;
 
 		void buildStatic_LeavesReady(Leaves& leaves, Interiors& interiors);
 
-		void buildIncrement(const vector<vec3f>& ptsAdd);
+		void buildIncrement(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads);
 
-		void buildIncrement_v2(const vector<vec3f>& ptsAdd);
+		void buildIncrement_v2(const vector<vec3f>& ptsAdd, const vector<Payload>& payloads);
+
+		// insert ptsAdd, first splitting the buckets of the main tree that pts reach into single-point leaves
+		// the first point of a bucket stays in its leaf, the others are inserted below it with ptsAdd
+		void splitBuckets(const vector<vec3f>& pts, const vector<vec3f>& ptsAdd, const vector<Payload>& payloadsAdd);
+
+		// set live count of interiors in [0, interiorSize) from the points of the valid leaves of a batch
+		void calcLiveCount(const Leaves& leaves, Interiors& interiors, size_t interiorSize);
 
 		void _query(const vector<RangeQuery>& queries, RangeQueryResponses& responses) const;
 
@@ -192,6 +357,42 @@ namespace pmkd {
 		}
 	};
 
+	template<typename Visitor>
+	void PMKDTree::forEachInRange(const vector<RangeQuery>& queries, Visitor&& visit) const {
+		size_t nq = queries.size();
+		if (nq == 0 || primSize() == 0) return;
+
+		auto visitHit = [&](size_t qIdx, const vec3f& pt, int ptIdx) -> bool {
+			if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, int, const vec3f&, int>>) {
+				visit(int(qIdx), pt, ptIdx);
+				return true;
+			}
+			else return visit(int(qIdx), pt, ptIdx);
+		};
+
+		if (isStatic) {
+			assert(nodeMgr->numBatches() == 1);
+			const auto leaves = nodeMgr->getLeaves(0).getRawRepr();
+			const auto interiors = nodeMgr->getInteriors(0).getRawRepr();
+			const vec3f* pts = nodeMgr->getPtsBatch(0).data();
+			int leafSize = primSize();
+
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				forEachPointInRange(queries[i], pts, leafSize, interiors, leaves,
+					[&](const vec3f& pt, int ptIdx) { return visitHit(i, pt, ptIdx); });
+				});
+		}
+		else {
+			NodeMgrDevice nodeMgrDevice = nodeMgr->getDeviceHandle();
+			int totalLeafSize = primSize();
+
+			parlay::parallel_for(0, nq, [&](size_t i) {
+				forEachPointInRange(queries[i], nodeMgrDevice, totalLeafSize,
+					[&](const vec3f& pt, int ptIdx) { return visitHit(i, pt, ptIdx); });
+				});
+		}
+	}
+
 	struct PMKD_PrintInfo {
 		// leaf index transformed to idx + leafNum
 		// interior index unchanged
@@ -115,6 +115,143 @@ namespace pmkd {
 		}
 	};
 
+	// exact range query responses stored back to back, response i occupies [offset[i], offset[i + 1])
+	struct CompactRangeQueryResponses {
+		vector<int> queryIdx;
+		vector<uint32_t> respSize;
+		parlay::sequence<size_t> offset;
+		vector<vec3f> buffer;
+
+		CompactRangeQueryResponses(size_t num) :queryIdx(num), respSize(num, 0), offset(num + 1, 0) {
+			parlay::parallel_for(0, num, [&](size_t i) {queryIdx[i] = i;});
+		}
+
+		CompactRangeQueryResponses(const CompactRangeQueryResponses&) = delete;
+		CompactRangeQueryResponses& operator=(const CompactRangeQueryResponses&) = delete;
+
+		CompactRangeQueryResponses(CompactRangeQueryResponses&&) = default;
+		CompactRangeQueryResponses& operator=(CompactRangeQueryResponses&&) = default;
+
+		// turn respSize into offsets and allocate the buffer, return the total size
+		size_t initBuffer() {
+			parlay::parallel_for(0, respSize.size(), [&](size_t i) {offset[i] = respSize[i];});
+			size_t total = parlay::scan_inplace(offset);
+			buffer.resize(total);
+			return total;
+		}
+
+		size_t size() const { return respSize.size(); }
+
+		RangeQueryResponse at(uint32_t idx) {
+			return { buffer.data() + offset[idx], respSize.data() + idx };
+		}
+	};
+
+	struct RangeIndexQueryResponse {
+		int* idx = nullptr;      // global point index, i.e. index into PMKDTree::getStoredPoints()
+		uint32_t* size = nullptr;
+	};
+
+	struct RangeIndexQueryResponsesRawRepr {
+		int* buffer;
+		uint32_t* respSize;
+		const uint32_t capPerResponse;
+
+		int* getBufPtr(uint32_t idx) { return buffer + idx * capPerResponse; }
+		uint32_t* getSizePtr(uint32_t idx) { return respSize + idx; }
+	};
+
+	// range query responses holding point indices instead of point coordinates
+	struct RangeIndexQueryResponses {
+		vector<int> queryIdx;
+		vector<int> buffer;
+		vector<uint32_t> respSize;
+		uint32_t numResponse;
+		uint32_t capPerResponse;
+
+		RangeIndexQueryResponses(uint32_t num, uint32_t capacityPerResponse = DEFAULT_MAX_SIZE_PER_RANGE_RESPONSE)
+			:queryIdx(num), buffer(num* capacityPerResponse), respSize(num, 0),
+			numResponse(num), capPerResponse(capacityPerResponse)
+		{
+			parlay::parallel_for(0, num, [&](size_t i) {queryIdx[i] = i;});
+		}
+
+		RangeIndexQueryResponses(const RangeIndexQueryResponses&) = delete;
+		RangeIndexQueryResponses& operator=(const RangeIndexQueryResponses&) = delete;
+
+		RangeIndexQueryResponses(RangeIndexQueryResponses&&) = default;
+		RangeIndexQueryResponses& operator=(RangeIndexQueryResponses&&) = default;
+
+		size_t size() const { return respSize.size(); }
+
+		RangeIndexQueryResponse at(uint32_t idx) {
+			return { buffer.data() + idx * capPerResponse, respSize.data() + idx };
+		}
+
+		RangeIndexQueryResponsesRawRepr getRawRepr() const {
+			return RangeIndexQueryResponsesRawRepr{
+				const_cast<int*>(buffer.data()),
+				const_cast<uint32_t*>(respSize.data()),
+				capPerResponse
+			};
+		}
+	};
+
+	struct KnnQueryResponse {
+		int* idx = nullptr;      // global point index, i.e. index into PMKDTree::getStoredPoints()
+		mfloat* dist = nullptr;
+		uint32_t* size = nullptr;
+	};
+
+	struct KnnQueryResponsesRawRepr {
+		int* idx;
+		mfloat* dist;
+		uint32_t* respSize;
+		const uint32_t k;
+
+		int* getIdxPtr(uint32_t i) { return idx + i * k; }
+		mfloat* getDistPtr(uint32_t i) { return dist + i * k; }
+		uint32_t* getSizePtr(uint32_t i) { return respSize + i; }
+	};
+
+	// k nearest neighbors of each query, sorted by ascending distance
+	struct KnnQueryResponses {
+		vector<int> queryIdx;
+		vector<int> idx;
+		vector<mfloat> dist;
+		vector<uint32_t> respSize;
+		uint32_t numResponse;
+		uint32_t k;
+
+		KnnQueryResponses(uint32_t num, uint32_t k)
+			:queryIdx(num), idx(num* k, -1), dist(num* k),
+			respSize(num, 0), numResponse(num), k(k)
+		{
+			parlay::parallel_for(0, num, [&](size_t i) {queryIdx[i] = i;});
+		}
+
+		KnnQueryResponses(const KnnQueryResponses&) = delete;
+		KnnQueryResponses& operator=(const KnnQueryResponses&) = delete;
+
+		KnnQueryResponses(KnnQueryResponses&&) = default;
+		KnnQueryResponses& operator=(KnnQueryResponses&&) = default;
+
+		size_t size() const { return respSize.size(); }
+
+		KnnQueryResponse at(uint32_t i) {
+			return { idx.data() + i * k, dist.data() + i * k, respSize.data() + i };
+		}
+
+		KnnQueryResponsesRawRepr getRawRepr() const {
+			return KnnQueryResponsesRawRepr{
+				const_cast<int*>(idx.data()),
+				const_cast<mfloat*>(dist.data()),
+				const_cast<uint32_t*>(respSize.data()),
+				k
+			};
+		}
+	};
+
 	struct VerifiableRangeQueryResponses {
 		vector<int> queryIdx;
 		parlay::sequence<int> fOffset;